@@ -0,0 +1,89 @@
+#include <pebble.h>
+#include <allocator.h>
+#include <event_log.h>
+
+#ifdef ENABLE_MEM_ACCOUNTING
+
+//Every block carries this header in front of it, so that mem_free() knows what to account for. 4 bytes to keep the block aligned
+typedef struct {
+	uint16_t size;
+	uint8_t tag;
+	uint8_t reserved;
+} MemHeader;
+
+uint32_t live_bytes[MEM_NUM_TAGS]; //currently allocated bytes per tag (without headers)
+uint32_t peak_bytes[MEM_NUM_TAGS]; //maximum of live_bytes per tag
+uint32_t alloc_count[MEM_NUM_TAGS]; //number of allocations per tag so far
+uint32_t total_live_bytes = 0; //sum of live_bytes (including headers)
+uint32_t total_peak_bytes = 0; //maximum of total_live_bytes
+uint32_t total_alloc_count = 0; //number of allocations so far (all tags)
+uint32_t total_allocated_bytes = 0; //bytes allocated so far (all tags, without headers, never decreases)
+
+void* mem_alloc(MemTag tag, size_t size) { //like malloc, but accounts the block to tag. Returns 0 if out of memory
+	if (size > UINT16_MAX)
+		return 0;
+	MemHeader *header = malloc(sizeof(MemHeader)+size);
+	if (header == 0) {
+		EVENT_WARNING(EVENT_OUT_OF_MEMORY, tag, size);
+		return 0;
+	}
+	
+	header->size = size;
+	header->tag = tag;
+	alloc_count[tag]++;
+	total_alloc_count++;
+	total_allocated_bytes += size;
+	live_bytes[tag] += size;
+	if (live_bytes[tag] > peak_bytes[tag])
+		peak_bytes[tag] = live_bytes[tag];
+	total_live_bytes += sizeof(MemHeader)+size;
+	if (total_live_bytes > total_peak_bytes)
+		total_peak_bytes = total_live_bytes;
+	
+	return header+1;
+}
+
+void mem_free(void* ptr) { //frees a block allocated with mem_alloc (0 is fine)
+	if (ptr == 0)
+		return;
+	MemHeader *header = ((MemHeader*) ptr)-1;
+	live_bytes[header->tag] -= header->size;
+	total_live_bytes -= sizeof(MemHeader)+header->size;
+	free(header);
+}
+
+//Getters for the statistics
+uint32_t mem_live_bytes(MemTag tag) {
+	return live_bytes[tag];
+}
+
+uint32_t mem_peak_bytes(MemTag tag) {
+	return peak_bytes[tag];
+}
+
+uint32_t mem_alloc_count(MemTag tag) {
+	return alloc_count[tag];
+}
+
+uint32_t mem_total_peak_bytes() { //peak of all tags together (including headers)
+	return total_peak_bytes;
+}
+
+uint32_t mem_total_alloc_count() { //allocations so far (for measuring the allocations of some code path)
+	return total_alloc_count;
+}
+
+uint32_t mem_total_allocated_bytes() { //bytes allocated so far
+	return total_allocated_bytes;
+}
+
+#ifdef ENABLE_MEM_LOG
+void mem_log_summary() { //dumps the statistics into the app log
+	static const char *tag_names[MEM_NUM_TAGS] = {"items", "sync buffer", "layer arrays", "texts", "codec", "snapshot"};
+	for (int i=0;i<MEM_NUM_TAGS;i++)
+		APP_LOG(APP_LOG_LEVEL_INFO, "heap %s: live %lu, peak %lu, allocs %lu", tag_names[i], (unsigned long) live_bytes[i], (unsigned long) peak_bytes[i], (unsigned long) alloc_count[i]);
+	APP_LOG(APP_LOG_LEVEL_INFO, "heap total peak %lu", (unsigned long) total_peak_bytes);
+}
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+#include <pebble.h>
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+//Subsystems that heap allocations are accounted to
+typedef enum {
+	MEM_TAG_ITEMS, //AgendaItems (database and sync buffer)
+	MEM_TAG_SYNC_BUFFER, //communication.c's buffer array
+	MEM_TAG_LAYER_ARRAYS, //item_layers, item_texts, day_separator_* arrays
+	MEM_TAG_TEXTS, //time and separator texts
+	MEM_TAG_CODEC, //item_codec.c's chunk and dictionary buffers
+	MEM_TAG_SNAPSHOT, //snapshot entries and the texts of a shown snapshot
+	MEM_NUM_TAGS
+} MemTag;
+
+//Define to account heap allocations per subsystem (see allocator.c). Every block then carries a MEM_BLOCK_OVERHEAD byte header. If undefined,
+//mem_alloc()/mem_free() compile to plain malloc()/free(), the per-tag and total counters are 0 and mem_total_peak_bytes() is the current heap use
+//#define ENABLE_MEM_ACCOUNTING
+
+//Define to dump the heap statistics into the app log when the watchface exits (needs ENABLE_MEM_ACCOUNTING). If undefined, MEM_LOG_SUMMARY() compiles to nothing
+//#define ENABLE_MEM_LOG
+
+#ifdef ENABLE_MEM_ACCOUNTING
+#define MEM_BLOCK_OVERHEAD 4 //sizeof(MemHeader)
+
+//For comments, see allocator.c
+void* mem_alloc(MemTag tag, size_t size);
+void mem_free(void* ptr);
+uint32_t mem_live_bytes(MemTag tag);
+uint32_t mem_peak_bytes(MemTag tag);
+uint32_t mem_alloc_count(MemTag tag);
+uint32_t mem_total_peak_bytes();
+uint32_t mem_total_alloc_count();
+uint32_t mem_total_allocated_bytes();
+#else
+#define MEM_BLOCK_OVERHEAD 0
+
+#define mem_alloc(tag, size) malloc(size)
+#define mem_free(ptr) free(ptr)
+#define mem_live_bytes(tag) ((uint32_t) 0)
+#define mem_peak_bytes(tag) ((uint32_t) 0)
+#define mem_alloc_count(tag) ((uint32_t) 0)
+#define mem_total_peak_bytes() ((uint32_t) heap_bytes_used())
+#define mem_total_alloc_count() ((uint32_t) 0)
+#define mem_total_allocated_bytes() ((uint32_t) 0)
+#endif
+
+#if defined(ENABLE_MEM_LOG) && defined(ENABLE_MEM_ACCOUNTING)
+void mem_log_summary();
+#define MEM_LOG_SUMMARY() mem_log_summary()
+#else
+#define MEM_LOG_SUMMARY()
+#endif
+
+#endif
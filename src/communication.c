@@ -2,10 +2,16 @@
 #include <datatypes.h>
 #include <item_db.h>
 #include <main.h>
+#include <scheduler.h>
+#include <allocator.h>
+#include <probes.h>
+#include <event_log.h>
+#include <stats.h>
+#include <pressure.h>
 #include <communication.h>
 
 //Version of the watchapp. Will be compared to what version the (updated) phone app expects
-#define WATCHAPP_VERSION 13
+#define WATCHAPP_VERSION 14
 #define BACKWARD_COMPAT_VERSION 8
 //BACKWARD_COMPAT_VERSION smallest version number that this version is backwards compatible to (so an Android app bundling that (older) version would still work)
 	
@@ -23,11 +29,25 @@
 #define DICT_KEY_ITEM_INDEX 5
 #define DICT_KEY_SETTINGS_BOOLFLAGS 40
 #define DICT_KEY_VIBRATE 6
+#define DICT_KEY_ITEM_RECURRENCE_RULE 50 //optional (COMMAND_ITEM, COMMAND_ITEM_2): see RECURRENCE_*
+#define DICT_KEY_ITEM_RECURRENCE_COUNT 51 //optional: number of occurrences
 
 //Outgoing dictionary keys
 #define DICT_OUT_KEY_VERSION 0
 #define DICT_OUT_KEY_BACKWARDSVERSION 1
 #define DICT_OUT_KEY_LAST_SYNC_ID 2
+#define DICT_OUT_KEY_CONTENT_HASH 3
+#define DICT_OUT_KEY_NUM_ITEMS 4
+//Performance telemetry (see stats.h)
+#define DICT_OUT_KEY_STAT_REBUILDS 5
+#define DICT_OUT_KEY_STAT_LAST_REBUILD_MS 6
+#define DICT_OUT_KEY_STAT_HEAP_PEAK 7
+#define DICT_OUT_KEY_STAT_DROPPED_INBOUND 8
+#define DICT_OUT_KEY_STAT_SYNC_RESTARTS 9
+#define DICT_OUT_KEY_STAT_PERSIST_BYTES 10
+#define DICT_OUT_KEY_STAT_PERSIST_KEYS 11
+#define DICT_OUT_KEY_STAT_PERSIST_MS 12
+#define DICT_OUT_KEY_MAX_ITEMS 13 //only sent if the watch is low on memory: the phone should send at most this many items
 
 //Commands from phone
 #define COMMAND_INIT_DATA 0
@@ -46,180 +66,560 @@ uint8_t index_expected = 0; //index that the next received item should carry (ot
 uint8_t current_sync_id = 0; //id of the current sync (as reported by phone)
 bool expecting_second_half = false; //true if we still need the second half of the current item
 bool update_request_sent = 0; //whether or not we informed the phone about outdated version
+bool sync_aborted = false; //true if we dropped the current sync because we're out of memory (so don't request a restart when the phone is done)
 
-void send_sync_request(uint8_t report_sync_id) { //Sends a request for fresh data to the phone. Report report_sync_id as last successful sync (0 to force sync)
-	APP_LOG(APP_LOG_LEVEL_DEBUG, "Sending sync request");
+//Outbox queue
+#define OUTBOX_QUEUE_SIZE 4
+#define OUTBOX_MAX_ATTEMPTS 5 //attempts per message before giving up (the scheduler will try again later)
+#define OUTBOX_MIN_RETRY_MS 500
+#define OUTBOX_MAX_RETRY_MS 8000
+
+//Types of outgoing messages
+#define OUTBOX_SYNC_REQUEST 0
+
+typedef struct {
+	uint8_t type; //one of OUTBOX_*
+	uint8_t sync_id; //for OUTBOX_SYNC_REQUEST: sync id to report (0 to force sync)
+	uint8_t attempts; //number of failed attempts to send this message
+} OutboxMessage;
+
+OutboxMessage outbox_queue[OUTBOX_QUEUE_SIZE]; //pending outgoing messages. outbox_queue[0] is the next (or currently sending) one
+uint8_t outbox_depth = 0; //number of messages in outbox_queue
+bool outbox_in_flight = false; //true if outbox_queue[0] has been handed to the system and we're waiting for the ack/nack
+AppTimer *outbox_retry_timer = 0; //timer for resending after failure (or 0)
+uint32_t outbox_retry_ms = OUTBOX_MIN_RETRY_MS; //current retry delay (doubles with each failure)
+
+uint16_t stat_to_uint16(uint32_t value) { //saturating
+	return value > UINT16_MAX ? UINT16_MAX : value;
+}
+
+void write_stats(DictionaryIterator *iter) { //piggybacks the performance counters onto an outgoing message
+	Tuplet stat_tuplets[] = {
+		TupletInteger(DICT_OUT_KEY_STAT_REBUILDS, stat_to_uint16(stats_get(STAT_REBUILDS))),
+		TupletInteger(DICT_OUT_KEY_STAT_LAST_REBUILD_MS, stat_to_uint16(stats_get(STAT_LAST_REBUILD_MS))),
+		TupletInteger(DICT_OUT_KEY_STAT_HEAP_PEAK, stat_to_uint16(mem_total_peak_bytes())),
+		TupletInteger(DICT_OUT_KEY_STAT_DROPPED_INBOUND, stat_to_uint16(stats_get(STAT_DROPPED_INBOUND))),
+		TupletInteger(DICT_OUT_KEY_STAT_SYNC_RESTARTS, stat_to_uint16(stats_get(STAT_SYNC_RESTARTS))),
+		TupletInteger(DICT_OUT_KEY_STAT_PERSIST_BYTES, stat_to_uint16(stats_get(STAT_PERSIST_BYTES))),
+		TupletInteger(DICT_OUT_KEY_STAT_PERSIST_KEYS, stat_to_uint16(stats_get(STAT_PERSIST_KEYS))),
+		TupletInteger(DICT_OUT_KEY_STAT_PERSIST_MS, stat_to_uint16(stats_get(STAT_PERSIST_MS)))
+	};
+	for (unsigned int i=0;i<sizeof(stat_tuplets)/sizeof(Tuplet);i++)
+		dict_write_tuplet(iter, &stat_tuplets[i]);
+}
+
+int communication_outbox_depth() { //number of messages waiting to be sent (including the one in flight)
+	return outbox_depth;
+}
+
+bool communication_sync_in_progress() { //true while items of a sync are still expected
+	return number_expected != 0;
+}
+
+void outbox_retry_timer_callback(void *data);
+void outbox_process();
+
+void outbox_pop() { //removes the head of the queue
+	if (outbox_depth == 0)
+		return;
+	for (int i=1;i<outbox_depth;i++)
+		outbox_queue[i-1] = outbox_queue[i];
+	outbox_depth--;
+	outbox_retry_ms = OUTBOX_MIN_RETRY_MS;
+}
+
+void outbox_schedule_retry() { //retries sending the head of the queue after a delay (exponential backoff)
+	if (outbox_retry_timer != 0)
+		return;
+	outbox_retry_timer = app_timer_register(outbox_retry_ms, outbox_retry_timer_callback, NULL);
+	outbox_retry_ms = outbox_retry_ms*2 > OUTBOX_MAX_RETRY_MS ? OUTBOX_MAX_RETRY_MS : outbox_retry_ms*2;
+}
+
+void outbox_message_failed() { //the head of the queue could not be sent. Retry or give up
+	if (outbox_depth == 0)
+		return;
+	
+	if (++outbox_queue[0].attempts >= OUTBOX_MAX_ATTEMPTS) {
+		EVENT_DEBUG(EVENT_OUTBOX_GIVE_UP, outbox_queue[0].type, 0);
+		if (outbox_queue[0].type == OUTBOX_SYNC_REQUEST)
+			scheduler_sync_failed(time(NULL)); //scheduler will ask again later
+		outbox_pop();
+		outbox_process();
+	}
+	else
+		outbox_schedule_retry();
+}
+
+void outbox_process() { //sends the head of the queue if possible
+	if (outbox_depth == 0 || outbox_in_flight || outbox_retry_timer != 0)
+		return;
+	
 	DictionaryIterator *iter;
-	app_message_outbox_begin(&iter);
-	Tuplet value = TupletInteger(DICT_OUT_KEY_VERSION, WATCHAPP_VERSION);
-	dict_write_tuplet(iter, &value);
-	Tuplet value2 = TupletInteger(DICT_OUT_KEY_BACKWARDSVERSION, BACKWARD_COMPAT_VERSION);
-	dict_write_tuplet(iter, &value2);
-	Tuplet value3 = TupletInteger(DICT_OUT_KEY_LAST_SYNC_ID, report_sync_id);
-	dict_write_tuplet(iter, &value3);
-	app_message_outbox_send();
+	if (app_message_outbox_begin(&iter) != APP_MSG_OK) { //system busy (e.g., still receiving). Try again later
+		outbox_message_failed();
+		return;
+	}
+	
+	OutboxMessage *message = &outbox_queue[0];
+	switch (message->type) {
+		case OUTBOX_SYNC_REQUEST:
+		EVENT_DEBUG(EVENT_SYNC_REQUEST, message->sync_id, 0);
+		Tuplet value = TupletInteger(DICT_OUT_KEY_VERSION, WATCHAPP_VERSION);
+		dict_write_tuplet(iter, &value);
+		Tuplet value2 = TupletInteger(DICT_OUT_KEY_BACKWARDSVERSION, BACKWARD_COMPAT_VERSION);
+		dict_write_tuplet(iter, &value2);
+		Tuplet value3 = TupletInteger(DICT_OUT_KEY_LAST_SYNC_ID, message->sync_id);
+		dict_write_tuplet(iter, &value3);
+		//Report what we have, so that the phone can answer COMMAND_NO_NEW_DATA if its first NUM_ITEMS items hash to the same value (even if sync_id is 0)
+		Tuplet value4 = TupletInteger(DICT_OUT_KEY_CONTENT_HASH, content_hash_to_report());
+		dict_write_tuplet(iter, &value4);
+		Tuplet value5 = TupletInteger(DICT_OUT_KEY_NUM_ITEMS, (uint8_t) db_size());
+		dict_write_tuplet(iter, &value5);
+		write_stats(iter);
+		if (pressure_max_sync_items() != 0) {
+			Tuplet value6 = TupletInteger(DICT_OUT_KEY_MAX_ITEMS, pressure_max_sync_items());
+			dict_write_tuplet(iter, &value6);
+		}
+		break;
+	}
+	
+	if (app_message_outbox_send() != APP_MSG_OK) {
+		outbox_message_failed();
+		return;
+	}
+	stats_increment(STAT_MESSAGES_SENT);
+	outbox_in_flight = true;
+}
+
+void outbox_retry_timer_callback(void *data) {
+	outbox_retry_timer = 0;
+	outbox_process();
+}
+
+void outbox_enqueue(uint8_t type, uint8_t sync_id) { //adds a message to the queue, merging it with an equivalent pending message
+	for (int i=0;i<outbox_depth;i++) {
+		if (outbox_queue[i].type != type)
+			continue;
+		if (type == OUTBOX_SYNC_REQUEST && (i != 0 || !outbox_in_flight)) { //merge with pending request that has not been sent yet. Forcing a sync (0) wins
+			if (sync_id == 0)
+				outbox_queue[i].sync_id = 0;
+			return;
+		}
+		if (outbox_queue[i].sync_id == sync_id || outbox_queue[i].sync_id == 0) //equivalent (or forced) request is in flight already
+			return;
+	}
+	
+	if (outbox_depth >= OUTBOX_QUEUE_SIZE) { //should not happen, as requests of the same type are merged
+		EVENT_WARNING(EVENT_OUTBOX_FULL, type, 0);
+		return;
+	}
+	outbox_queue[outbox_depth++] = (OutboxMessage) {.type = type, .sync_id = sync_id, .attempts = 0};
+	EVENT_DEBUG(EVENT_OUTBOX_DEPTH, outbox_depth, 0);
+}
+
+void send_sync_request(uint8_t report_sync_id) { //Queues a request for fresh data to the phone. Report report_sync_id as last successful sync (0 to force sync)
+	outbox_enqueue(OUTBOX_SYNC_REQUEST, report_sync_id);
+	outbox_process();
+	scheduler_sync_requested(time(NULL));
 	sync_layer_set_progress(0,1);
 }
 
 void out_sent_handler(DictionaryIterator *sent, void *context) {
-	// outgoing message was delivered. Yay ;-)
+	// outgoing message was delivered. Yay ;-) Continue with the next one
+	outbox_in_flight = false;
+	outbox_pop();
+	outbox_process();
 }
 
 void out_failed_handler(DictionaryIterator *failed, AppMessageResult reason, void *context) {
-	APP_LOG(APP_LOG_LEVEL_DEBUG, "Sending failed for reason %d", reason);
+	EVENT_DEBUG(EVENT_SEND_FAILED, reason, 0);
+	outbox_in_flight = false;
+	outbox_message_failed(); //retry later
+}
+
+void outbox_cleanup() { //drops all pending outgoing messages and timers
+	if (outbox_retry_timer != 0)
+		app_timer_cancel(outbox_retry_timer);
+	outbox_retry_timer = 0;
+	outbox_depth = 0;
+	outbox_in_flight = false;
+	outbox_retry_ms = OUTBOX_MIN_RETRY_MS;
+}
+
+
+//Incoming messages are decoded in one pass over the dictionary into this struct (see decode_message())
+typedef struct {
+	uint8_t command;
+	uint8_t version; //COMMAND_INIT_DATA: version the phone expects
+	bool has_sync_id; //COMMAND_INIT_DATA: whether sync_id was sent
+	uint8_t sync_id;
+	uint8_t num_items; //COMMAND_INIT_DATA: number of items that will follow
+	uint32_t settings_flags; //COMMAND_INIT_DATA: boolean settings
+	uint8_t index; //COMMAND_ITEM*: index of the item
+	char *text1, *text2; //COMMAND_ITEM*: row texts (pointing into the dictionary)
+	uint8_t design1, design2;
+	caltime_t start_time, end_time;
+	uint8_t recurrence_rule, recurrence_count; //COMMAND_ITEM, COMMAND_ITEM_2: repetition (RECURRENCE_NONE if not sent)
+	uint8_t vibrate; //COMMAND_DONE: vibration type
+} IncomingMessage;
+
+//Dictionary keys are sparse, so each known key gets a slot (bit) to track which tuples were present
+int dict_key_to_slot(uint32_t key) {
+	switch (key) {
+		case 0: case 1: case 2: case 3: case 4: case 5: case 6:
+			return (int) key;
+		case DICT_KEY_NUM_ITEMS: return 7;
+		case DICT_KEY_ITEM_STARTTIME: return 8;
+		case DICT_KEY_ITEM_ENDTIME: return 9;
+		case DICT_KEY_SETTINGS_BOOLFLAGS: return 10;
+		case DICT_KEY_ITEM_RECURRENCE_RULE: return 11;
+		case DICT_KEY_ITEM_RECURRENCE_COUNT: return 12;
+		default: return -1;
+	}
+}
+#define NUM_DICT_SLOTS 13
+#define SLOT_BIT(key) (1 << dict_key_to_slot(key))
+
+int32_t tuple_get_int(Tuple *tuple) { //reads an integer tuple regardless of its width
+	switch (tuple->length) {
+		case 1: return tuple->type == TUPLE_INT ? tuple->value->int8 : tuple->value->uint8;
+		case 2: return tuple->type == TUPLE_INT ? tuple->value->int16 : tuple->value->uint16;
+		default: return tuple->value->int32;
+	}
+}
+
+bool tuple_is_int(Tuple *tuple) {
+	return (tuple->type == TUPLE_INT || tuple->type == TUPLE_UINT) && (tuple->length == 1 || tuple->length == 2 || tuple->length == 4);
 }
 
+bool tuple_is_cstring(Tuple *tuple) {
+	return tuple->type == TUPLE_CSTRING && tuple->length > 0 && tuple->value->cstring[tuple->length-1] == 0;
+}
+
+//Walks the dictionary once and fills message. Returns false if the message is malformed (missing keys or wrong types for its command)
+bool decode_message(DictionaryIterator *received, IncomingMessage *message) {
+	Tuple *tuples[NUM_DICT_SLOTS];
+	uint16_t found = 0; //bit i set iff tuples[i] is valid
+	
+	for (Tuple *tuple = dict_read_first(received); tuple != NULL; tuple = dict_read_next(received)) {
+		int slot = dict_key_to_slot(tuple->key);
+		if (slot < 0) //unknown key (maybe from a newer phone app). Ignore
+			continue;
+		tuples[slot] = tuple;
+		found |= 1 << slot;
+	}
+	
+	if (!(found & SLOT_BIT(DICT_KEY_COMMAND)) || !tuple_is_int(tuples[0]))
+		return false;
+	message->command = tuple_get_int(tuples[0]);
+	
+	//Figure out which keys this command needs
+	uint16_t required;
+	uint16_t string_keys = 0; //keys that should be strings (all others are integers)
+	switch (message->command) {
+		case COMMAND_INIT_DATA:
+		required = SLOT_BIT(DICT_KEY_VERSION) | SLOT_BIT(DICT_KEY_NUM_ITEMS) | SLOT_BIT(DICT_KEY_SETTINGS_BOOLFLAGS);
+		break;
+		
+		case COMMAND_ITEM:
+		required = SLOT_BIT(DICT_KEY_ITEM_INDEX) | SLOT_BIT(DICT_KEY_ITEM_TEXT1) | SLOT_BIT(DICT_KEY_ITEM_DESIGN1) | SLOT_BIT(DICT_KEY_ITEM_TEXT2) | SLOT_BIT(DICT_KEY_ITEM_DESIGN2) | SLOT_BIT(DICT_KEY_ITEM_STARTTIME) | SLOT_BIT(DICT_KEY_ITEM_ENDTIME);
+		string_keys = SLOT_BIT(DICT_KEY_ITEM_TEXT1) | SLOT_BIT(DICT_KEY_ITEM_TEXT2);
+		break;
+		
+		case COMMAND_ITEM_1:
+		required = SLOT_BIT(DICT_KEY_ITEM_INDEX) | SLOT_BIT(DICT_KEY_ITEM_TEXT1) | SLOT_BIT(DICT_KEY_ITEM_DESIGN1) | SLOT_BIT(DICT_KEY_ITEM_STARTTIME);
+		string_keys = SLOT_BIT(DICT_KEY_ITEM_TEXT1);
+		break;
+		
+		case COMMAND_ITEM_2:
+		required = SLOT_BIT(DICT_KEY_ITEM_INDEX) | SLOT_BIT(DICT_KEY_ITEM_TEXT2) | SLOT_BIT(DICT_KEY_ITEM_DESIGN2) | SLOT_BIT(DICT_KEY_ITEM_ENDTIME);
+		string_keys = SLOT_BIT(DICT_KEY_ITEM_TEXT2);
+		break;
+		
+		default: //COMMAND_DONE, COMMAND_NO_NEW_DATA, COMMAND_FORCE_REQUEST (or unknown): nothing required
+		required = 0;
+		break;
+	}
+	
+	//Validate
+	if ((found & required) != required)
+		return false;
+	for (int i=1; i<NUM_DICT_SLOTS; i++) {
+		if (!(required & (1 << i)))
+			continue;
+		if ((string_keys & (1 << i)) ? !tuple_is_cstring(tuples[i]) : !tuple_is_int(tuples[i]))
+			return false;
+	}
+	
+	//Fill message
+	#define OPTIONAL_INT(key, fallback) ((found & SLOT_BIT(key)) && tuple_is_int(tuples[dict_key_to_slot(key)]) ? tuple_get_int(tuples[dict_key_to_slot(key)]) : (fallback))
+	switch (message->command) {
+		case COMMAND_INIT_DATA:
+		message->version = tuple_get_int(tuples[dict_key_to_slot(DICT_KEY_VERSION)]);
+		message->num_items = tuple_get_int(tuples[dict_key_to_slot(DICT_KEY_NUM_ITEMS)]);
+		message->settings_flags = (uint32_t) tuple_get_int(tuples[dict_key_to_slot(DICT_KEY_SETTINGS_BOOLFLAGS)]);
+		message->has_sync_id = (found & SLOT_BIT(DICT_KEY_SYNC_ID)) && tuple_is_int(tuples[dict_key_to_slot(DICT_KEY_SYNC_ID)]);
+		message->sync_id = OPTIONAL_INT(DICT_KEY_SYNC_ID, 0);
+		break;
+		
+		case COMMAND_ITEM:
+		case COMMAND_ITEM_1:
+		case COMMAND_ITEM_2:
+		message->index = tuple_get_int(tuples[dict_key_to_slot(DICT_KEY_ITEM_INDEX)]);
+		if (message->command != COMMAND_ITEM_2) {
+			message->text1 = tuples[dict_key_to_slot(DICT_KEY_ITEM_TEXT1)]->value->cstring;
+			message->design1 = tuple_get_int(tuples[dict_key_to_slot(DICT_KEY_ITEM_DESIGN1)]);
+			message->start_time = tuple_get_int(tuples[dict_key_to_slot(DICT_KEY_ITEM_STARTTIME)]);
+		}
+		if (message->command != COMMAND_ITEM_1) {
+			message->text2 = tuples[dict_key_to_slot(DICT_KEY_ITEM_TEXT2)]->value->cstring;
+			message->design2 = tuple_get_int(tuples[dict_key_to_slot(DICT_KEY_ITEM_DESIGN2)]);
+			message->end_time = tuple_get_int(tuples[dict_key_to_slot(DICT_KEY_ITEM_ENDTIME)]);
+			message->recurrence_rule = OPTIONAL_INT(DICT_KEY_ITEM_RECURRENCE_RULE, RECURRENCE_NONE);
+			message->recurrence_count = OPTIONAL_INT(DICT_KEY_ITEM_RECURRENCE_COUNT, 0);
+			if (message->recurrence_rule > RECURRENCE_WEEKLY) //unknown rule (newer phone app?): show the first occurrence only
+				message->recurrence_rule = RECURRENCE_NONE;
+		}
+		break;
+		
+		case COMMAND_DONE:
+		message->vibrate = OPTIONAL_INT(DICT_KEY_VIBRATE, 0);
+		break;
+	}
+	#undef OPTIONAL_INT
+	
+	return true;
+}
+
+//Define to log every incoming message (and drop/restart) as one "CAP" line, so that real sync sessions can be recorded from the app log and replayed
+//#define CAPTURE_SYNC_SESSIONS
+
+#ifdef CAPTURE_SYNC_SESSIONS
+uint16_t capture_num_restarts = 0; //restarts requested via handle_sync_failed()
+
+void capture_message(IncomingMessage *m) { //Format: "CAP <type> <fields>[|text1][|text2]"
+	switch (m->command) {
+		case COMMAND_INIT_DATA:
+		APP_LOG(APP_LOG_LEVEL_DEBUG, "CAP I %d %d %d %d %lu", (int) m->version, (int) m->num_items, (int) m->has_sync_id, (int) m->sync_id, (unsigned long) m->settings_flags);
+		break;
+		case COMMAND_ITEM:
+		APP_LOG(APP_LOG_LEVEL_DEBUG, "CAP T %d %d %d %ld %ld %d %d|%s|%s", (int) m->index, (int) m->design1, (int) m->design2, (long) m->start_time, (long) m->end_time, (int) m->recurrence_rule, (int) m->recurrence_count, m->text1, m->text2);
+		break;
+		case COMMAND_ITEM_1:
+		APP_LOG(APP_LOG_LEVEL_DEBUG, "CAP 1 %d %d %ld|%s", (int) m->index, (int) m->design1, (long) m->start_time, m->text1);
+		break;
+		case COMMAND_ITEM_2:
+		APP_LOG(APP_LOG_LEVEL_DEBUG, "CAP 2 %d %d %ld %d %d|%s", (int) m->index, (int) m->design2, (long) m->end_time, (int) m->recurrence_rule, (int) m->recurrence_count, m->text2);
+		break;
+		case COMMAND_DONE:
+		APP_LOG(APP_LOG_LEVEL_DEBUG, "CAP D %d", (int) m->vibrate);
+		break;
+		default:
+		APP_LOG(APP_LOG_LEVEL_DEBUG, "CAP C %d", (int) m->command);
+		break;
+	}
+}
+#define CAPTURE_MESSAGE(m) capture_message(m)
+#define CAPTURE_DROP(reason) APP_LOG(APP_LOG_LEVEL_DEBUG, "CAP X %d", (int) (reason))
+#define CAPTURE_RESTART() APP_LOG(APP_LOG_LEVEL_DEBUG, "CAP R %d", (int) ++capture_num_restarts)
+#else
+#define CAPTURE_MESSAGE(m)
+#define CAPTURE_DROP(reason)
+#define CAPTURE_RESTART()
+#endif
+
+void handle_message(DictionaryIterator *received);
+
+void abort_sync_out_of_memory() { //drops the current sync. The next request asks the phone for fewer items (after the scheduler's retry delay, so that we don't loop)
+	pressure_sync_failed(number_expected);
+	communication_cleanup();
+	number_expected = 0; //ignore the rest of the sync
+	sync_aborted = true;
+	sync_layer_set_progress(0,0);
+	app_comm_set_sniff_interval(SNIFF_INTERVAL_NORMAL);
+	scheduler_sync_failed(time(NULL));
+}
 
 void in_received_handler(DictionaryIterator *received, void *context) {
-	Tuple *command = dict_find(received, DICT_KEY_COMMAND);
+	PROBE_START(PROBE_IN_RECEIVED);
+	stats_increment(STAT_WAKEUPS);
+	stats_increment(STAT_MESSAGES_RECEIVED);
+	handle_message(received);
+	PROBE_END(PROBE_IN_RECEIVED);
+}
+
+void handle_message(DictionaryIterator *received) { //decodes and processes an incoming message
+	IncomingMessage message;
+	if (!decode_message(received, &message)) {
+		EVENT_WARNING(EVENT_MALFORMED_MESSAGE, 0, 0);
+		return;
+	}
+	CAPTURE_MESSAGE(&message);
 	
-	if (command) {
-		//APP_LOG(APP_LOG_LEVEL_DEBUG, "Got message with command %d", (int) command->value->uint8);
-		switch (command->value->uint8) {
-			case COMMAND_INIT_DATA: //First message (starting new sync, giving settings)
-			//Check version number
-			if (dict_find(received, DICT_KEY_VERSION)->value->uint8 > WATCHAPP_VERSION) {
-				if (!update_request_sent) {
-					send_sync_request(0); //make sure the phone knows about our mismatched version
-					update_request_sent = true; //do it only once
-				}
-				return; //ignore message
+	//APP_LOG(APP_LOG_LEVEL_DEBUG, "Got message with command %d", (int) message.command);
+	switch (message.command) {
+		case COMMAND_INIT_DATA: //First message (starting new sync, giving settings)
+		//Check version number
+		if (message.version > WATCHAPP_VERSION) {
+			if (!update_request_sent) {
+				send_sync_request(0); //make sure the phone knows about our mismatched version
+				update_request_sent = true; //do it only once
 			}
-			
-			communication_cleanup(); //clean up if necessary for new data
-
-			number_expected = dict_find(received, DICT_KEY_NUM_ITEMS)->value->uint8;
-			Tuple* sync_id_tuple = dict_find(received, DICT_KEY_SYNC_ID);
-			if (sync_id_tuple != NULL)
-				current_sync_id = sync_id_tuple->value->uint8;
-			APP_LOG(APP_LOG_LEVEL_DEBUG, "starting with sync id %d", current_sync_id);
-			if (number_expected != 0) {
-				//init buffer
-				number_received = 0;
-				index_expected = 0;
-				expecting_second_half = false;
-				buffer_size = 0;
-				buffer = malloc(sizeof(AgendaItem*)*number_expected);
-				
-				APP_LOG(APP_LOG_LEVEL_DEBUG, "Starting sync. Expecting %d items", (int) number_expected);
-
-				//Begin heightened communication status (for faster sync, hopefully)
-				app_comm_set_sniff_interval(SNIFF_INTERVAL_REDUCED);
-			
-				//Show user
-				sync_layer_set_progress(number_received+1, number_expected+2);
-			} else {
-				APP_LOG(APP_LOG_LEVEL_DEBUG, "Phone does not have any items to send");
-				sync_layer_set_progress(0,0);
-				db_reset();
-				handle_new_data(current_sync_id);
-			}
-			
-			//Apply settings from the message
-			settings_set(dict_find(received, DICT_KEY_SETTINGS_BOOLFLAGS)->value->uint32);
-			break;
-			
-			case COMMAND_NO_NEW_DATA: //phone informs us that our data is up-to-date
-				sync_layer_set_progress(0,0);
-				handle_no_new_data();
-			break;
-			
-			case COMMAND_ITEM: //getting an item
-			if (number_expected-number_received != 0 && number_expected != 0) { //check if message is expected				
-				if (index_expected != dict_find(received, DICT_KEY_ITEM_INDEX)->value->uint8 || expecting_second_half) {
-					APP_LOG(APP_LOG_LEVEL_DEBUG, "got unexpected event (wrong index). Ignoring");
-					break;
-				}
-				
-				buffer[number_received] = create_agenda_item();
-				buffer_size++;
-				set_item_row1(buffer[number_received], dict_find(received, DICT_KEY_ITEM_TEXT1)->value->cstring, dict_find(received, DICT_KEY_ITEM_DESIGN1)->value->uint8);
-				set_item_row2(buffer[number_received], dict_find(received, DICT_KEY_ITEM_TEXT2)->value->cstring, dict_find(received, DICT_KEY_ITEM_DESIGN2)->value->uint8);
-				set_item_times(buffer[number_received], dict_find(received, DICT_KEY_ITEM_STARTTIME)->value->int32, dict_find(received, DICT_KEY_ITEM_ENDTIME)->value->int32);
-				number_received++;
-				index_expected++;
-				expecting_second_half = false;
-				sync_layer_set_progress(number_received+1, number_expected+2);
+			return; //ignore message
+		}
+		
+		communication_cleanup(); //clean up if necessary for new data
+		sync_aborted = false;
+
+		number_expected = message.num_items;
+		if (message.has_sync_id)
+			current_sync_id = message.sync_id;
+		EVENT_DEBUG(EVENT_SYNC_START, current_sync_id, number_expected);
+		if (number_expected != 0) {
+			//init buffer
+			number_received = 0;
+			index_expected = 0;
+			expecting_second_half = false;
+			buffer_size = 0;
+			pressure_update();
+			if (pressure_sync_fits(number_expected))
+				buffer = mem_alloc(MEM_TAG_SYNC_BUFFER, sizeof(AgendaItem*)*number_expected);
+			if (buffer == 0)
+				abort_sync_out_of_memory();
+		}
+		if (buffer != 0) {
+			//Begin heightened communication status (for faster sync, hopefully)
+			app_comm_set_sniff_interval(SNIFF_INTERVAL_REDUCED);
+		
+			//Show user
+			sync_layer_set_progress(number_received+1, number_expected+2);
+		} else if (!sync_aborted) {
+			EVENT_DEBUG(EVENT_SYNC_EMPTY, 0, 0);
+			sync_layer_set_progress(0,0);
+			db_reset();
+			handle_new_data(current_sync_id);
+		}
+		
+		//Apply settings from the message
+		settings_set(message.settings_flags);
+		break;
+		
+		case COMMAND_NO_NEW_DATA: //phone informs us that our data is up-to-date
+			sync_layer_set_progress(0,0);
+			handle_no_new_data();
+		break;
+		
+		case COMMAND_ITEM: //getting an item
+		if (number_expected-number_received != 0 && number_expected != 0) { //check if message is expected				
+			if (index_expected != message.index || expecting_second_half) {
+				EVENT_DEBUG(EVENT_UNEXPECTED_ITEM, message.index, index_expected+(expecting_second_half ? 256 : 0));
+				break;
 			}
-			break;
 			
-			case COMMAND_ITEM_1: //getting an item half
-			if (number_expected-number_received != 0 && number_expected != 0) { //check if message is expected				
-				if (index_expected != dict_find(received, DICT_KEY_ITEM_INDEX)->value->uint8 || expecting_second_half) {
-					APP_LOG(APP_LOG_LEVEL_DEBUG, "got unexpected event (wrong index/expecting second half). Ignoring");
-					break;
-				}
-				
-				buffer[number_received] = create_agenda_item();
-				buffer_size++;
-				set_item_row1(buffer[number_received], dict_find(received, DICT_KEY_ITEM_TEXT1)->value->cstring, dict_find(received, DICT_KEY_ITEM_DESIGN1)->value->uint8);
-				set_item_start_time(buffer[number_received], dict_find(received, DICT_KEY_ITEM_STARTTIME)->value->int32);				
-				expecting_second_half = true;
+			if ((buffer[number_received] = create_agenda_item()) == 0) {
+				abort_sync_out_of_memory();
+				break;
 			}
-			break;
-			
-			case COMMAND_ITEM_2: //getting second item half
-			if (number_expected-number_received != 0 && number_expected != 0) { //check if message is expected				
-				if (index_expected != dict_find(received, DICT_KEY_ITEM_INDEX)->value->uint8 || !expecting_second_half) {
-					APP_LOG(APP_LOG_LEVEL_DEBUG, "got unexpected event (wrong index/not expecting second half). Ignoring");
-					break;
-				}
-				
-				set_item_row2(buffer[number_received], dict_find(received, DICT_KEY_ITEM_TEXT2)->value->cstring, dict_find(received, DICT_KEY_ITEM_DESIGN2)->value->uint8);
-				set_item_end_time(buffer[number_received], dict_find(received, DICT_KEY_ITEM_ENDTIME)->value->int32);
-				number_received++;
-				index_expected++;
-				expecting_second_half = false;
-				sync_layer_set_progress(number_received+1, number_expected+2);
+			buffer_size++;
+			set_item_row1(buffer[number_received], message.text1, message.design1);
+			set_item_row2(buffer[number_received], message.text2, message.design2);
+			set_item_times(buffer[number_received], message.start_time, message.end_time);
+			set_item_recurrence(buffer[number_received], message.recurrence_rule, message.recurrence_count);
+			number_received++;
+			index_expected++;
+			expecting_second_half = false;
+			sync_layer_set_progress(number_received+1, number_expected+2);
+			handle_streamed_items(buffer, number_received, number_expected); //show what we have so far
+		}
+		break;
+		
+		case COMMAND_ITEM_1: //getting an item half
+		if (number_expected-number_received != 0 && number_expected != 0) { //check if message is expected				
+			if (index_expected != message.index || expecting_second_half) {
+				EVENT_DEBUG(EVENT_UNEXPECTED_ITEM, message.index, index_expected+(expecting_second_half ? 256 : 0));
+				break;
 			}
-			break;
 			
-			case COMMAND_DONE: //phone signals it sent all its data
-			if (number_expected-number_received == 0 && number_expected != 0) { //is message expected?
-				db_reset(); //reset database
-				
-				for (int i=0;i<number_received;i++) //insert buffered items into database. Database will take care of freeing memory later
-					db_put(buffer[i]);
-				
-				handle_new_data(current_sync_id); //show new data, remember the sync_id
-				
-				//Reset to begin again
-				free(buffer);
-				buffer = 0;
-				buffer_size = 0;
-				number_expected = 0;
-				number_received = 0;
-				index_expected = 0;
-				
-				APP_LOG(APP_LOG_LEVEL_DEBUG, "Sync done");
-				sync_layer_set_progress(0,0);
-				vibrate(dict_find(received, DICT_KEY_VIBRATE)->value->uint8);
+			if ((buffer[number_received] = create_agenda_item()) == 0) {
+				abort_sync_out_of_memory();
+				break;
 			}
-			else {//phone thinks it's done but at some point, we began ignoring (yet ack'ing) its messages. So we request a restart
-				handle_sync_failed();
-				APP_LOG(APP_LOG_LEVEL_DEBUG, "Phone finished sync but something went wrong - requesting restart");
+			buffer_size++;
+			set_item_row1(buffer[number_received], message.text1, message.design1);
+			set_item_start_time(buffer[number_received], message.start_time);				
+			expecting_second_half = true;
+		}
+		break;
+		
+		case COMMAND_ITEM_2: //getting second item half
+		if (number_expected-number_received != 0 && number_expected != 0) { //check if message is expected				
+			if (index_expected != message.index || !expecting_second_half) {
+				EVENT_DEBUG(EVENT_UNEXPECTED_ITEM, message.index, index_expected+(expecting_second_half ? 256 : 0));
+				break;
 			}
-			app_comm_set_sniff_interval(SNIFF_INTERVAL_NORMAL); //stop heightened communcation
-			break;
 			
-			case COMMAND_FORCE_REQUEST: //the phone wants us to request an update (so that we report our version, etc.)
-			APP_LOG(APP_LOG_LEVEL_DEBUG, "Got FORCE_REQUEST");
-			send_sync_request(0);
-			break;
+			set_item_row2(buffer[number_received], message.text2, message.design2);
+			set_item_end_time(buffer[number_received], message.end_time);
+			set_item_recurrence(buffer[number_received], message.recurrence_rule, message.recurrence_count);
+			number_received++;
+			index_expected++;
+			expecting_second_half = false;
+			sync_layer_set_progress(number_received+1, number_expected+2);
+			handle_streamed_items(buffer, number_received, number_expected); //show what we have so far
 		}
+		break;
+		
+		case COMMAND_DONE: //phone signals it sent all its data
+		if (number_expected-number_received == 0 && number_expected != 0) { //is message expected?
+			db_reset(); //reset database
+			
+			for (int i=0;i<number_received;i++) //insert buffered items into database. Database will take care of freeing memory later
+				db_put(buffer[i]);
+			
+			handle_new_data(current_sync_id); //show new data, remember the sync_id
+			EVENT_DEBUG(EVENT_SYNC_DONE, number_received, 0);
+			
+			//Reset to begin again
+			mem_free(buffer);
+			buffer = 0;
+			buffer_size = 0;
+			number_expected = 0;
+			number_received = 0;
+			index_expected = 0;
+			
+			sync_layer_set_progress(0,0);
+			vibrate(message.vibrate);
+		}
+		else if (sync_aborted) //we dropped this sync on purpose (see abort_sync_out_of_memory())
+			sync_aborted = false;
+		else {//phone thinks it's done but at some point, we began ignoring (yet ack'ing) its messages. So we request a restart
+			EVENT_DEBUG(EVENT_SYNC_RESTART, number_received, number_expected);
+			handle_sync_failed();
+			CAPTURE_RESTART();
+		}
+		app_comm_set_sniff_interval(SNIFF_INTERVAL_NORMAL); //stop heightened communcation
+		break;
+		
+		case COMMAND_FORCE_REQUEST: //the phone wants us to request an update (so that we report our version, etc.)
+		EVENT_DEBUG(EVENT_FORCE_REQUEST, 0, 0);
+		send_sync_request(0);
+		break;
 	}
 }
 
 void in_dropped_handler(AppMessageResult reason, void *context) { //incoming message dropped: just reset whole process (simple protocol...)
 	communication_cleanup();
-	APP_LOG(APP_LOG_LEVEL_WARNING, "inbound message dropped (reason %d)", (int) reason);
+	stats_increment(STAT_DROPPED_INBOUND);
+	CAPTURE_DROP(reason);
+	EVENT_WARNING(EVENT_IN_DROPPED, reason, 0);
 }
 
 void communication_cleanup() { //reset everything to start state (also cleans up malloc'ed memory)
 	if (buffer != 0) {
+		handle_stream_aborted(); //main.c might be showing buffered items
 		for (int i=0;i<buffer_size;i++)
-			free(buffer[i]);
-		free(buffer);
+			destroy_agenda_item(buffer[i]);
+		mem_free(buffer);
 		buffer = 0;
 		
 		buffer_size = 0;
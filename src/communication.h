@@ -10,5 +10,8 @@ void out_failed_handler(DictionaryIterator *failed, AppMessageResult reason, voi
 void in_received_handler(DictionaryIterator *received, void *context);
 void in_dropped_handler(AppMessageResult reason, void *context);
 void communication_cleanup();
+int communication_outbox_depth();
+bool communication_sync_in_progress();
+void outbox_cleanup();
 
 #endif
\ No newline at end of file
@@ -1,8 +1,16 @@
 #include<pebble.h>
 #include<datatypes.h>
+#include<allocator.h>
 	
 AgendaItem* create_agenda_item() {
-	return malloc(sizeof(AgendaItem));
+	AgendaItem* item = mem_alloc(MEM_TAG_ITEMS, sizeof(AgendaItem));
+	if (item != 0)
+		set_item_recurrence(item, RECURRENCE_NONE, 0);
+	return item;
+}
+
+void destroy_agenda_item(AgendaItem* item) {
+	mem_free(item);
 }
 
 //Setters
@@ -31,6 +39,123 @@ void set_item_end_time(AgendaItem* item, caltime_t end) {
 	item->end_time = end;
 }
 
+void set_item_recurrence(AgendaItem* item, uint8_t rule, uint8_t count) {
+	item->recurrence_rule = rule;
+	item->recurrence_count = rule == RECURRENCE_NONE ? 0 : count;
+}
+
+bool agenda_item_is_all_day(AgendaItem* item) { //whether item spans whole days (from midnight to midnight). The phone sends those as local dates, so they don't move when the time zone changes
+	return item->end_time > item->start_time && caltime_to_date_only(item->start_time) == item->start_time && caltime_to_date_only(item->end_time) == item->end_time;
+}
+
+//Occurrences
+int agenda_item_num_occurrences(AgendaItem* item) {
+	return item->recurrence_rule == RECURRENCE_NONE || item->recurrence_rule > RECURRENCE_WEEKLY || item->recurrence_count == 0 ? 1 : item->recurrence_count; //(unknown rules: not recurring)
+}
+
+static int occurrence_step_days(AgendaItem* item, int32_t weekday) { //days from an occurrence of item that starts on weekday to the next one (0 for unknown rules)
+	switch (item->recurrence_rule) {
+		case RECURRENCE_DAILY:
+		return 1;
+		
+		case RECURRENCE_WEEKLY:
+		return 7;
+		
+		case RECURRENCE_WEEKDAYS: //skipping the weekend
+		return weekday == 4 ? 3 : weekday == 5 ? 2 : 1;
+		
+		default:
+		return 0;
+	}
+}
+
+AgendaOccurrence agenda_item_occurrence(AgendaItem* item, int n) { //n'th occurrence of item (zero based, the 0th being the item itself). Times are computed on the fly
+	AgendaOccurrence result = {.item = item, .start_time = item->start_time, .end_time = item->end_time};
+	if (n <= 0)
+		return result;
+	if (n >= agenda_item_num_occurrences(item)) {
+		result.item = 0;
+		return result;
+	}
+	
+	//Figure out how many days the n'th occurrence is after the first
+	int days = 0;
+	int32_t weekday = caltime_get_weekday(item->start_time);
+	if (item->recurrence_rule == RECURRENCE_WEEKDAYS && weekday < 5) { //five occurrences per whole week
+		days = n/5*7;
+		n %= 5;
+	}
+	for (;n > 0;n--) {
+		int step = occurrence_step_days(item, weekday);
+		if (step == 0) { //unknown rule (agenda_item_num_occurrences() treats it as not recurring)
+			result.item = 0;
+			return result;
+		}
+		days += step;
+		weekday = (weekday+step)%7;
+	}
+	
+	result.start_time = caltime_add_days(item->start_time, days);
+	if (item->end_time != 0)
+		result.end_time = caltime_add_days(item->end_time, days);
+	return result;
+}
+
+AgendaOccurrence agenda_item_next_occurrence(AgendaOccurrence previous, int n) { //n'th occurrence of previous.item, given the (n-1)'th one in previous. Cheaper than agenda_item_occurrence() when going through the occurrences in order
+	AgendaItem *item = previous.item;
+	if (item == 0 || n <= 0)
+		return item == 0 ? previous : agenda_item_occurrence(item, n);
+	int step = occurrence_step_days(item, caltime_get_weekday(previous.start_time));
+	if (n >= agenda_item_num_occurrences(item) || step == 0)
+		return (AgendaOccurrence) {.item = 0};
+	
+	AgendaOccurrence result = {.item = item, .start_time = caltime_add_days(previous.start_time, step), .end_time = previous.end_time};
+	if (previous.end_time != 0)
+		result.end_time = caltime_add_days(previous.end_time, step);
+	return result;
+}
+
+//FNV-1a hashing of single bytes
+static uint32_t hash_byte(uint32_t hash, uint8_t byte) {
+	return (hash ^ byte) * 16777619u;
+}
+
+uint32_t hash_data(uint32_t hash, const void* data, size_t length) { //continues FNV-1a hash (start with AGENDA_ITEM_HASH_INIT) with raw bytes
+	for (size_t i=0;i<length;i++)
+		hash = hash_byte(hash, ((const uint8_t*) data)[i]);
+	return hash;
+}
+
+static uint32_t hash_int32(uint32_t hash, int32_t value) { //little endian
+	for (int i=0;i<4;i++)
+		hash = hash_byte(hash, (uint8_t) (((uint32_t) value) >> (8*i)));
+	return hash;
+}
+
+static uint32_t hash_string(uint32_t hash, const char* text) { //including the terminating 0
+	do {
+		hash = hash_byte(hash, (uint8_t) *text);
+	} while (*text++ != 0);
+	return hash;
+}
+
+//Continues hash (start with AGENDA_ITEM_HASH_INIT) with the item's content. The phone computes the same hash over what it sends:
+//FNV-1a (32 bit) over row1text\0, row1design, row2text\0, row2design, start_time, end_time (times as 4 bytes, little endian)
+//and, for recurring items only, recurrence_rule, recurrence_count
+uint32_t agenda_item_hash(uint32_t hash, AgendaItem* item) {
+	hash = hash_string(hash, item->row1text);
+	hash = hash_byte(hash, item->row1design);
+	hash = hash_string(hash, item->row2text);
+	hash = hash_byte(hash, item->row2design);
+	hash = hash_int32(hash, item->start_time);
+	hash = hash_int32(hash, item->end_time);
+	if (item->recurrence_rule != RECURRENCE_NONE) {
+		hash = hash_byte(hash, item->recurrence_rule);
+		hash = hash_byte(hash, item->recurrence_count);
+	}
+	return hash;
+}
+
 
 /*void cal_set_title_and_loc(CalendarEvent* event, char* title, char* location) {//strings will be (deep-)copied and truncated if necessary
 	strncpy(event->title, title, sizeof(event->title));
@@ -134,9 +259,45 @@ caltime_t caltime_get_tomorrow(const caltime_t time) { //gives a caltime_t for t
 	return t;
 }
 
-int caltime_month_num_days(caltime_t t) { //Returns the number of days of the current month
-	int year;
-	switch (caltime_get_month(t)) {
+caltime_t caltime_get_yesterday(const caltime_t time) { //gives a caltime_t for yesterday relative to t (date only, no time)
+	caltime_t t = caltime_to_date_only(time);
+	
+	//Normalize day, month, and year if we're at the limits
+	if (caltime_get_day(t) == 1) {
+		//Decrement month (with year underflow)
+		if (caltime_get_month(t) == 1) {
+			t += 60*24*7*32*11; //set month to December
+			t -= 60*24*7*32*12; //decrement year
+		}
+		else
+			t -= 60*24*7*32; //decrement month
+		
+		t += (caltime_month_num_days(t)-1)*60*24*7; //set day to the last of that month
+	}
+	else
+		t -= 60*24*7; //decrement day
+	
+	//Decrement day of the week
+	if (caltime_get_weekday(t) == 0)
+		t += 60*24*6;
+	else
+		t -= 60*24;
+	
+	return t;
+}
+
+caltime_t caltime_add_minutes(caltime_t t, int32_t minutes) { //gives the time minutes later (or earlier if negative), carrying over into other days
+	caltime_t date = caltime_to_date_only(t);
+	int32_t time_of_day = t-date+minutes;
+	for (;time_of_day >= 60*24;time_of_day -= 60*24)
+		date = caltime_get_tomorrow(date);
+	for (;time_of_day < 0;time_of_day += 60*24)
+		date = caltime_get_yesterday(date);
+	return date+time_of_day;
+}
+
+static int month_num_days(int32_t year, int32_t month) { //number of days of month (1-12) in year
+	switch (month) {
 		case 1:
 		case 3:
 		case 5:
@@ -153,7 +314,6 @@ int caltime_month_num_days(caltime_t t) { //Returns the number of days of the cu
 			return 30;
 				
 		case 2:
-			year = (int) caltime_get_year(t);
 			if (year%400 == 0)
 				return 29;
 			if (year%100 == 0)
@@ -164,4 +324,29 @@ int caltime_month_num_days(caltime_t t) { //Returns the number of days of the cu
 		default:
 			return 0;
 	}
-}
\ No newline at end of file
+}
+
+caltime_t caltime_add_days(caltime_t t, int days) { //gives the same time of day, days days later (days >= 0). Goes by whole years and months where it can, so the cost doesn't grow with days
+	caltime_t time_of_day = t-caltime_to_date_only(t);
+	int32_t weekday = (caltime_get_weekday(t)+days)%7;
+	int32_t day = caltime_get_day(t), month = caltime_get_month(t), year = caltime_get_year(t);
+	while (day+days > month_num_days(year, month)) {
+		//The first of the next month
+		days -= month_num_days(year, month)-day+1;
+		day = 1;
+		if (++month > 12) {
+			month = 1;
+			year++;
+		}
+		
+		//Whole years from there (with a February 29 in them or not)
+		for (int year_days;days >= (year_days = month_num_days(month <= 2 ? year : year+1, 2)+337);days -= year_days)
+			year++;
+	}
+	day += days;
+	return time_of_day+weekday*60*24+day*60*24*7+(month-1)*60*24*7*32+(year-1900)*60*24*7*32*12;
+}
+
+int caltime_month_num_days(caltime_t t) { //Returns the number of days of the current month
+	return month_num_days(caltime_get_year(t), caltime_get_month(t));
+}
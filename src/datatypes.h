@@ -19,23 +19,48 @@ typedef int32_t caltime_t; //in format: minutes + 60*hours + 60*24*weekday + 60*
 //The format preserves natural ordering of points in time. 
 //However, no time arithmetic should be done one this directly. There is nothing accounting even for the number of days in a certain month...
 
+//Recurrence rules (for recurrence_rule). A recurring item stands for recurrence_count occurrences, the first one at start_time
+#define RECURRENCE_NONE 0
+#define RECURRENCE_DAILY 1
+#define RECURRENCE_WEEKDAYS 2 //Monday to Friday
+#define RECURRENCE_WEEKLY 3
+
 typedef struct {
 	char row1text[50];
 	char row2text[50];
 	
 	uint8_t row1design, row2design;
+	uint8_t recurrence_rule, recurrence_count; //(these fill what used to be padding, so the struct's size didn't change)
 	
 	caltime_t start_time;
 	caltime_t end_time;
 } AgendaItem;
 
+//One occurrence of an item (see agenda_item_occurrence())
+typedef struct {
+	AgendaItem *item; //texts and designs (0 if there is no such occurrence)
+	caltime_t start_time; //times of this occurrence
+	caltime_t end_time;
+} AgendaOccurrence;
+
+//Initial value for agenda_item_hash() (FNV-1a offset basis)
+#define AGENDA_ITEM_HASH_INIT 2166136261u
+
 //For comments, see datatypes.c
 AgendaItem* create_agenda_item();
+void destroy_agenda_item(AgendaItem* item);
 void set_item_row1(AgendaItem* item, char* text, uint8_t design);
 void set_item_row2(AgendaItem* item, char* text, uint8_t design);
 void set_item_times(AgendaItem* item, caltime_t start, caltime_t end);
 void set_item_start_time(AgendaItem* item, caltime_t start);
 void set_item_end_time(AgendaItem* item, caltime_t end);
+void set_item_recurrence(AgendaItem* item, uint8_t rule, uint8_t count);
+bool agenda_item_is_all_day(AgendaItem* item);
+int agenda_item_num_occurrences(AgendaItem* item);
+AgendaOccurrence agenda_item_occurrence(AgendaItem* item, int n);
+AgendaOccurrence agenda_item_next_occurrence(AgendaOccurrence previous, int n);
+uint32_t agenda_item_hash(uint32_t hash, AgendaItem* item);
+uint32_t hash_data(uint32_t hash, const void* data, size_t length);
 
 caltime_t tm_to_caltime(struct tm *t);
 caltime_t tm_to_caltime_date_only(struct tm *t);
@@ -49,5 +74,8 @@ int32_t caltime_get_day(caltime_t t);
 int32_t caltime_get_month(caltime_t t);
 int32_t caltime_get_year(caltime_t t);
 caltime_t caltime_get_tomorrow(caltime_t t);
+caltime_t caltime_get_yesterday(caltime_t t);
+caltime_t caltime_add_days(caltime_t t, int days);
+caltime_t caltime_add_minutes(caltime_t t, int32_t minutes);
 int caltime_month_num_days(caltime_t t);
 #endif
@@ -0,0 +1,40 @@
+#include <pebble.h>
+#include <event_log.h>
+
+#ifdef EVENT_LOG_LEVEL
+//Number of most recent events kept
+#define EVENT_RING_SIZE 32
+
+typedef struct {
+	int32_t a, b; //arguments (meaning depends on id, see event_log.h)
+	uint16_t time; //seconds since startup (wraps around)
+	uint8_t id; //EventId
+} Event;
+
+Event events[EVENT_RING_SIZE]; //ring buffer of the most recent events
+uint8_t events_next = 0; //position in events for the next event
+uint8_t events_count = 0; //number of valid entries in events
+time_t events_started_at = 0; //time of the first event (reference for Event.time)
+
+void event_log(EventId id, int32_t a, int32_t b) { //records an event. Only stores three numbers, no formatting or logging here, as this is called in hot paths
+	time_t now = time(NULL);
+	if (events_started_at == 0)
+		events_started_at = now;
+	events[events_next] = (Event) {.a = a, .b = b, .time = (uint16_t) (now-events_started_at), .id = id};
+	events_next = (events_next+1)%EVENT_RING_SIZE;
+	if (events_count < EVENT_RING_SIZE)
+		events_count++;
+}
+
+void event_log_dump() { //writes the recorded events into the app log, oldest first (not for hot paths)
+	static const char *event_names[NUM_EVENTS] = {"sync_request", "outbox_depth", "outbox_full", "outbox_give_up", "send_failed", "malformed_message",
+		"sync_start", "sync_empty", "unexpected_item", "sync_done", "sync_restart", "force_request", "in_dropped", "refresh", "offset_change",
+		"out_of_memory", "pressure_level", "sync_out_of_memory", "offset_change_pending",
+		"persist", "persist_out_of_memory", "display_out_of_memory"};
+	for (int i=0;i<events_count;i++) {
+		Event *event = &events[(events_next+EVENT_RING_SIZE-events_count+i)%EVENT_RING_SIZE];
+		APP_LOG(APP_LOG_LEVEL_INFO, "event +%ds %s %ld %ld", (int) event->time, event->id < NUM_EVENTS ? event_names[event->id] : "?", (long) event->a, (long) event->b);
+	}
+	events_count = 0;
+}
+#endif
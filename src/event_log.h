@@ -0,0 +1,67 @@
+#include <pebble.h>
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+//Minimum level of events that are recorded (see event_log.c). Events below it compile to nothing. If undefined (release builds), no events are recorded and EVENT_LOG_DUMP() compiles to nothing
+//#define EVENT_LOG_LEVEL EVENT_LEVEL_DEBUG
+
+//Event levels
+#define EVENT_LEVEL_DEBUG 0
+#define EVENT_LEVEL_INFO 1
+#define EVENT_LEVEL_WARNING 2
+
+//Recorded events (the order must match event_names in event_log.c). Arguments a and b are documented for each
+typedef enum {
+	EVENT_SYNC_REQUEST, //sync request sent. a: reported sync id
+	EVENT_OUTBOX_DEPTH, //message queued. a: queue depth
+	EVENT_OUTBOX_FULL, //message not queued
+	EVENT_OUTBOX_GIVE_UP, //message dropped after too many attempts. a: message type
+	EVENT_SEND_FAILED, //sending failed. a: AppMessageResult
+	EVENT_MALFORMED_MESSAGE, //incoming message ignored
+	EVENT_SYNC_START, //phone starts a sync. a: sync id, b: number of items
+	EVENT_SYNC_EMPTY, //phone has no items
+	EVENT_UNEXPECTED_ITEM, //item message ignored. a: its index, b: expected index (+256 if expecting the second half)
+	EVENT_SYNC_DONE, //sync completed. a: number of items
+	EVENT_SYNC_RESTART, //sync failed, restart requested. a: items received, b: items expected
+	EVENT_FORCE_REQUEST, //phone asked for a sync request
+	EVENT_IN_DROPPED, //incoming message dropped. a: AppMessageResult
+	EVENT_REFRESH, //displayed items refreshed on a tick. a: refresh_at
+	EVENT_OFFSET_CHANGE, //local time offset changed. a: minutes
+	EVENT_OUT_OF_MEMORY, //allocation failed. a: MemTag, b: bytes
+	EVENT_PRESSURE_LEVEL, //memory pressure level changed. a: new PressureLevel, b: bytes free
+	EVENT_SYNC_OUT_OF_MEMORY, //sync ran out of memory. a: items expected, b: items requested from now on
+	EVENT_OFFSET_CHANGE_PENDING, //clock jump that may be an offset change, asking the phone. a: minutes
+	EVENT_PERSIST, //db persisted. a: items, b: bytes written (keys and time: see STAT_PERSIST_*)
+	EVENT_PERSIST_OUT_OF_MEMORY, //db not persisted (no memory for the encoder). a: items
+	EVENT_DISPLAY_OUT_OF_MEMORY, //display arrays not allocated. a: layers, b: day separators
+	NUM_EVENTS
+} EventId;
+
+#ifdef EVENT_LOG_LEVEL
+//For comments, see event_log.c
+void event_log(EventId id, int32_t a, int32_t b);
+void event_log_dump();
+#define EVENT_LOG_DUMP() event_log_dump()
+#else
+#define EVENT_LOG_DUMP()
+#endif
+
+#if defined(EVENT_LOG_LEVEL) && EVENT_LOG_LEVEL <= EVENT_LEVEL_DEBUG
+#define EVENT_DEBUG(id, a, b) event_log(id, a, b)
+#else
+#define EVENT_DEBUG(id, a, b)
+#endif
+
+#if defined(EVENT_LOG_LEVEL) && EVENT_LOG_LEVEL <= EVENT_LEVEL_INFO
+#define EVENT_INFO(id, a, b) event_log(id, a, b)
+#else
+#define EVENT_INFO(id, a, b)
+#endif
+
+#if defined(EVENT_LOG_LEVEL) && EVENT_LOG_LEVEL <= EVENT_LEVEL_WARNING
+#define EVENT_WARNING(id, a, b) event_log(id, a, b)
+#else
+#define EVENT_WARNING(id, a, b)
+#endif
+
+#endif
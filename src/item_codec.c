@@ -0,0 +1,280 @@
+#include <pebble.h>
+#include <datatypes.h>
+#include <allocator.h>
+#include <item_codec.h>
+
+//Compact encoding of agenda items for persistent storage. Items are written one after the other into a byte stream:
+//flags, row1design, [row2design], start time, [end time], [recurrence rule, recurrence count], row1text, [row2text]
+//Start times are zigzag varints relative to the previous item's start time, end times relative to the item's start time.
+//Texts are 0-terminated. Words (separated by spaces) of at least CODEC_MIN_WORD_LENGTH bytes are added to a dictionary
+//the first time they occur, later occurrences are written as the single byte CODEC_TEXT_WORD+index (UTF-8 never starts a character with such a byte).
+//Items hold references into the dictionary, so they have to stay in memory while encoding/decoding.
+//Items don't span chunks, and every chunk starts with an empty dictionary and a previous start time of 0, so that a chunk can be decoded
+//on its own. Where a chunk ends mostly depends on the items' contents (see codec_encode_item()), so changing, adding or removing an item
+//only changes its own chunk (and maybe the next one): the other chunks stay byte-identical and don't have to be rewritten.
+
+//Item flags
+#define CODEC_FLAG_ROW2 0x01 //row2design != 0 (row2design follows, unless CODEC_FLAG_SAME_DESIGN)
+#define CODEC_FLAG_SAME_DESIGN 0x02 //row2design == row1design
+#define CODEC_FLAG_END_TIME 0x04 //end_time != 0 (end time follows)
+#define CODEC_FLAG_ROW2_TEXT 0x08 //row2text is not empty (row2text follows)
+#define CODEC_FLAG_RECURRENCE 0x10 //recurrence_rule != RECURRENCE_NONE (rule and count follow)
+
+//Special bytes in texts
+#define CODEC_TEXT_END 0x00
+#define CODEC_TEXT_ESCAPE 0x01 //followed by a literal byte (CODEC_TEXT_ESCAPE, or a CODEC_TEXT_WORD... byte at the start of a word)
+#define CODEC_TEXT_WORD 0x80 //CODEC_TEXT_WORD+index at the start of a word refers to dictionary entry index (up to CODEC_DICT_SIZE)
+#define CODEC_MIN_WORD_LENGTH 4
+
+typedef char assert_dict_fits_word_bytes[CODEC_TEXT_WORD+CODEC_DICT_SIZE <= 0xC0 ? 1 : -1];
+
+static bool is_word_byte(uint8_t byte) {
+	return byte >= CODEC_TEXT_WORD && byte < CODEC_TEXT_WORD+CODEC_DICT_SIZE;
+}
+
+static uint32_t zigzag(int32_t value) {
+	return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+	return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+static int word_length(const char *text) { //length of the word starting at text
+	int length = 0;
+	while (text[length] != 0 && text[length] != ' ')
+		length++;
+	return length;
+}
+
+static int dict_find_word(CodecWord *dict, uint8_t dict_size, const char *word, int length) { //returns index or -1
+	for (int i=0;i<dict_size;i++)
+		if (dict[i].length == length && memcmp(dict[i].word, word, length) == 0)
+			return i;
+	return -1;
+}
+
+//Encoder
+bool codec_encoder_init(CodecEncoder *encoder, CodecChunkWriter writer, void *context) { //returns false if out of memory
+	memset(encoder, 0, sizeof(CodecEncoder));
+	encoder->chunk = mem_alloc(MEM_TAG_CODEC, CODEC_CHUNK_SIZE+CODEC_MAX_ITEM_SIZE);
+	encoder->dict = mem_alloc(MEM_TAG_CODEC, sizeof(CodecWord)*CODEC_DICT_SIZE);
+	encoder->writer = writer;
+	encoder->context = context;
+	if (encoder->chunk != 0 && encoder->dict != 0)
+		return true;
+	
+	if (encoder->chunk != 0)
+		mem_free(encoder->chunk);
+	if (encoder->dict != 0)
+		mem_free(encoder->dict);
+	return false;
+}
+
+static void write_byte(CodecEncoder *encoder, uint8_t byte) {
+	encoder->chunk[encoder->chunk_pos++] = byte;
+}
+
+static void end_chunk(CodecEncoder *encoder) { //writes the current chunk (if not empty). The next one starts from scratch
+	if (encoder->chunk_pos == 0)
+		return;
+	encoder->writer(encoder->chunk_index++, encoder->chunk, encoder->chunk_pos, encoder->context);
+	encoder->num_bytes += encoder->chunk_pos;
+	encoder->chunk_pos = 0;
+	encoder->dict_size = 0;
+	encoder->previous_start = 0;
+}
+
+static void write_varint(CodecEncoder *encoder, int32_t value) { //zigzag, 7 bits per byte
+	uint32_t v = zigzag(value);
+	while (v >= 0x80) {
+		write_byte(encoder, (v & 0x7F) | 0x80);
+		v >>= 7;
+	}
+	write_byte(encoder, v);
+}
+
+static void write_text(CodecEncoder *encoder, const char *text) {
+	while (*text != 0) {
+		int length = word_length(text);
+		if (length >= CODEC_MIN_WORD_LENGTH) {
+			int index = dict_find_word(encoder->dict, encoder->dict_size, text, length);
+			if (index >= 0) {
+				write_byte(encoder, CODEC_TEXT_WORD+index);
+				text += length;
+				continue;
+			}
+			if (encoder->dict_size < CODEC_DICT_SIZE)
+				encoder->dict[encoder->dict_size++] = (CodecWord) {.word = text, .length = length};
+		}
+		
+		//Literal word and the following space
+		if (text[length] == ' ')
+			length++;
+		for (int i=0;i<length;i++) {
+			if (text[i] == CODEC_TEXT_ESCAPE || (i == 0 && is_word_byte(text[i])))
+				write_byte(encoder, CODEC_TEXT_ESCAPE);
+			write_byte(encoder, text[i]);
+		}
+		text += length;
+	}
+	write_byte(encoder, CODEC_TEXT_END);
+}
+
+static void write_item(CodecEncoder *encoder, AgendaItem *item) {
+	uint8_t flags = (item->row2design != 0 ? CODEC_FLAG_ROW2 : 0) | (item->row2design != 0 && item->row2design == item->row1design ? CODEC_FLAG_SAME_DESIGN : 0)
+		| (item->end_time != 0 ? CODEC_FLAG_END_TIME : 0) | (item->row2text[0] != 0 ? CODEC_FLAG_ROW2_TEXT : 0) | (item->recurrence_rule != RECURRENCE_NONE ? CODEC_FLAG_RECURRENCE : 0);
+	write_byte(encoder, flags);
+	write_byte(encoder, item->row1design);
+	if ((flags & CODEC_FLAG_ROW2) && !(flags & CODEC_FLAG_SAME_DESIGN))
+		write_byte(encoder, item->row2design);
+	
+	write_varint(encoder, item->start_time-encoder->previous_start);
+	encoder->previous_start = item->start_time;
+	if (flags & CODEC_FLAG_END_TIME)
+		write_varint(encoder, item->end_time-item->start_time);
+	if (flags & CODEC_FLAG_RECURRENCE) {
+		write_byte(encoder, item->recurrence_rule);
+		write_byte(encoder, item->recurrence_count);
+	}
+	
+	write_text(encoder, item->row1text);
+	if (flags & CODEC_FLAG_ROW2_TEXT)
+		write_text(encoder, item->row2text);
+}
+
+void codec_encode_item(CodecEncoder *encoder, AgendaItem *item) { //appends the item to the stream
+	int item_start = encoder->chunk_pos;
+	write_item(encoder, item);
+	if (encoder->chunk_pos > CODEC_CHUNK_SIZE) { //doesn't fit anymore: starts the next chunk
+		encoder->chunk_pos = item_start;
+		end_chunk(encoder);
+		write_item(encoder, item);
+	}
+	
+	//End the chunk after items chosen by their content, so that the same items end up in the same chunks even if items before them changed
+	if (encoder->chunk_pos >= CODEC_CHUNK_MIN_FILL && agenda_item_hash(AGENDA_ITEM_HASH_INIT, item)%CODEC_CHUNK_CUT_MODULUS == 0)
+		end_chunk(encoder);
+}
+
+int codec_encoder_finish(CodecEncoder *encoder) { //writes the last chunk and frees the encoder's memory. Returns the length of the stream
+	end_chunk(encoder);
+	mem_free(encoder->chunk);
+	mem_free(encoder->dict);
+	encoder->chunk = 0;
+	encoder->dict = 0;
+	return encoder->num_bytes;
+}
+
+//Decoder
+bool codec_decoder_init(CodecDecoder *decoder, int num_bytes, CodecChunkReader reader, void *context) { //prepares decoding a stream of num_bytes bytes. Returns false if out of memory
+	memset(decoder, 0, sizeof(CodecDecoder));
+	decoder->chunk = mem_alloc(MEM_TAG_CODEC, CODEC_CHUNK_SIZE);
+	decoder->dict = mem_alloc(MEM_TAG_CODEC, sizeof(CodecWord)*CODEC_DICT_SIZE);
+	decoder->bytes_unread = num_bytes;
+	decoder->reader = reader;
+	decoder->context = context;
+	if (decoder->chunk != 0 && decoder->dict != 0)
+		return true;
+	
+	codec_decoder_finish(decoder);
+	return false;
+}
+
+static uint8_t read_byte(CodecDecoder *decoder) { //sets failed (and returns 0) at the end of the stream
+	if (decoder->chunk_pos >= decoder->chunk_length) { //next chunk (starts with a new item, see codec_encode_item())
+		int size = decoder->bytes_unread < CODEC_CHUNK_SIZE ? decoder->bytes_unread : CODEC_CHUNK_SIZE;
+		int length = decoder->failed || size <= 0 ? 0 : decoder->reader(decoder->chunk_index, decoder->chunk, size, decoder->context);
+		if (length <= 0) {
+			decoder->failed = true;
+			return 0;
+		}
+		decoder->chunk_index++;
+		decoder->chunk_length = length;
+		decoder->chunk_pos = 0;
+		decoder->bytes_unread -= length;
+		decoder->dict_size = 0;
+		decoder->previous_start = 0;
+	}
+	return decoder->chunk[decoder->chunk_pos++];
+}
+
+static int32_t read_varint(CodecDecoder *decoder) {
+	uint32_t v = 0;
+	for (int shift=0;shift<35;shift+=7) {
+		uint8_t byte = read_byte(decoder);
+		v |= (uint32_t) (byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return unzigzag(v);
+	}
+	decoder->failed = true;
+	return 0;
+}
+
+static void read_text(CodecDecoder *decoder, char *text, int size) { //text has size bytes
+	int length = 0;
+	int word_start = 0; //start of the current word in text
+	bool word_literal = true; //current word has been written literally (so it's a dictionary candidate)
+	while (!decoder->failed) {
+		uint8_t byte = read_byte(decoder);
+		if (length == word_start && is_word_byte(byte)) {
+			uint8_t index = byte-CODEC_TEXT_WORD;
+			if (index >= decoder->dict_size || length+decoder->dict[index].length >= size)
+				break;
+			memcpy(&text[length], decoder->dict[index].word, decoder->dict[index].length);
+			length += decoder->dict[index].length;
+			word_literal = false;
+			continue;
+		}
+		
+		if (byte == CODEC_TEXT_END || byte == ' ') { //word ends here. Add it to the dictionary as the encoder did
+			if (word_literal && length-word_start >= CODEC_MIN_WORD_LENGTH && decoder->dict_size < CODEC_DICT_SIZE)
+				decoder->dict[decoder->dict_size++] = (CodecWord) {.word = &text[word_start], .length = length-word_start};
+			word_start = length+1;
+			word_literal = true;
+			if (byte == CODEC_TEXT_END) {
+				text[length] = 0;
+				return;
+			}
+		}
+		
+		if (byte == CODEC_TEXT_ESCAPE)
+			byte = read_byte(decoder);
+		if (length+1 >= size)
+			break;
+		text[length++] = byte;
+	}
+	decoder->failed = true;
+	text[0] = 0;
+}
+
+bool codec_decode_item(CodecDecoder *decoder, AgendaItem *item) { //reads the next item from the stream. Returns false if that fails
+	memset(item, 0, sizeof(AgendaItem));
+	uint8_t flags = read_byte(decoder);
+	item->row1design = read_byte(decoder);
+	if (flags & CODEC_FLAG_ROW2)
+		item->row2design = flags & CODEC_FLAG_SAME_DESIGN ? item->row1design : read_byte(decoder);
+	
+	item->start_time = decoder->previous_start+read_varint(decoder);
+	decoder->previous_start = item->start_time;
+	if (flags & CODEC_FLAG_END_TIME)
+		item->end_time = item->start_time+read_varint(decoder);
+	if (flags & CODEC_FLAG_RECURRENCE) {
+		item->recurrence_rule = read_byte(decoder);
+		item->recurrence_count = read_byte(decoder);
+	}
+	
+	read_text(decoder, item->row1text, sizeof(item->row1text));
+	if (flags & CODEC_FLAG_ROW2_TEXT)
+		read_text(decoder, item->row2text, sizeof(item->row2text));
+	return !decoder->failed;
+}
+
+void codec_decoder_finish(CodecDecoder *decoder) { //frees the decoder's memory
+	if (decoder->chunk != 0)
+		mem_free(decoder->chunk);
+	if (decoder->dict != 0)
+		mem_free(decoder->dict);
+	decoder->chunk = 0;
+	decoder->dict = 0;
+}
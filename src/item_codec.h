@@ -0,0 +1,61 @@
+#include <pebble.h>
+#include <datatypes.h>
+#ifndef ITEM_CODEC_H
+#define ITEM_CODEC_H
+
+//Maximal size of the chunks the encoded byte stream is split into (one persistent storage key each)
+#define CODEC_CHUNK_SIZE PERSIST_DATA_MAX_LENGTH
+//Maximal size of an encoded item (every text byte escaped)
+#define CODEC_MAX_ITEM_SIZE (1+2+5+5+2+2*(2*(sizeof(((AgendaItem*) 0)->row1text)-1)+1))
+//A chunk that is filled at least this much ends after an item whose hash is a multiple of CODEC_CHUNK_CUT_MODULUS (see codec_encode_item())
+//(so that a changed item only changes its own chunk: the following chunks keep their boundaries and stay byte-identical)
+#define CODEC_CHUNK_MIN_FILL (CODEC_CHUNK_SIZE/2)
+#define CODEC_CHUNK_CUT_MODULUS 2
+//Maximal number of words in the shared dictionary
+#define CODEC_DICT_SIZE 64
+
+typedef struct {
+	const char *word; //points into an item's text (not 0-terminated)
+	uint8_t length;
+} CodecWord;
+
+//Called for every complete chunk of the stream (up to CODEC_CHUNK_SIZE bytes)
+typedef void (*CodecChunkWriter)(int index, const uint8_t *data, int length, void *context);
+//Should read chunk index into data (up to size bytes). Returns its length (<= 0 on failure)
+typedef int (*CodecChunkReader)(int index, uint8_t *data, int size, void *context);
+
+typedef struct {
+	uint8_t *chunk; //current chunk (CODEC_CHUNK_SIZE+CODEC_MAX_ITEM_SIZE bytes, so that an item that doesn't fit anymore can be moved to the next chunk)
+	int chunk_index; //index of the current chunk (number of chunks after codec_encoder_finish())
+	int chunk_pos; //bytes in chunk
+	int num_bytes; //bytes written so far (in complete chunks)
+	CodecWord *dict;
+	uint8_t dict_size;
+	caltime_t previous_start; //start time of the previous item (times are delta encoded)
+	CodecChunkWriter writer;
+	void *context;
+} CodecEncoder;
+
+typedef struct {
+	uint8_t *chunk; //current chunk
+	int chunk_index; //index of the next chunk to read
+	int chunk_pos; //read position in chunk
+	int chunk_length; //bytes in chunk
+	int bytes_unread; //bytes of the stream that have not been read into chunk yet
+	bool failed; //stream was malformed or couldn't be read
+	CodecWord *dict;
+	uint8_t dict_size;
+	caltime_t previous_start;
+	CodecChunkReader reader;
+	void *context;
+} CodecDecoder;
+
+//For comments, see item_codec.c
+bool codec_encoder_init(CodecEncoder *encoder, CodecChunkWriter writer, void *context);
+void codec_encode_item(CodecEncoder *encoder, AgendaItem *item);
+int codec_encoder_finish(CodecEncoder *encoder);
+bool codec_decoder_init(CodecDecoder *decoder, int num_bytes, CodecChunkReader reader, void *context);
+bool codec_decode_item(CodecDecoder *decoder, AgendaItem *item);
+void codec_decoder_finish(CodecDecoder *decoder);
+
+#endif
@@ -3,33 +3,243 @@
 #include <item_db.h>
 #include <datatypes.h>
 #include <persist_const.h>
+#include <probes.h>
+#include <stats.h>
+#include <event_log.h>
+#include <item_codec.h>
 
 //Maximal number of items this database can store. Should be small enough so persistence memory is not exhausted (also, phone has a limit of items it wants to send, this should correspond to this constant)
 #define NUM_EVENTS_SAVED 30
 
+//Changes are persisted in the background this long after the last change (so that a sync's items are written together)
+#define DB_PERSIST_DELAY_MS 3000
+//Number of items persisted if SETTINGS_BOOL_LIMIT_PERSIST is set
+#define DB_LIMITED_PERSIST_NUM 5
+
+//Items are persisted as one compressed stream (see item_codec.c), split into chunks
+#define DB_PERSIST_FORMAT 2 //version of the format (persisted data with another version is ignored)
+#define DB_MAX_CHUNKS NUM_EVENTS_SAVED //maximal number of chunks (every chunk holds at least one item)
+
+typedef struct {
+	uint8_t format; //DB_PERSIST_FORMAT
+	uint8_t num_items;
+	uint16_t num_bytes; //length of the encoded stream
+	uint8_t num_chunks;
+	uint8_t reserved;
+} DbPersistHeader;
+
 AgendaItem *db_items[NUM_EVENTS_SAVED]; //the 'database' itself
 int current_num_elems = 0; //number of actual entries in db_events
 bool dirty_bit = 0; //1 if there were changes to the database since last persist
+uint32_t content_hash = AGENDA_ITEM_HASH_INIT; //rolling hash over db_items[0..current_num_elems-1]
+int num_persisted = -1; //number of items in persistent storage (-1 if not read yet)
+bool restore_done = false; //true if db_restore_persisted() has nothing (more) to do
+bool restore_failed = false; //true if persisted items couldn't be restored (until the db gets new content)
+CodecDecoder restore_decoder; //decoder state between db_restore_persisted() calls (valid while restore_decoder.chunk != 0)
+AppTimer *persist_timer = 0; //timer for the next background db_persist() (or 0)
+DbPersistHeader persisted_header; //header in persistent storage (if persisted_header_known)
+bool persisted_header_known = false;
+uint32_t persisted_chunk_hashes[DB_MAX_CHUNKS]; //hash_data() of the chunk in persistent storage under PERSIST_DB_CHUNK_PREFIX|i (if known)
+uint32_t persisted_chunk_known = 0; //bit i set iff persisted_chunk_hashes[i] is valid
+uint32_t persist_bytes_written = 0; //statistics for the current db_persist()
+int persist_keys_written = 0;
+
+//Occurrence index: occurrences of all items (recurring items expanded, see agenda_item_occurrence()) that haven't ended yet, sorted by start time
+#define DB_MAX_OCCURRENCES 64
+
+typedef struct {
+	caltime_t start_time;
+	uint8_t item; //index in db_items
+	uint8_t n; //occurrence number
+} DbOccurrence;
+
+DbOccurrence occurrences[DB_MAX_OCCURRENCES];
+int num_occurrences = -1; //number of entries in occurrences (-1 if the index has to be rebuilt)
+caltime_t index_expires_at = 0; //earliest end of an occurrence in the index (0 if none ends). The index should be rebuilt after that (see db_refresh_index())
+bool index_has_recurrences = false; //whether any item has more than one occurrence
+
+//Day index: occurrences grouped by the date they start on
+uint8_t day_first_occurrence[DB_MAX_OCCURRENCES+1]; //index of the first occurrence of day d. day_first_occurrence[num_days] == num_occurrences
+int num_days = 0; //number of days in the index
+
+void db_invalidate_index() { //items changed
+	num_occurrences = -1;
+}
+
+void db_restore_finish() { //no more restoring from persistent storage
+	restore_done = true;
+	codec_decoder_finish(&restore_decoder);
+}
+
+void db_persist_timer_callback(void *data) {
+	persist_timer = 0;
+	db_persist();
+}
+
+void db_schedule_persist() { //marks the database dirty and persists it after DB_PERSIST_DELAY_MS (postponed by further changes)
+	dirty_bit = 1;
+	if (persist_timer != 0)
+		app_timer_cancel(persist_timer);
+	persist_timer = app_timer_register(DB_PERSIST_DELAY_MS, db_persist_timer_callback, NULL);
+}
 
 void db_reset() { //empties database. Also good to call to tidy up occupied heap space
 	handle_data_gone(); //notify main.c of our removing the stuff
+	db_restore_finish(); //db content is replaced, persisted data is obsolete (and the decoder refers to the items)
 	for (int i=0; i<current_num_elems; i++)
-		free(db_items[i]);
+		destroy_agenda_item(db_items[i]);
 	
-	dirty_bit = 1;
+	db_schedule_persist();
 	current_num_elems = 0;
+	db_invalidate_index();
+	content_hash = AGENDA_ITEM_HASH_INIT;
+	restore_failed = false;
 }
 
 int db_size() { //number of elements in the database
 	return current_num_elems;
 }
 
+uint32_t db_content_hash() { //hash over the database's content. Reported to the phone so that it can skip sending unchanged data
+	return content_hash;
+}
+
 void db_put(AgendaItem* item){ //inserts item into database. Associated heap memory for event will now be managed by the db.
 	if (current_num_elems >= NUM_EVENTS_SAVED)
 		return;
 	
-	dirty_bit = 1;
+	db_schedule_persist();
 	db_items[current_num_elems++] = item;
+	db_invalidate_index();
+	content_hash = agenda_item_hash(content_hash, item);
+}
+
+static void rebase_item(AgendaItem* item, int32_t minutes) { //shifts item by minutes unless it's an all-day item (those stay on their dates, like the phone keeps them)
+	if (!agenda_item_is_all_day(item))
+		set_item_times(item, caltime_add_minutes(item->start_time, minutes), item->end_time == 0 ? 0 : caltime_add_minutes(item->end_time, minutes));
+}
+
+uint32_t db_rebased_content_hash(int32_t minutes) { //db_content_hash() as it would be after db_rebase(minutes). Doesn't change the items
+	db_restore_persisted(NUM_EVENTS_SAVED); //(all items count)
+	
+	uint32_t hash = AGENDA_ITEM_HASH_INIT;
+	for (int i=0;i<current_num_elems;i++) {
+		AgendaItem item = *db_items[i];
+		rebase_item(&item, minutes);
+		hash = agenda_item_hash(hash, &item);
+	}
+	return hash;
+}
+
+void db_rebase(int32_t minutes) { //shifts all timed items by minutes (because the local time offset changed by that much). Afterwards, the items are what the phone would send under the new offset
+	db_restore_persisted(NUM_EVENTS_SAVED); //items still in persistent storage need the shift, too
+	
+	content_hash = AGENDA_ITEM_HASH_INIT;
+	for (int i=0;i<current_num_elems;i++) {
+		rebase_item(db_items[i], minutes);
+		content_hash = agenda_item_hash(content_hash, db_items[i]);
+	}
+	
+	if (current_num_elems != 0) {
+		db_schedule_persist();
+		db_invalidate_index();
+	}
+}
+
+void db_build_index() {
+	//Merge the items' occurrence sequences (each sorted by start time), skipping occurrences that ended already (like display_item() does).
+	//Each occurrence is computed from the previous one of its item
+	time_t t = time(NULL);
+	caltime_t now = tm_to_caltime(localtime(&t));
+	uint8_t next[NUM_EVENTS_SAVED]; //next occurrence of item i to merge (agenda_item_num_occurrences() if none left)
+	AgendaOccurrence next_occurrence[NUM_EVENTS_SAVED]; //(occurrence next[i] of item i)
+	uint32_t indexed = 0; //bit i set iff item i has an occurrence in the index
+	int unindexed = 0; //items with occurrences left but none in the index yet. A slot is kept for each, so that every item is shown
+	index_has_recurrences = false;
+	for (int i=0;i<current_num_elems;i++) {
+		int count = agenda_item_num_occurrences(db_items[i]);
+		index_has_recurrences |= count > 1;
+		next[i] = 0;
+		next_occurrence[i] = agenda_item_occurrence(db_items[i], 0);
+		while (next_occurrence[i].item != 0 && next_occurrence[i].end_time != 0 && next_occurrence[i].end_time < now)
+			next_occurrence[i] = agenda_item_next_occurrence(next_occurrence[i], ++next[i]);
+		if (next_occurrence[i].item != 0)
+			unindexed++;
+	}
+	
+	num_occurrences = 0;
+	index_expires_at = 0;
+	while (num_occurrences < DB_MAX_OCCURRENCES) {
+		int best = -1; //item with the earliest next occurrence (the first such item for equal start times)
+		for (int i=0;i<current_num_elems;i++)
+			if (next_occurrence[i].item != 0 && (best < 0 || next_occurrence[i].start_time < next_occurrence[best].start_time))
+				best = i;
+		if (best < 0)
+			break;
+		
+		if (indexed & (1<<best)) { //a repetition. Only if that leaves space for the items that aren't in the index yet
+			if (num_occurrences+unindexed >= DB_MAX_OCCURRENCES) {
+				next_occurrence[best].item = 0;
+				continue;
+			}
+		} else {
+			indexed |= 1<<best;
+			unindexed--;
+		}
+		
+		occurrences[num_occurrences++] = (DbOccurrence) {.start_time = next_occurrence[best].start_time, .item = best, .n = next[best]};
+		if (next_occurrence[best].end_time != 0 && (index_expires_at == 0 || next_occurrence[best].end_time < index_expires_at))
+			index_expires_at = next_occurrence[best].end_time;
+		next_occurrence[best] = agenda_item_next_occurrence(next_occurrence[best], ++next[best]);
+	}
+	
+	num_days = 0;
+	for (int i=0;i<num_occurrences;i++)
+		if (i == 0 || caltime_to_date_only(occurrences[i].start_time) != caltime_to_date_only(occurrences[i-1].start_time))
+			day_first_occurrence[num_days++] = i;
+	day_first_occurrence[num_days] = num_occurrences;
+}
+
+void db_refresh_index() { //rebuilds the occurrence index if an occurrence in it has ended since it was built (so that later repetitions can take its place)
+	if (num_occurrences < 0 || index_expires_at == 0)
+		return;
+	time_t t = time(NULL);
+	if (tm_to_caltime(localtime(&t)) > index_expires_at)
+		db_invalidate_index();
+}
+
+int db_num_occurrences() { //number of occurrences that haven't ended when the index was built (recurring items can have several)
+	if (num_occurrences < 0)
+		db_build_index();
+	return num_occurrences;
+}
+
+AgendaOccurrence db_get_occurrence(int offset) { //gives the offset'th occurrence in order of start time (zero based). .item is 0 if there is no such occurrence
+	if (offset < 0 || offset >= db_num_occurrences())
+		return (AgendaOccurrence) {.item = 0};
+	return agenda_item_occurrence(db_items[occurrences[offset].item], occurrences[offset].n);
+}
+
+bool db_has_recurrences() { //whether any item has more than one occurrence
+	if (num_occurrences < 0)
+		db_build_index();
+	return index_has_recurrences;
+}
+
+int db_num_days() { //number of different dates that occurrences start on
+	if (num_occurrences < 0)
+		db_build_index();
+	return num_days;
+}
+
+int db_day_first_occurrence(int day) { //index of the first occurrence starting on day (0 <= day <= db_num_days(), the latter giving db_num_occurrences())
+	if (num_occurrences < 0)
+		db_build_index();
+	return day_first_occurrence[day < 0 ? 0 : day > num_days ? num_days : day];
+}
+
+caltime_t db_day_date(int day) { //date of day (0 <= day < db_num_days())
+	return caltime_to_date_only(db_get_occurrence(db_day_first_occurrence(day)).start_time);
 }
 
 AgendaItem* db_get(const int offset) { //gives access to the offset'th item (zero based)
@@ -38,31 +248,200 @@ AgendaItem* db_get(const int offset) { //gives access to the offset'th item (zer
 	return db_items[offset];
 }
 
-void db_persist(uint8_t max_num) { //saves (part of) the database into persistent storage.
-	if (!dirty_bit)
+int db_persist_limit() { //number of items to persist according to settings
+	return settings_get_bool_flags() & SETTINGS_BOOL_LIMIT_PERSIST ? DB_LIMITED_PERSIST_NUM : NUM_EVENTS_SAVED;
+}
+
+void db_persist_chunk(int index, const uint8_t *data, int length, void *context) { //CodecChunkWriter: writes the chunk unless it's unchanged
+	uint32_t hash = hash_data(AGENDA_ITEM_HASH_INIT, data, length);
+	if (index < DB_MAX_CHUNKS && (persisted_chunk_known & (1<<index)) && persisted_chunk_hashes[index] == hash)
 		return;
 	
+	int result = persist_write_data(PERSIST_DB_CHUNK_PREFIX|index, data, length);
+	persist_keys_written++;
+	if (index >= DB_MAX_CHUNKS)
+		return;
+	if (result == length) {
+		persist_bytes_written += result;
+		persisted_chunk_hashes[index] = hash;
+		persisted_chunk_known |= 1<<index;
+	} else
+		persisted_chunk_known &= ~(1<<index);
+}
+
+void db_delete_stale_keys(int num_chunks) { //deletes chunks from num_chunks on that belong to an older (longer) stream, and data in the old formats
+	if (!persisted_header_known) { //might not have been restored
+		if (persist_read_data(PERSIST_DB_HEADER, &persisted_header, sizeof(DbPersistHeader)) != sizeof(DbPersistHeader) || persisted_header.format != DB_PERSIST_FORMAT) {
+			memset(&persisted_header, 0, sizeof(DbPersistHeader));
+			persisted_header.num_chunks = DB_MAX_CHUNKS; //unknown: delete whatever is there
+		}
+		persisted_header_known = true;
+	}
+	for (int i=num_chunks;i<persisted_header.num_chunks;i++) {
+		if (!persist_exists(PERSIST_DB_CHUNK_PREFIX|i))
+			continue;
+		persist_delete(PERSIST_DB_CHUNK_PREFIX|i);
+		persisted_chunk_known &= ~(1<<i);
+		persist_keys_written++;
+	}
+	
+	if (persist_exists(PERSIST_NUM_ELEMS)) { //old format: one uncompressed item per key (migrated by db_restore_legacy())
+		for (int i=0;i<NUM_EVENTS_SAVED;i++)
+			if (persist_exists(PERSIST_DB_PREFIX|i))
+				persist_delete(PERSIST_DB_PREFIX|i);
+		persist_delete(PERSIST_NUM_ELEMS);
+		persist_keys_written++;
+	}
+}
+
+void db_persist() { //saves (part of, see db_persist_limit()) the database into persistent storage if it changed. Only chunks that differ from the persisted ones are written
+	if (persist_timer != 0) { //we're doing it now
+		app_timer_cancel(persist_timer);
+		persist_timer = 0;
+	}
+	if (!dirty_bit || !restore_done) //nothing changed, or we only know part of the persisted data (don't overwrite the rest)
+		return;
+	
+	PROBE_START(PROBE_DB_PERSIST);
+	uint32_t started_at = stats_now_ms();
+	int max_num = db_persist_limit();
 	uint8_t num_elems = current_num_elems > max_num ? max_num : current_num_elems;
-	persist_write_int(PERSIST_NUM_ELEMS, num_elems);
+	persist_bytes_written = 0;
+	persist_keys_written = 0;
+	
+	//Write chunks
+	CodecEncoder encoder;
+	if (!codec_encoder_init(&encoder, db_persist_chunk, NULL)) { //try again with the next change (or on exit)
+		EVENT_WARNING(EVENT_PERSIST_OUT_OF_MEMORY, num_elems, 0);
+		PROBE_END(PROBE_DB_PERSIST);
+		return;
+	}
 	for (int i=0;i<num_elems;i++)
-		persist_write_data(PERSIST_DB_PREFIX|i, db_items[i], sizeof(AgendaItem));
+		codec_encode_item(&encoder, db_items[i]);
+	int num_bytes = codec_encoder_finish(&encoder);
+	db_delete_stale_keys(encoder.chunk_index);
+	
+	//Write header (after the chunks it describes)
+	DbPersistHeader header = {.format = DB_PERSIST_FORMAT, .num_items = num_elems, .num_bytes = num_bytes, .num_chunks = encoder.chunk_index, .reserved = 0};
+	if (memcmp(&header, &persisted_header, sizeof(DbPersistHeader)) != 0) {
+		persist_write_data(PERSIST_DB_HEADER, &header, sizeof(DbPersistHeader));
+		persisted_header = header;
+		persist_bytes_written += sizeof(DbPersistHeader);
+		persist_keys_written++;
+	}
+	num_persisted = num_elems;
+	dirty_bit = 0;
+	
+	//Remember what this cost
+	stats_set(STAT_PERSIST_BYTES, persist_bytes_written);
+	stats_set(STAT_PERSIST_KEYS, persist_keys_written);
+	stats_add(STAT_FLASH_WRITES, persist_keys_written);
+	stats_set(STAT_PERSIST_MS, stats_now_ms()-started_at);
+	EVENT_DEBUG(EVENT_PERSIST, num_elems, persist_bytes_written);
+	PROBE_END(PROBE_DB_PERSIST);
+}
+
+void db_cleanup() { //empties the database without persisting it (the last changes should have been persisted with db_persist())
+	db_reset();
+	dirty_bit = 0;
+	if (persist_timer != 0)
+		app_timer_cancel(persist_timer);
+	persist_timer = 0;
+}
+
+int db_num_persisted() { //number of items in persistent storage (only valid after db_restore_persisted() has been called)
+	return num_persisted;
+}
+
+int db_restore_chunk(int index, uint8_t *data, int size, void *context) { //CodecChunkReader: reads a chunk and remembers its hash
+	int length = persist_read_data(PERSIST_DB_CHUNK_PREFIX|index, data, size);
+	if (length <= 0)
+		return length;
+	if (index < DB_MAX_CHUNKS) {
+		persisted_chunk_hashes[index] = hash_data(AGENDA_ITEM_HASH_INIT, data, length);
+		persisted_chunk_known |= 1<<index;
+	}
+	return length;
 }
 
-void db_restore_persisted() { //restores database from persistent storage. Please clear db beforehand if nonempty
-	if (!persist_exists(PERSIST_NUM_ELEMS) || current_num_elems != 0)
+void db_restore_legacy() { //restores items in the old format (one uncompressed AgendaItem per key, written before the codec stream existed). The next db_persist() writes them in the new format and deletes the old keys
+	int num = persist_exists(PERSIST_NUM_ELEMS) ? persist_read_int(PERSIST_NUM_ELEMS) : 0;
+	if (num <= 0)
 		return;
+	if (num > NUM_EVENTS_SAVED)
+		num = NUM_EVENTS_SAVED;
 	
-	current_num_elems = persist_read_int(PERSIST_NUM_ELEMS);
-	if (current_num_elems < 0) { //error code
-		current_num_elems = 0;
-		return;
+	for (int i=0;i<num;i++) {
+		db_items[i] = create_agenda_item();
+		if (db_items[i] == 0 || persist_read_data(PERSIST_DB_PREFIX|i, db_items[i], sizeof(AgendaItem)) != sizeof(AgendaItem)) { //read failure or out of memory
+			if (db_items[i] != 0)
+				destroy_agenda_item(db_items[i]);
+			restore_failed = true;
+			break;
+		}
+		db_items[i]->row1text[sizeof(db_items[i]->row1text)-1] = 0;
+		db_items[i]->row2text[sizeof(db_items[i]->row2text)-1] = 0;
+		db_items[i]->recurrence_rule = 0; //was padding in the old format
+		db_items[i]->recurrence_count = 0;
+		content_hash = agenda_item_hash(content_hash, db_items[i]);
+		current_num_elems = i+1;
 	}
+	num_persisted = current_num_elems;
+	db_invalidate_index();
+	db_schedule_persist();
+}
 
-	for (int i=0;i<current_num_elems;i++) {
-		db_items[i] = malloc(sizeof(AgendaItem));
-		if (persist_read_data(PERSIST_DB_PREFIX|i, db_items[i], sizeof(AgendaItem)) < 0) {
-			current_num_elems = i;
-			return;
+bool db_restore_failed() { //whether persisted items were lost when restoring (the db is incomplete, so the phone should send everything again)
+	return restore_failed;
+}
+
+//restores the first max_num items from persistent storage. Can be called again with a bigger max_num to restore the rest (in stages). Returns true if everything has been restored
+//Restoring stops for good once the db has been changed otherwise (the persisted data is outdated then)
+bool db_restore_persisted(int max_num) {
+	if (restore_done)
+		return true;
+	if (num_persisted < 0) { //first call
+		num_persisted = 0;
+		if (current_num_elems != 0) {
+			db_restore_finish();
+			return true;
+		}
+		int header_size = persist_read_data(PERSIST_DB_HEADER, &persisted_header, sizeof(DbPersistHeader));
+		if (header_size <= 0) { //nothing in a stream format. Maybe in the old one
+			db_restore_legacy();
+			db_restore_finish();
+			return true;
+		}
+		if (header_size != sizeof(DbPersistHeader) || persisted_header.format != DB_PERSIST_FORMAT) { //older stream format: can't be read, the phone has to send everything (num_items is at the same place in all formats)
+			restore_failed = header_size >= 2 && persisted_header.num_items > 0;
+			db_restore_finish();
+			return true;
 		}
+		persisted_header_known = true;
+		if (!codec_decoder_init(&restore_decoder, persisted_header.num_bytes, db_restore_chunk, NULL)) {
+			restore_failed = persisted_header.num_items > 0;
+			db_restore_finish();
+			return true;
+		}
+		num_persisted = persisted_header.num_items > NUM_EVENTS_SAVED ? NUM_EVENTS_SAVED : persisted_header.num_items;
+	}
+	
+	int num = max_num < num_persisted ? max_num : num_persisted;
+	for (int i=current_num_elems;i<num;i++) {
+		db_items[i] = create_agenda_item();
+		if (db_items[i] == 0 || !codec_decode_item(&restore_decoder, db_items[i])) { //read failure or out of memory
+			if (db_items[i] != 0)
+				destroy_agenda_item(db_items[i]);
+			num_persisted = i;
+			restore_failed = true;
+			break;
+		}
+		content_hash = agenda_item_hash(content_hash, db_items[i]);
+		current_num_elems = i+1;
+		db_invalidate_index();
 	}
-}
\ No newline at end of file
+	
+	if (current_num_elems >= num_persisted)
+		db_restore_finish();
+	return restore_done;
+}
@@ -8,7 +8,21 @@ void db_reset(); //empties database. Also good to call to tidy up heap space
 void db_put(AgendaItem* event); //inserts item into database. Associated heap memory for item will now be managed by the db.
 AgendaItem* db_get(const int offset); //gives access to the offset'th item (zero based). Returns 0 if no more entries are available
 int db_size(); //returns number of items in the db
-void db_persist(uint8_t max_num); //saves database into persistent storage.
-void db_restore_persisted(); //restores database from persistent storage.
+int db_num_occurrences(); //number of occurrences (recurring items expanded, ended ones left out)
+AgendaOccurrence db_get_occurrence(int offset); //gives the offset'th occurrence in order of start time. .item is 0 if there is none
+void db_refresh_index(); //rebuilds the occurrence index if occurrences in it have ended
+bool db_has_recurrences(); //whether any item has more than one occurrence
+int db_num_days(); //number of different dates that occurrences start on
+int db_day_first_occurrence(int day); //index of the first occurrence starting on day (day == db_num_days() gives db_num_occurrences())
+caltime_t db_day_date(int day); //date (see caltime_to_date_only()) of day
+void db_rebase(int32_t minutes); //shifts the times of all items but all-day ones by minutes (local time offset changed)
+uint32_t db_rebased_content_hash(int32_t minutes); //db_content_hash() after db_rebase(minutes), without changing anything
+uint32_t db_content_hash(); //returns hash over all items in the db (see agenda_item_hash())
+void db_schedule_persist(); //marks database as changed, persists it in the background after a short delay
+void db_persist(); //saves database into persistent storage now (if it changed)
+void db_cleanup(); //empties the database without persisting it
+bool db_restore_persisted(int max_num); //restores (the first max_num items of the) database from persistent storage. Returns true when done
+int db_num_persisted(); //number of items in persistent storage
+bool db_restore_failed(); //whether persisted items were lost when restoring (then the phone should send everything again)
 
 #endif
\ No newline at end of file
@@ -0,0 +1,24 @@
+#include <pebble.h>
+#include <layout.h>
+
+//Tables indexed by the two-bit size setting. Unknown indices fall back to entry 0
+static const FontMetrics font_metrics[] = {
+	{FONT_KEY_GOTHIC_14, FONT_KEY_GOTHIC_14_BOLD, 16, 28, 15, 9},
+	{FONT_KEY_GOTHIC_18, FONT_KEY_GOTHIC_18_BOLD, 22, 35, 17, 11},
+	{FONT_KEY_GOTHIC_24, FONT_KEY_GOTHIC_24_BOLD, 28, 45, 20, 13}
+};
+#define NUM_FONT_METRICS ((int) (sizeof(font_metrics)/sizeof(font_metrics[0])))
+
+static const HeaderMetrics header_metrics[] = {
+	{RESOURCE_ID_FONT_ROBOTO_CONDENSED_30, FONT_KEY_GOTHIC_14, 33, 74, -3, -2, 15}, //small time
+	{RESOURCE_ID_FONT_ROBOTO_CONDENSED_BOLD_40, FONT_KEY_GOTHIC_18, 44, 98, -6, -2, 18} //big time
+};
+#define NUM_HEADER_METRICS ((int) (sizeof(header_metrics)/sizeof(header_metrics[0])))
+
+const FontMetrics *layout_font_metrics(int font_index) { //metrics of the item font with the given size index
+	return &font_metrics[font_index >= 0 && font_index < NUM_FONT_METRICS ? font_index : 0];
+}
+
+const HeaderMetrics *layout_header_metrics(int header_index) { //metrics of the header with the given size index
+	return &header_metrics[header_index >= 0 && header_index < NUM_HEADER_METRICS ? header_index : 0];
+}
@@ -0,0 +1,38 @@
+#include <pebble.h>
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+//Display dimensions. Everything that depends on the screen size is derived from these
+#define LAYOUT_SCREEN_WIDTH 144
+#define LAYOUT_SCREEN_HEIGHT 168
+
+#define LAYOUT_NO_HEADER_HEIGHT 2 //space above the items if the clock header is disabled
+#define LAYOUT_SCROLL_KEEP_LINES 3 //number of lines that stay visible when scrolling a screen further
+#define LAYOUT_SCROLL_DEFAULT_AMOUNT 130 //scroll amount if there are no items (no line height)
+
+//Metrics for each item font size (SETTINGS_BOOL_FONT_SIZE*)
+typedef struct {
+	const char *font_key; //system font for regular text
+	const char *font_bold_key; //system font for bold text
+	uint8_t line_height; //height of a row
+	uint8_t time_width; //width of a single time ("19:00")
+	uint8_t am_pm_width; //additional width if am/pm is appended
+	uint8_t time_padding; //space between times and text
+} FontMetrics;
+
+//Metrics for each clock header size (SETTINGS_BOOL_HEADER_SIZE*)
+typedef struct {
+	uint32_t time_font_resource; //custom font for the time
+	const char *date_font_key; //system font for date and weekday
+	uint8_t height; //height of the header
+	uint8_t time_width; //width of the time layer
+	int8_t time_y_offset; //vertical offset of the time
+	int8_t weekday_y_offset; //vertical offset of the right side (weekday and date)
+	uint8_t weekday_height; //height of the weekday layer
+} HeaderMetrics;
+
+//For comments, see layout.c
+const FontMetrics *layout_font_metrics(int font_index);
+const HeaderMetrics *layout_header_metrics(int header_index);
+
+#endif
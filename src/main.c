@@ -4,16 +4,29 @@
 #include <communication.h>
 #include <settings.h>
 #include <persist_const.h>
+#include <scheduler.h>
+#include <allocator.h>
+#include <probes.h>
+#include <event_log.h>
+#include <stats.h>
+#include <pressure.h>
+#include <layout.h>
 #include <main.h>
 	
-time_t last_sync = 0; //time where the last successful sync happened
 uint8_t last_sync_id = 0; //id that the phone supplied for the last successful sync
+int32_t pending_offset_change = 0; //clock jump (minutes) that looks like a local time offset change, but hasn't been confirmed by the phone yet (see detect_offset_change())
 caltime_t refresh_at = 0; //time where the item display should be refreshed next
 
 int num_layers = 0; //number of elements in item_layer and item_text
 int elapsed_item_num = 0; //number of items skipped because they were elapsed
 TextLayer **item_layers = 0; //list of all layers that were created for the displayed items
 char **item_texts = 0; //list of texts. item_text[i] corresponds to item_layer[i]. Does not necessarily include all strings (e.g., event texts are saved in the event)
+uint8_t *item_layer_styles = 0; //LAYER_STYLE_* bits of item_layer[i] (needed to save the layout as a snapshot)
+
+//Styles of layers (for item_layer_styles and snapshots)
+#define LAYER_STYLE_BOLD 0x01 //bold font
+#define LAYER_STYLE_ROW_TEXT 0x02 //text portion of a row (GTextOverflowModeFill)
+#define LAYER_STYLE_SEPARATOR 0x04 //day separator
 
 //Font according to settings
 GFont font; //font to use for items (and separators)
@@ -59,39 +72,33 @@ caltime_t get_current_time() { //shortcut to get current caltime_t
 	return tm_to_caltime(localtime(&t));
 }
 
+//Converts refresh_at to a time_t for the sync scheduler. Returns 0 if not today (no arithmetic across days possible with caltime_t)
+time_t get_refresh_boundary() {
+	caltime_t now = get_current_time();
+	if (refresh_at <= now || caltime_to_date_only(refresh_at) != caltime_to_date_only(now))
+		return 0;
+	
+	time_t t = time(NULL);
+	return t-t%60+(refresh_at-now)*60;
+}
+
 //Displays progress of synchronization in the layer (if displayed). Setting max == 0 is valid (then no sync bar)
 void sync_layer_set_progress(int now, int max) {
 	if (sync_indicator_layer == 0)
 		return;
 	
-	int width = max == 0 ? 144 : ((now*144)/max);
+	int width = max == 0 ? LAYOUT_SCREEN_WIDTH : ((now*LAYOUT_SCREEN_WIDTH)/max);
 	
-	layer_set_bounds(text_layer_get_layer(sync_indicator_layer), GRect(width,0,144-width,1));
+	layer_set_bounds(text_layer_get_layer(sync_indicator_layer), GRect(width,0,LAYOUT_SCREEN_WIDTH-width,1));
 }
 
 //Set font variables (font, font_bold, line_height) according to settings
 void set_font_from_settings() {
 	font_index = (int) ((settings_get_bool_flags() & (SETTINGS_BOOL_FONT_SIZE0|SETTINGS_BOOL_FONT_SIZE1))/SETTINGS_BOOL_FONT_SIZE0); //figure out index of the font from settings (two-bit number)
-	switch (font_index) {
-		case 1:
-			font = fonts_get_system_font(FONT_KEY_GOTHIC_18);
-			font_bold = fonts_get_system_font(FONT_KEY_GOTHIC_18_BOLD);
-			line_height = 22;
-		break;
-		
-		case 2:
-			font = fonts_get_system_font(FONT_KEY_GOTHIC_24);
-			font_bold = fonts_get_system_font(FONT_KEY_GOTHIC_24_BOLD);
-			line_height = 28;
-		break;
-		
-		case 0:
-		default:
-			font = fonts_get_system_font(FONT_KEY_GOTHIC_14);
-			font_bold = fonts_get_system_font(FONT_KEY_GOTHIC_14_BOLD);
-			line_height = 16;
-		break;
-	}
+	const FontMetrics *metrics = layout_font_metrics(font_index);
+	font = fonts_get_system_font(metrics->font_key);
+	font_bold = fonts_get_system_font(metrics->font_bold_key);
+	line_height = metrics->line_height;
 }
 
 //Calculate from settings how much horizontal space the time layer should take. I know I could let Pebble measure the text width, but I want this offset to be constant for a consistent look
@@ -99,14 +106,15 @@ int get_item_text_offset(uint8_t row_design, uint8_t number_of_times, bool appen
 	if ((row_design/ROW_DESIGN_TIME_TYPE_OFFSET)%0x8 == 0) //no time displayed
 		return 0;
 	
-	int result = font_index == 2 ? 45 : font_index == 1 ? 35 : 28; //start with basic width
+	const FontMetrics *metrics = layout_font_metrics(font_index);
+	int result = metrics->time_width; //start with basic width
 	if (append_am_pm) //add some if am/pm is displayed
-		result+= font_index == 2 ? 20 : font_index == 1 ? 17 : 15;
+		result+= metrics->am_pm_width;
 	if (number_of_times > 1) { //twice that if actually two times are displayed (like "19:00-20:00")
 		result*=2;
 	} 
 	
-	result += font_index == 2 ? 13 : font_index == 1 ? 11 : 9; //add some more
+	result += metrics->time_padding; //add some more
 	
 	return result;
 }
@@ -144,50 +152,57 @@ void time_to_showstring(char* buffer, size_t buffersize, caltime_t time, caltime
 	}
 }
 
-//Creates the necessary layers for an item. Returns y+[height that the new layers take]. Every item has up to two rows, both consisting of a time and a text portion (either may be empty)
-int create_item_layers(int y, Layer* parent, AgendaItem* item, caltime_t relative_to, bool relative_time) { //relative_to and relative_time as used in time_to_showstring(...)
+//Creates the necessary layers for an item's occurrence. Returns y+[height that the new layers take]. Every item has up to two rows, both consisting of a time and a text portion (either may be empty)
+int create_item_layers(int y, Layer* parent, AgendaOccurrence* occurrence, caltime_t relative_to, bool relative_time) { //relative_to and relative_time as used in time_to_showstring(...)
 	//Get settings
 	uint32_t settings = settings_get_bool_flags();
+	AgendaItem* item = occurrence->item;
 	
 	//Create the row(s)
 	for (int row=0; row<2; row++) {
-		if (row == 1 && item->row2design == 0) //skip second row if design says so
+		if (row == 1 && (item->row2design == 0 || pressure_skip_second_rows())) //skip second row if design says so (or memory is low)
 			continue;
 		
 		//Convenience variables
 		uint8_t row_design = row == 0 ? item->row1design : item->row2design;
 		uint8_t design_time = (row_design/ROW_DESIGN_TIME_TYPE_OFFSET)%0x8;
-		uint8_t row_overflow = (row_design/ROW_DESIGN_TEXT_OVERFLOW_OFFSET)%0x4;
+		uint8_t row_overflow = pressure_single_line_texts() ? 0 : (row_design/ROW_DESIGN_TEXT_OVERFLOW_OFFSET)%0x4;
 		char* row_text = row == 0 ? item->row1text : item->row2text;
 		
 		//Figure out height of this line and the width of the time
 		int time_layer_width = get_item_text_offset(row_design, design_time==3 ? 2 : 1, (settings & SETTINGS_BOOL_12H) && (settings & SETTINGS_BOOL_AMPM) ? 1 : 0); //desired width of time layer
 		int line_height_factor = row_overflow == 2 ? 2 : 1;
-		if (row_overflow == 1 && graphics_text_layout_get_content_size(row_text, row_design & ROW_DESIGN_TEXT_BOLD ? font_bold : font, GRect(time_layer_width,y,144-time_layer_width,line_height*2), GTextOverflowModeFill, GTextAlignmentLeft).h > line_height)  //row_overflow == 1: overflow if necessary
+		if (row_overflow == 1)
+			stats_increment(STAT_TEXT_LAYOUTS);
+		if (row_overflow == 1 && graphics_text_layout_get_content_size(row_text, row_design & ROW_DESIGN_TEXT_BOLD ? font_bold : font, GRect(time_layer_width,y,LAYOUT_SCREEN_WIDTH-time_layer_width,line_height*2), GTextOverflowModeFill, GTextAlignmentLeft).h > line_height)  //row_overflow == 1: overflow if necessary
 			line_height_factor = 2;
 		
-		//Create time text and layer
-		if (design_time != 0) { //should we show any time at all?
-			item_texts[num_layers] = malloc(20*sizeof(char));
+		//Create time text and layer (skipped if out of memory)
+		if (design_time != 0 && (item_texts[num_layers] = mem_alloc(MEM_TAG_TEXTS, 20*sizeof(char))) != 0) { //should we show any time at all?
 			//figure out whether to display start or end time
-			caltime_t time_to_show = design_time == 2 ? item->end_time : item->start_time; 
+			caltime_t time_to_show = design_time == 2 ? occurrence->end_time : occurrence->start_time; 
 			if (design_time == 4) { //Settings say we should show end_time rather than start time iff item has started
-				if (get_current_time() >= item->start_time)
-					time_to_show = item->end_time;
+				if (get_current_time() >= occurrence->start_time)
+					time_to_show = occurrence->end_time;
 			}
 			
-			time_to_showstring(item_texts[num_layers], 20, time_to_show, relative_to, relative_time, settings & SETTINGS_BOOL_12H ? 1 : 0,(settings & SETTINGS_BOOL_12H) && (settings & SETTINGS_BOOL_AMPM) ? 1 : 0, time_to_show == item->end_time ? 1 : 0);
+			time_to_showstring(item_texts[num_layers], 20, time_to_show, relative_to, relative_time, settings & SETTINGS_BOOL_12H ? 1 : 0,(settings & SETTINGS_BOOL_12H) && (settings & SETTINGS_BOOL_AMPM) ? 1 : 0, time_to_show == occurrence->end_time ? 1 : 0);
 			if (design_time == 3) //we should show start and end time. So we append the end time
-				time_to_showstring(item_texts[num_layers]+strlen(item_texts[num_layers]), 10, item->end_time, relative_to, relative_time && get_current_time() >= item->start_time, settings & SETTINGS_BOOL_12H ? 1 : 0, (settings & SETTINGS_BOOL_12H) && (settings & SETTINGS_BOOL_AMPM) ? 1 : 0, true);
+				time_to_showstring(item_texts[num_layers]+strlen(item_texts[num_layers]), 10, occurrence->end_time, relative_to, relative_time && get_current_time() >= occurrence->start_time, settings & SETTINGS_BOOL_12H ? 1 : 0, (settings & SETTINGS_BOOL_12H) && (settings & SETTINGS_BOOL_AMPM) ? 1 : 0, true);
 		
 			//Create time layer
 			TextLayer *layer = text_layer_create(GRect(0,y,time_layer_width,line_height*line_height_factor));
-			text_layer_set_background_color(layer, GColorWhite);
-			text_layer_set_text_color(layer, GColorBlack);
-			text_layer_set_font(layer, font);
-			text_layer_set_text(layer, item_texts[num_layers]);
-			layer_add_child(parent, text_layer_get_layer(layer));
-			item_layers[num_layers++] = layer;
+			if (layer != 0) {
+				stats_increment(STAT_LAYERS_CREATED);
+				text_layer_set_background_color(layer, GColorWhite);
+				text_layer_set_text_color(layer, GColorBlack);
+				text_layer_set_font(layer, font);
+				text_layer_set_text(layer, item_texts[num_layers]);
+				layer_add_child(parent, text_layer_get_layer(layer));
+				item_layer_styles[num_layers] = 0;
+				item_layers[num_layers++] = layer;
+			} else
+				mem_free(item_texts[num_layers]);
 		}
 		
 		//Create text layer
@@ -196,15 +211,19 @@ int create_item_layers(int y, Layer* parent, AgendaItem* item, caltime_t relativ
 			text = row_text; //set the reference to the text saved in the event struct
 		item_texts[num_layers] = 0; //no reference in item_texts for this layer (as the text should not be freed when tidying up UI, only by the database)
 		
-		TextLayer *layer = text_layer_create(GRect(time_layer_width,y,144-time_layer_width,line_height*line_height_factor));
-		text_layer_set_background_color(layer, GColorWhite);
-		text_layer_set_text_color(layer, GColorBlack);
-		text_layer_set_font(layer, row_design & ROW_DESIGN_TEXT_BOLD ? font_bold : font);
-		text_layer_set_overflow_mode(layer, GTextOverflowModeFill);
-		if (text != 0)
-			text_layer_set_text(layer, text);
-		layer_add_child(parent, text_layer_get_layer(layer));
-		item_layers[num_layers++] = layer;
+		TextLayer *layer = text_layer_create(GRect(time_layer_width,y,LAYOUT_SCREEN_WIDTH-time_layer_width,line_height*line_height_factor));
+		if (layer != 0) { //(out of memory otherwise)
+			stats_increment(STAT_LAYERS_CREATED);
+			text_layer_set_background_color(layer, GColorWhite);
+			text_layer_set_text_color(layer, GColorBlack);
+			text_layer_set_font(layer, row_design & ROW_DESIGN_TEXT_BOLD ? font_bold : font);
+			text_layer_set_overflow_mode(layer, GTextOverflowModeFill);
+			if (text != 0)
+				text_layer_set_text(layer, text);
+			layer_add_child(parent, text_layer_get_layer(layer));
+			item_layer_styles[num_layers] = LAYER_STYLE_ROW_TEXT | (row_design & ROW_DESIGN_TEXT_BOLD ? LAYER_STYLE_BOLD : 0);
+			item_layers[num_layers++] = layer;
+		}
 		
 		y+=line_height*line_height_factor; //add this line's height to y for return value
 	}
@@ -212,20 +231,29 @@ int create_item_layers(int y, Layer* parent, AgendaItem* item, caltime_t relativ
 	return y; //screen offset where this item's layers end
 }
 
-//Creates separator (like the "Monday" layer, separating today's items from tomorrow's), returns y+[own height]
+//Creates separator (like the "Monday" layer, separating today's items from tomorrow's), returns y+[own height]. If out of memory, the separator's layer and text are 0 and it takes no space
 int create_day_separator_layer(int i, int y, Layer* parent, caltime_t day) {
 	static char *daystrings[8] = {"Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday", "Sunday", "Tomorrow"};
 	static char *monthstrings[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
 	
 	//Set text
-	day_separator_texts[i] = malloc(sizeof(char)*20);
+	day_separator_layers[i] = 0;
+	day_separator_texts[i] = mem_alloc(MEM_TAG_TEXTS, sizeof(char)*20);
+	if (day_separator_texts[i] == 0)
+		return y;
 	if (settings_get_bool_flags() & SETTINGS_BOOL_SEPARATOR_DATE)
 		snprintf(day_separator_texts[i], 20, "%s, %s %02ld", daystrings[caltime_to_date_only(day) == caltime_get_tomorrow(get_current_time()) ? 7 : caltime_get_weekday(day)], monthstrings[caltime_get_month(day)-1], caltime_get_day(day));
 	else
 		snprintf(day_separator_texts[i], 20, "%s", daystrings[caltime_to_date_only(day) == caltime_get_tomorrow(get_current_time()) ? 7 : caltime_get_weekday(day)]);
 	
 	//Create layer
-	day_separator_layers[i] = text_layer_create(GRect(0,y,144,line_height));
+	day_separator_layers[i] = text_layer_create(GRect(0,y,LAYOUT_SCREEN_WIDTH,line_height));
+	if (day_separator_layers[i] == 0) {
+		mem_free(day_separator_texts[i]);
+		day_separator_texts[i] = 0;
+		return y;
+	}
+	stats_increment(STAT_LAYERS_CREATED);
 	text_layer_set_background_color(day_separator_layers[i], GColorBlack);
 	text_layer_set_text_color(day_separator_layers[i], GColorWhite);
 	text_layer_set_font(day_separator_layers[i], font);
@@ -236,108 +264,341 @@ int create_day_separator_layer(int i, int y, Layer* parent, caltime_t day) {
 	return y+line_height;
 }
 
-void display_data() { //(Re-)creates all the layers for items in the database and shows them. (Re-)creates item_layers, item_texts, ... arrays
-	Layer *window_layer = root_layer;
-	if (db_size() <= 0)
-		return;
+AppTimer *full_render_timer = 0; //timer to replace a snapshot shown at startup by the real display (or 0, see snapshot_show())
+void cancel_full_render();
+AppTimer *init_stage_timer = 0; //timer for the next startup stage (or 0, see handle_init())
+#define NUM_DB_ITEMS_ALL 255 //for db_restore_persisted(): everything
+void cancel_init_stages();
+void remove_displayed_data();
+
+//State of the current display pass (see display_begin(), display_item() and display_end())
+AgendaOccurrence display_previous = {.item = 0}; //the occurrence displayed before (.item == 0 if none)
+int display_y = 0; //vertical offset for the next layers
+caltime_t display_now = 0; //time that the pass started at
+caltime_t display_last_separator_date = 0; //the date of the last day separator (so that times can be shown relative to that)
+caltime_t display_tomorrow_date = 0;
+uint16_t display_pass = 0; //incremented with every display_begin() (to find out whether a pass can be continued)
+int display_max_items = 0; //number of (not elapsed) items the pass has space for (may be less than requested under memory pressure)
+Layer *display_parent = 0; //layer that the pass adds item layers to (root_layer, or a page)
+int display_visible_layers = 0; //item_layers[0..display_visible_layers-1] are on the visible page (for snapshot_save())
+int display_visible_separators = 0; //same for day_separator_layers
+int display_num_items = 0; //number of (not elapsed) items displayed in the pass so far
+
+//Day paging (SETTINGS_BOOL_DAY_PAGES): one page per day, page 0 being today (and items that started before). Tap flips to the next page.
+//Only the current page and its neighbours are materialized, side by side in pages_layer (which is moved to flip pages)
+#define PAGE_RESET_MS 15000 //time after the last tap until we flip back to today
+Layer *pages_layer = 0; //container for page_layers (0 if not paging). At x=-LAYOUT_SCREEN_WIDTH, so that the current page is on screen
+Layer *page_layers[3] = {0,0,0}; //previous, current and next page (0 if that page doesn't exist)
+int current_page = 0; //page shown
+PropertyAnimation *page_animation = 0; //animation flipping to a neighbouring page (or 0)
+void page_animation_cleanup();
+
+//Streaming (showing items while a sync is still running)
+bool displaying_stream = false; //true iff the displayed layers belong to items that are still in the communication buffer (not in the db)
+int stream_num_displayed = 0; //number of streamed items that have been passed to display_item()
+bool stream_incomplete = false; //true if a recurring item stopped displaying streamed items (so the display has to be rebuilt after the sync)
+
+bool allocate_display_arrays(int max_layers, int max_separators) { //creates item_layers, item_texts, ... arrays. Returns false (and creates none) if out of memory
+	item_layers = mem_alloc(MEM_TAG_LAYER_ARRAYS, sizeof(TextLayer*)*max_layers);
+	item_texts = mem_alloc(MEM_TAG_LAYER_ARRAYS, sizeof(char*)*max_layers);
+	item_layer_styles = mem_alloc(MEM_TAG_LAYER_ARRAYS, sizeof(uint8_t)*max_layers);
+	day_separator_layers = mem_alloc(MEM_TAG_LAYER_ARRAYS, sizeof(TextLayer*)*max_separators);
+	day_separator_texts = mem_alloc(MEM_TAG_LAYER_ARRAYS, sizeof(char*)*max_separators);
+	if ((item_layers != 0 && item_texts != 0 && item_layer_styles != 0 && day_separator_layers != 0 && day_separator_texts != 0) || max_layers+max_separators == 0)
+		return true;
 	
+	EVENT_WARNING(EVENT_DISPLAY_OUT_OF_MEMORY, max_layers, max_separators);
+	remove_displayed_data(); //frees what we got
+	return false;
+}
+
+void display_begin(int max_items) { //starts a new display pass for up to max_items items (fewer under memory pressure). Call remove_displayed_data() first
 	//Create arrays
-	item_layers = malloc(sizeof(TextLayer*)*db_size()*4); //maximal four layers per item in the db
-	item_texts = malloc(sizeof(char*)*db_size()*4);
-	day_separator_layers = malloc(sizeof(TextLayer*)*db_size()); //maximal one day-separator per item
-	day_separator_texts = malloc(sizeof(char*)*db_size());
+	pressure_update();
+	display_max_items = pressure_max_display_items(max_items);
+	display_num_items = 0;
+	if (!allocate_display_arrays(display_max_items*4, display_max_items)) //maximal four layers and one day-separator per item
+		display_max_items = 0;
 	
 	//Figure out font to use
 	set_font_from_settings();
 	
-	//Iterate over agenda items
+	stats_increment(STAT_REBUILDS);
+	display_pass++;
 	num_layers = 0;
 	elapsed_item_num = 0;
 	num_separators = 0;
 	refresh_at = 0; //contains the earliest time that we need to schedule a refresh for
-	AgendaItem *previous_item = 0; //contains the item from previous loop iteration (or 0)
-	int y = header_height; //vertical offset to start displaying layers
-	caltime_t now = get_current_time();
-	caltime_t last_separator_date = now; //the date of the last day separator (so that times can be shown relative to that)
-	caltime_t tomorrow_date = caltime_get_tomorrow(now);
+	display_previous.item = 0;
+	display_parent = root_layer;
+	display_y = header_height; //vertical offset to start displaying layers
+	display_now = get_current_time();
+	display_last_separator_date = display_now;
+	display_tomorrow_date = caltime_get_tomorrow(display_now);
+}
 
-	for (int i=0;i<db_size();i++) {
-		AgendaItem* item = db_get(i);
-		if (item->end_time != 0 && item->end_time < now) { //skip those that we shouldn't display
-			elapsed_item_num++;
+void display_item(AgendaOccurrence* item) { //creates the layers for the next item occurrence (occurrences have to be passed in order)
+	if (item->end_time != 0 && item->end_time < display_now) { //skip those that we shouldn't display
+		elapsed_item_num++;
+		return;
+	}
+	if (display_num_items >= display_max_items) //no space left
+		return;
+	display_num_items++;
+	
+	//Check if we need a date separator
+	if ((display_previous.item == 0 && caltime_to_date_only(item->start_time) >= display_tomorrow_date) //first item doesn't begin before tomorrow
+		|| (display_previous.item != 0 && caltime_to_date_only(display_previous.start_time) != caltime_to_date_only(item->start_time) && caltime_to_date_only(item->start_time) >= display_tomorrow_date)) { //it's not the first item, but the previous one belonged to another date and this one doesn't start until tomorrow
+		display_y = create_day_separator_layer(num_separators, display_y, display_parent, item->start_time);
+		display_last_separator_date = item->start_time;
+		num_separators++;
+	}
+	
+	//Add item layers
+	display_y = create_item_layers(display_y, display_parent, item, display_last_separator_date, (settings_get_bool_flags() & SETTINGS_BOOL_COUNTDOWNS) && num_separators == 0)+1;
+	
+	//refresh_at is set by time_to_showstring() for shown times. Make sure that items disappear after their expiration even when not showing the time
+	if (item->end_time != 0)
+		set_refresh_at_if_decrease(item->end_time);
+	
+	display_previous = *item;
+}
+
+void display_end() { //finishes the display pass (can be continued with more display_item() calls afterwards)
+	if (pages_layer == 0) { //(otherwise set by display_pages())
+		items_biggest_y = display_y;
+		display_visible_layers = num_layers;
+		display_visible_separators = num_separators;
+	}
+	
+	//Make sure data is fresh when the display changes next
+	scheduler_set_next_boundary(get_refresh_boundary());
+}
+
+int page_count() { //number of pages (at least 1)
+	caltime_t today = caltime_to_date_only(get_current_time());
+	int day = 0;
+	while (day < db_num_days() && db_day_date(day) <= today)
+		day++;
+	return db_num_days()-day+1;
+}
+
+void page_get_items(int page, int *first, int *num) { //occurrences on page are db_get_occurrence(first..first+num-1)
+	int first_day = db_num_days()-page_count()+1; //first day after today (page 1)
+	int from = page == 0 ? 0 : first_day+page-1;
+	int to = page == 0 ? first_day : from+1;
+	*first = db_day_first_occurrence(from);
+	*num = page < 0 || from >= db_num_days() ? 0 : db_day_first_occurrence(to)-*first;
+}
+
+void display_pages() { //display pass for the current page and its neighbours (see SETTINGS_BOOL_DAY_PAGES)
+	if (current_page >= page_count())
+		current_page = 0;
+	int first[3], num[3];
+	for (int i=0;i<3;i++)
+		page_get_items(current_page-1+i, &first[i], &num[i]);
+	display_begin(num[0]+num[1]+num[2]);
+	
+	pages_layer = layer_create(GRect(-LAYOUT_SCREEN_WIDTH,0,3*LAYOUT_SCREEN_WIDTH,LAYOUT_SCREEN_HEIGHT));
+	if (pages_layer == 0) { //out of memory
+		display_end();
+		return;
+	}
+	layer_set_clips(pages_layer, false);
+	layer_add_child(root_layer, pages_layer);
+	
+	static const int order[3] = {1, 2, 0}; //current page first (it gets the layers first if memory is low, and they're the first ones for snapshot_save())
+	for (int j=0;j<3;j++) {
+		int i = order[j];
+		if (current_page-1+i < 0 || current_page-1+i >= page_count() || (page_layers[i] = layer_create(GRect(i*LAYOUT_SCREEN_WIDTH,0,LAYOUT_SCREEN_WIDTH,LAYOUT_SCREEN_HEIGHT))) == 0)
 			continue;
-		}
-				
-		//Check if we need a date separator
-		if ((previous_item == 0 && caltime_to_date_only(item->start_time) >= tomorrow_date) //first item doesn't begin before tomorrow
-			|| (previous_item != 0 && caltime_to_date_only(previous_item->start_time) != caltime_to_date_only(item->start_time) && caltime_to_date_only(item->start_time) >= tomorrow_date)) { //it's not the first item, but the previous one belonged to another date and this one doesn't start until tomorrow
-			y = create_day_separator_layer(num_separators, y, window_layer, item->start_time);
-			last_separator_date = item->start_time;
-			num_separators++;
-		}
-		
-		//Add item layers
-		y = create_item_layers(y, window_layer, item, last_separator_date, (settings_get_bool_flags() & SETTINGS_BOOL_COUNTDOWNS) && num_separators == 0)+1;
+		layer_set_clips(page_layers[i], false);
+		layer_add_child(pages_layer, page_layers[i]);
 		
-		//refresh_at is set by time_to_showstring() for shown times. Make sure that items disappear after their expiration even when not showing the time
-		if (item->end_time != 0)
-			set_refresh_at_if_decrease(item->end_time);
+		//Start page like a display pass of its own
+		display_parent = page_layers[i];
+		display_y = header_height;
+		display_previous.item = 0;
+		display_last_separator_date = display_now;
+		for (int k=0;k<num[i];k++) {
+			AgendaOccurrence occurrence = db_get_occurrence(first[i]+k);
+			display_item(&occurrence);
+		}
 		
-		previous_item = item;
+		if (i == 1) {
+			items_biggest_y = display_y;
+			display_visible_layers = num_layers;
+			display_visible_separators = num_separators;
+		}
 	}
+	display_end();
+}
+
+void display_data() { //(Re-)creates all the layers for items in the database and shows them. (Re-)creates item_layers, item_texts, ... arrays
+	if (db_size() <= 0)
+		return;
+	db_refresh_index(); //(occurrences that ended since the last pass make room for later ones)
+	
+	PROBE_START(PROBE_DISPLAY_DATA);
+	uint32_t started_at = stats_now_ms();
 	
-	items_biggest_y = y;
+	if (settings_get_bool_flags() & SETTINGS_BOOL_DAY_PAGES)
+		display_pages();
+	else {
+		display_begin(db_num_occurrences());
+		for (int i=0;i<db_num_occurrences();i++) {
+			AgendaOccurrence occurrence = db_get_occurrence(i);
+			display_item(&occurrence);
+		}
+		display_end();
+	}
+	
+	stats_set(STAT_LAST_REBUILD_MS, stats_now_ms()-started_at);
+	PROBE_END(PROBE_DISPLAY_DATA);
 }
 
 void remove_displayed_data() { //tidies up anything that display_data() created
+	PROBE_START(PROBE_REMOVE_DISPLAYED_DATA);
+	stats_add(STAT_LAYERS_DESTROYED, num_layers+num_separators);
 	for (int i=0;i<num_layers;i++) {
 		if (item_layers[i] != 0)
 			text_layer_destroy(item_layers[i]);
 		if (item_texts[i] != 0)
-			free(item_texts[i]);
+			mem_free(item_texts[i]);
 	}
 	for (int i=0;i<num_separators;i++) {
-		text_layer_destroy(day_separator_layers[i]);
-		free(day_separator_texts[i]);
+		if (day_separator_layers[i] != 0)
+			text_layer_destroy(day_separator_layers[i]);
+		if (day_separator_texts[i] != 0)
+			mem_free(day_separator_texts[i]);
 	}
 	
+	page_animation_cleanup();
+	for (int i=0;i<3;i++) {
+		if (page_layers[i] != 0)
+			layer_destroy(page_layers[i]);
+		page_layers[i] = 0;
+	}
+	if (pages_layer != 0)
+		layer_destroy(pages_layer);
+	pages_layer = 0;
+	
 	num_layers = 0;
 	num_separators = 0;
+	display_visible_layers = 0;
+	display_visible_separators = 0;
 	if (item_layers != 0)
-		free(item_layers);
+		mem_free(item_layers);
 	if (item_texts != 0)
-		free(item_texts);
+		mem_free(item_texts);
+	if (item_layer_styles != 0)
+		mem_free(item_layer_styles);
 	if (day_separator_layers != 0)
-		free(day_separator_layers);
+		mem_free(day_separator_layers);
 	if (day_separator_texts != 0)
-		free(day_separator_texts);
+		mem_free(day_separator_texts);
 	
 	item_layers = 0;
 	item_texts = 0;
+	item_layer_styles = 0;
 	day_separator_layers = 0;
 	day_separator_texts = 0;
+	displaying_stream = false;
+	PROBE_END(PROBE_REMOVE_DISPLAYED_DATA);
+}
+
+int get_screenful_item_num() { //number of (not elapsed) items that certainly fill the screen (every item has at least one row)
+	set_font_from_settings();
+	return (LAYOUT_SCREEN_HEIGHT-header_height)/line_height+1;
+}
+
+//Called during a sync whenever another item has been received completely. Old data is kept until the new items fill the screen, then they replace it. Later items are appended without a rebuild
+void handle_streamed_items(AgendaItem **items, int num_received, int num_expected) {
+	if (settings_get_bool_flags() & SETTINGS_BOOL_DAY_PAGES) //pages are only built from the database (after the sync)
+		return;
+	if (!displaying_stream) {
+		int num_shown = 0;
+		caltime_t now = get_current_time();
+		for (int i=0;i<num_received;i++) {
+			if (agenda_item_num_occurrences(items[i]) > 1) //keep the old data until the sync is done (see below)
+				return;
+			if (items[i]->end_time == 0 || items[i]->end_time >= now)
+				num_shown++;
+		}
+		if (num_received < num_expected && num_shown < get_screenful_item_num())
+			return;
+		
+		remove_displayed_data();
+		display_begin(num_expected);
+		displaying_stream = true;
+		stream_num_displayed = 0;
+		stream_incomplete = false;
+	} else if (stream_incomplete)
+		return;
+	
+	for (; stream_num_displayed<num_received; stream_num_displayed++) {
+		if (agenda_item_num_occurrences(items[stream_num_displayed]) > 1) { //repetitions would have to be sorted in. Show the rest when the sync is done
+			stream_incomplete = true;
+			break;
+		}
+		AgendaOccurrence occurrence = agenda_item_occurrence(items[stream_num_displayed], 0);
+		display_item(&occurrence);
+	}
+	display_end();
+}
+
+void handle_stream_aborted() { //Sync was aborted, the streamed items will be freed. Show database content again
+	if (!displaying_stream)
+		return;
+	remove_displayed_data();
+	display_data();
 }
 
 void handle_no_new_data() { //sync done, no new data
-	last_sync = time(NULL);
+	if (pending_offset_change != 0) { //the phone's items hash to what the rebased db would: the offset did change. Rebase instead of syncing everything again
+		EVENT_INFO(EVENT_OFFSET_CHANGE, pending_offset_change, 0);
+		db_rebase(pending_offset_change);
+		scheduler_rebase(pending_offset_change*60);
+		pending_offset_change = 0;
+		refresh_at = 1; //redisplay on the next tick
+	}
+	scheduler_sync_succeeded(time(NULL), false);
 }
 
 void handle_new_data(uint8_t sync_id) { //Sync done. Show new data from database
-	display_data(); //Create the item layers etc.
-	
-	last_sync = time(NULL); //remember successful sync
+	cancel_full_render(); //database is up to date, don't restore the persisted one
+	cancel_init_stages();
+	scheduler_sync_succeeded(time(NULL), true); //remember successful sync (before display_data() reports the next item boundary)
 	last_sync_id = sync_id;
+	pending_offset_change = 0; //the phone sent its items as they are now (whether the offset changed or not)
+	
+	if (displaying_stream && !stream_incomplete) //everything's on screen already (the streamed items are in the db now)
+		displaying_stream = false;
+	else {
+		remove_displayed_data();
+		display_data(); //Create the item layers etc.
+	}
 	
 	//scroll(0);
 }
 
+uint8_t sync_id_to_report() { //last_sync_id, or 0 if the db lost items when restoring (the phone has to send everything again, even if its data didn't change) or an offset change is to be confirmed (the phone has to compare content hashes)
+	return db_restore_failed() || pending_offset_change != 0 ? 0 : last_sync_id;
+}
+
+uint32_t content_hash_to_report() { //hash of the db, as it would be after the pending offset change (the phone answers COMMAND_NO_NEW_DATA if its items hash to the same value)
+	return pending_offset_change != 0 ? db_rebased_content_hash(pending_offset_change) : db_content_hash();
+}
+
 void handle_sync_failed() {
-	last_sync = 0;
-	send_sync_request(last_sync_id);
+	stats_increment(STAT_SYNC_RESTARTS);
+	send_sync_request(sync_id_to_report());
 }
 
-void handle_data_gone() { //Database will go down. Stop showing stuff, as the texts are gone
-	remove_displayed_data();
+void handle_data_gone() { //Database will go down. Stop showing stuff, as the texts are gone (unless we're showing streamed items, which are not in the db yet)
+	cancel_init_stages(); //don't continue restoring
+	if (!displaying_stream)
+		remove_displayed_data();
 }
 
 void update_clock() { //updates the layer for the current time (if exists)
@@ -380,7 +641,30 @@ void update_date(struct tm *time) { //updates the layer for the current date (if
 	}
 }
 
+//Detection of time zone/DST changes. The watch only knows local time, so such a change shows as a jump of the clock between two minute ticks.
+//A jump like that can also be the clock being set, so it is only taken as an offset change when the phone confirms it (see handle_no_new_data())
+#define TIME_OFFSET_GRANULARITY 15 //local time offsets are multiples of this (in minutes)
+#define TIME_OFFSET_MAX_CHANGE (26*60) //maximum difference between two time zones (in minutes)
+time_t last_tick_time = 0; //time(NULL) at the previous minute tick (0 if none yet)
+
+int32_t detect_offset_change(time_t now) { //returns by how many minutes the local time offset may have changed since the last tick (0 if the clock didn't jump or the jump doesn't look like an offset change)
+	time_t previous = last_tick_time;
+	last_tick_time = now;
+	if (previous == 0)
+		return 0;
+	
+	int32_t jump = now-previous-60; //seconds (ticks are a minute apart)
+	int32_t minutes = (jump+(jump < 0 ? -30 : 30))/60; //rounded to the nearest minute
+	if (minutes == 0 || minutes%TIME_OFFSET_GRANULARITY != 0 || minutes > TIME_OFFSET_MAX_CHANGE || minutes < -TIME_OFFSET_MAX_CHANGE)
+		return 0;
+	return minutes;
+}
+
 static void handle_time_tick(struct tm *tick_time, TimeUnits units_changed) { //handle OS call for ticking time (every minute)
+	PROBE_START(PROBE_TIME_TICK);
+	stats_increment(STAT_WAKEUPS);
+	time_t now = time(NULL);
+	
 	//Update clock value
 	update_clock();
 	
@@ -388,28 +672,40 @@ static void handle_time_tick(struct tm *tick_time, TimeUnits units_changed) { //
 	if (units_changed & DAY_UNIT)
 		update_date(tick_time);
 	
-	//check whether we should try for an update (if connected and last sync was more than (30-20*elapsed_item_num) minutes ago). Also when time went backward (time zoning/DST)
-	if (time(NULL)-last_sync > 60*30-60*20*elapsed_item_num || time(NULL) < last_sync)
-		send_sync_request(last_sync_id);
+	//Ask the phone whether the time zone/DST changed: the request reports the hash of the db rebased by the jump, so the phone only has to answer COMMAND_NO_NEW_DATA
+	//if it did (instead of sending everything again). During a sync, the scheduler resyncs as before
+	int32_t offset_change = detect_offset_change(now);
+	if (offset_change != 0 && !communication_sync_in_progress()) {
+		EVENT_DEBUG(EVENT_OFFSET_CHANGE_PENDING, offset_change, 0);
+		pending_offset_change += offset_change;
+		send_sync_request(sync_id_to_report());
+	}
+	
+	//check whether we should try for an update (see scheduler.c)
+	if (scheduler_sync_due(now))
+		send_sync_request(sync_id_to_report());
 	
 	//APP_LOG(APP_LOG_LEVEL_DEBUG, "refresh_at = %ld (h:%ld m:%ld)", refresh_at, caltime_get_hour(refresh_at), caltime_get_minute(refresh_at));
 	//check whether we crossed the refresh_at threshold (e.g., item finished and has to be removed. Or item starts and now has to show endtime...)
-	if ((tick_time->tm_hour == 0 && tick_time->tm_min == 0) || (refresh_at != 0 && tm_to_caltime(tick_time) > refresh_at)) {
-		APP_LOG(APP_LOG_LEVEL_DEBUG, "Refreshing currently shown items");
+	if (!displaying_stream && full_render_timer == 0 && init_stage_timer == 0 && ((tick_time->tm_hour == 0 && tick_time->tm_min == 0) || (refresh_at != 0 && tm_to_caltime(tick_time) > refresh_at))) { //(streamed items are refreshed after the sync, snapshots are replaced anyway)
+		EVENT_DEBUG(EVENT_REFRESH, refresh_at, 0);
 		//Reset what's displayed and redisplay
 		remove_displayed_data();
 		display_data();
 	}
+	
+	PROBE_END(PROBE_TIME_TICK);
 }
 
 static void handle_battery(BatteryChargeState charge_state) {
+	stats_increment(STAT_WAKEUPS);
 	time_t now = time(NULL);
 	update_date(localtime(&now));
 }
 
 void bluetooth_connection_callback(bool connected) {
-	if (connected)
-		last_sync = 0; //force sync
+	stats_increment(STAT_WAKEUPS);
+	scheduler_set_connected(connected); //suppresses syncs while disconnected, forces one on reconnect
 	sync_layer_set_progress(0, connected ? 0 : 1);	
 }
 
@@ -424,50 +720,30 @@ void set_time_font_from_settings() {
 		
 		//Apply new font
 		time_font_id = time_font_id_new;
-		switch (time_font_id) {
-			case 1: //big time
-				time_font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_ROBOTO_CONDENSED_BOLD_40));
-				break;
-			case 0:
-			default:
-				time_font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_ROBOTO_CONDENSED_30));
-				break;
-		}
+		time_font = fonts_load_custom_font(resource_get_handle(layout_header_metrics(time_font_id)->time_font_resource));
 	}
 	
 	//Apply other settings
-	switch (time_font_id) {
-		case 1: //big time/header
-			date_font = fonts_get_system_font(FONT_KEY_GOTHIC_18);
-			header_weekday_height = 18;
-			header_height = 44;
-			header_time_width = 98;
-			header_time_y_offset = -6;
-			header_weekday_y_offset = -2;
-		break;
-		
-		case 0: //small time/header
-		default:
-			date_font = fonts_get_system_font(FONT_KEY_GOTHIC_14);
-			header_weekday_height = 15;
-			header_height = 33;
-			header_time_width = 74;
-			header_time_y_offset = -3;
-			header_weekday_y_offset = -2;
-		break;
-	}
+	const HeaderMetrics *metrics = layout_header_metrics(time_font_id);
+	date_font = fonts_get_system_font(metrics->date_font_key);
+	header_weekday_height = metrics->weekday_height;
+	header_height = metrics->height;
+	header_time_width = metrics->time_width;
+	header_time_y_offset = metrics->time_y_offset;
+	header_weekday_y_offset = metrics->weekday_y_offset;
 }
 
 //Create the header that shows current time and date (if settings say so)
 void create_header(Layer *window_layer) {
 	if (!(settings_get_bool_flags() & SETTINGS_BOOL_SHOW_CLOCK_HEADER)) { //stop creating here if user settings permit
-		header_height = 2;
+		header_height = LAYOUT_NO_HEADER_HEIGHT;
 	}
 	else {
 		//Figure out font for the time
 		set_time_font_from_settings(); //also sets header_height etc.
 		
 		//Create time layer
+		stats_add(STAT_LAYERS_CREATED, 3);
 		text_layer_time = text_layer_create(GRect(0, header_time_y_offset, header_time_width, header_height));
 		text_layer_set_background_color(text_layer_time, GColorBlack);
 		text_layer_set_text_color(text_layer_time, GColorWhite);
@@ -476,7 +752,7 @@ void create_header(Layer *window_layer) {
 		layer_add_child(window_layer, text_layer_get_layer(text_layer_time));
 		
 		//Create date layer
-		text_layer_date = text_layer_create(GRect(header_time_width, header_weekday_y_offset+header_weekday_height, 144-header_time_width, header_height-header_weekday_height));
+		text_layer_date = text_layer_create(GRect(header_time_width, header_weekday_y_offset+header_weekday_height, LAYOUT_SCREEN_WIDTH-header_time_width, header_height-header_weekday_height));
 		text_layer_set_background_color(text_layer_date, GColorBlack);
 		text_layer_set_text_color(text_layer_date, GColorWhite);
 		text_layer_set_text_alignment(text_layer_date, GTextAlignmentRight);
@@ -485,7 +761,7 @@ void create_header(Layer *window_layer) {
 		layer_add_child(window_layer, text_layer_get_layer(text_layer_date));
 		
 		//Create weekday layer
-		text_layer_weekday = text_layer_create(GRect(header_time_width, header_weekday_y_offset, 144-header_time_width, header_weekday_height));
+		text_layer_weekday = text_layer_create(GRect(header_time_width, header_weekday_y_offset, LAYOUT_SCREEN_WIDTH-header_time_width, header_weekday_height));
 		text_layer_set_background_color(text_layer_weekday, GColorBlack);
 		text_layer_set_text_color(text_layer_weekday, GColorWhite);
 		text_layer_set_text_alignment(text_layer_weekday, GTextAlignmentRight);
@@ -500,7 +776,8 @@ void create_header(Layer *window_layer) {
 	}
 	
 	//Create sync indicator
-	sync_indicator_layer = text_layer_create(GRect(0,0,144,1));
+	sync_indicator_layer = text_layer_create(GRect(0,0,LAYOUT_SCREEN_WIDTH,1));
+	stats_increment(STAT_LAYERS_CREATED);
 	text_layer_set_background_color(sync_indicator_layer, GColorWhite);
 	layer_add_child(window_layer, text_layer_get_layer(sync_indicator_layer));
 	layer_add_child(window_layer, text_layer_get_layer(sync_indicator_layer));
@@ -509,6 +786,7 @@ void create_header(Layer *window_layer) {
 
 //Well... Destroys whatever create_header() created...
 void destroy_header() {
+	stats_add(STAT_LAYERS_DESTROYED, (text_layer_time != 0)+(text_layer_date != 0)+(text_layer_weekday != 0)+(sync_indicator_layer != 0));
 	if (text_layer_time != 0) text_layer_destroy(text_layer_time);
 	if (text_layer_date != 0) text_layer_destroy(text_layer_date);
 	if (text_layer_weekday != 0) text_layer_destroy(text_layer_weekday);
@@ -520,15 +798,78 @@ void destroy_header() {
 	sync_indicator_layer = 0;
 }
 
-//Scrolls back to 0
+void page_animation_cleanup() { //stops flipping pages (safe to call at any point in time)
+	PropertyAnimation *animation = page_animation;
+	page_animation = 0; //(unscheduling calls page_animation_stopped())
+	if (animation != 0) {
+		animation_unschedule((struct Animation*) animation);
+		property_animation_destroy(animation);
+	}
+}
+
+void page_animation_stopped(Animation *animation, bool finished, void *data) {
+	if (page_animation == 0) //cancelled by page_animation_cleanup()
+		return;
+	page_animation_cleanup();
+	if (!finished)
+		return;
+	
+	//Neighbour is on screen now. Rebuild around it
+	current_page = (int) (intptr_t) data;
+	remove_displayed_data();
+	display_data();
+}
+
+void page_flip(int page) { //shows page (see SETTINGS_BOOL_DAY_PAGES). Neighbouring pages slide in, others are built directly
+	if (page == current_page || page_animation != 0)
+		return;
+	if (pages_layer == 0 || (page != current_page-1 && page != current_page+1)) {
+		current_page = page;
+		remove_displayed_data();
+		display_data();
+		return;
+	}
+	
+	GRect from_frame = layer_get_frame(pages_layer);
+	GRect to_frame = GRect(page > current_page ? -2*LAYOUT_SCREEN_WIDTH : 0, from_frame.origin.y, from_frame.size.w, from_frame.size.h);
+	page_animation = property_animation_create_layer_frame(pages_layer, &from_frame, &to_frame);
+	if (page_animation == 0) //out of memory
+		return;
+	animation_set_handlers((struct Animation*) page_animation, (AnimationHandlers) {
+		.stopped = (AnimationStoppedHandler) page_animation_stopped,
+	}, (void*) (intptr_t) page);
+	animation_schedule((Animation*) page_animation);
+}
+
+//Scrolls back to 0 (and to today's page)
 void scroll_reset_timer_callback(void* data) {
 	scroll(0);
 	scroll_reset_timer = 0;
+	if (settings_get_bool_flags() & SETTINGS_BOOL_DAY_PAGES)
+		page_flip(0);
 }
 
 //Reacts to tap event by scrolling and preparing to reset the scrolling position
 void accel_tap_handler(AccelAxisType axis, int32_t direction) {
-	if (settings_get_bool_flags() & SETTINGS_BOOL_ENABLED_ALT_SCROLL) {
+	stats_increment(STAT_WAKEUPS);
+	if (settings_get_bool_flags() & SETTINGS_BOOL_DAY_PAGES) {
+		if (scroll_animation == 0 && page_animation == 0) {
+			if (scroll_position+LAYOUT_SCREEN_HEIGHT < items_biggest_y) { //show the rest of this page first
+				int scroll_amount = line_height == 0 ? LAYOUT_SCROLL_DEFAULT_AMOUNT : LAYOUT_SCREEN_HEIGHT-LAYOUT_SCROLL_KEEP_LINES*line_height;
+				scroll(scroll_position+scroll_amount+LAYOUT_SCREEN_HEIGHT+10 > items_biggest_y ? items_biggest_y-LAYOUT_SCREEN_HEIGHT+1 : scroll_position+scroll_amount);
+			} else {
+				scroll(0);
+				page_flip(current_page+1 < page_count() ? current_page+1 : 0); //after the last page, start over
+			}
+		}
+		
+		if (scroll_reset_timer != 0) {
+			app_timer_cancel(scroll_reset_timer);
+			scroll_reset_timer = 0;
+		}
+		if (scroll_position != 0 || current_page != 0 || page_animation != 0)
+			scroll_reset_timer = app_timer_register(PAGE_RESET_MS, scroll_reset_timer_callback, NULL); //set timer to go back to today
+	} else if (settings_get_bool_flags() & SETTINGS_BOOL_ENABLED_ALT_SCROLL) {
 		if (scroll_reset_timer != 0) {
 			app_timer_cancel(scroll_reset_timer);
 			scroll_reset_timer = 0;
@@ -536,8 +877,8 @@ void accel_tap_handler(AccelAxisType axis, int32_t direction) {
 		scroll_reset_timer = app_timer_register(30000, scroll_reset_timer_callback, NULL); //set timer to reset scroll position to 0
 		start_scroll_continuously();
 	} else if (!(settings_get_bool_flags() & SETTINGS_BOOL_ENABLED_ALT_SCROLL) && scroll_animation == 0) {
-		int scroll_amount = line_height == 0 ? 130 : 168-3*line_height; //scroll about half the visible lines away
-		scroll(scroll_position+168 > items_biggest_y ? 0 : scroll_position+scroll_amount+168+10 > items_biggest_y ? items_biggest_y-168+1 : scroll_position+scroll_amount); //the +10 are to make these "tiny-step" scrollings to the end rarer
+		int scroll_amount = line_height == 0 ? LAYOUT_SCROLL_DEFAULT_AMOUNT : LAYOUT_SCREEN_HEIGHT-LAYOUT_SCROLL_KEEP_LINES*line_height; //scroll about half the visible lines away
+		scroll(scroll_position+LAYOUT_SCREEN_HEIGHT > items_biggest_y ? 0 : scroll_position+scroll_amount+LAYOUT_SCREEN_HEIGHT+10 > items_biggest_y ? items_biggest_y-LAYOUT_SCREEN_HEIGHT+1 : scroll_position+scroll_amount); //the +10 are to make these "tiny-step" scrollings to the end rarer
 		
 		if (scroll_reset_timer != 0) {
 			app_timer_cancel(scroll_reset_timer);
@@ -550,20 +891,35 @@ void accel_tap_handler(AccelAxisType axis, int32_t direction) {
 		light_enable_interaction();
 }
 
-//Callback if settings changed (also called in handle_init()). We'll simply destroy everything, recreate the header if still set to. Calendar data will be shown again after sync is done
-void handle_new_settings() {
-	remove_displayed_data();
-	destroy_header();
-	create_header(root_layer);
+//Callback if settings changed (also called in handle_init() with all flags). Only rebuilds the parts affected by changed_flags (see SETTINGS_GROUP_*). Calendar data is shown again right away from the database
+void handle_new_settings(uint32_t changed_flags) {
+	if (changed_flags & (SETTINGS_GROUP_HEADER|SETTINGS_GROUP_ITEMS)) {
+		bool was_streaming = displaying_stream;
+		remove_displayed_data();
+		
+		if (changed_flags & SETTINGS_GROUP_HEADER) { //header height changes the item positions as well
+			destroy_header();
+			create_header(root_layer);
+		}
+		
+		if (!was_streaming) //streamed items will be displayed with the next one received
+			display_data();
+	}
 	
-	accel_tap_service_unsubscribe();
+	if (changed_flags & SETTINGS_BOOL_LIMIT_PERSIST) //persist according to the new limit
+		db_schedule_persist();
 	
-	if (settings_get_bool_flags() & SETTINGS_BOOL_ENABLE_SCROLL)
-		accel_tap_service_subscribe(&accel_tap_handler);
+	if (changed_flags & SETTINGS_GROUP_SCROLL) {
+		accel_tap_service_unsubscribe();
+		if (settings_get_bool_flags() & (SETTINGS_BOOL_ENABLE_SCROLL|SETTINGS_BOOL_DAY_PAGES))
+			accel_tap_service_subscribe(&accel_tap_handler);
+	}
 	
+	if (!(changed_flags & SETTINGS_GROUP_INVERT))
+		return;
 	if (settings_get_bool_flags() & SETTINGS_BOOL_INVERT) {
 		if (inverter_layer == 0) {
-			inverter_layer = inverter_layer_create(GRect(0,0,144,168));
+			inverter_layer = inverter_layer_create(GRect(0,0,LAYOUT_SCREEN_WIDTH,LAYOUT_SCREEN_HEIGHT));
 			layer_add_child(window_get_root_layer(window), inverter_layer_get_layer(inverter_layer));
 		}
 	} else {
@@ -636,10 +992,10 @@ void continuous_animation_impl(struct Animation *animation, const uint32_t time_
 			scroll_position = 0;
 			if (anim_num_milestones > 10) //be lenient with deactivation at first
 				continuous_scroll_cleanup();
-		} else if (scroll_position > items_biggest_y-168+1) {
-			scroll_position = items_biggest_y-168+1;
+		} else if (scroll_position > items_biggest_y-LAYOUT_SCREEN_HEIGHT+1) {
+			scroll_position = items_biggest_y-LAYOUT_SCREEN_HEIGHT+1;
 		}
-		layer_set_frame(root_layer, GRect(0,-scroll_position,144,168));
+		layer_set_frame(root_layer, GRect(0,-scroll_position,LAYOUT_SCREEN_WIDTH,LAYOUT_SCREEN_HEIGHT));
 	}
 	
 	//Is it time for a new milestone yet?
@@ -702,8 +1058,252 @@ void vibrate(uint8_t type) {
 	}
 }
 
-//Create all necessary structures, etc.
+//Snapshot of the first screen's layout. Saved on exit so that the next start can show it right away without restoring the database or measuring texts (see snapshot_save(), snapshot_show())
+#define SNAPSHOT_MAX_ENTRIES 24
+#define SNAPSHOT_ENTRIES_PER_KEY 4
+#define SNAPSHOT_FULL_RENDER_DELAY_MS 500 //after showing a snapshot, the real display is built this much later
+
+typedef struct {
+	int16_t y;
+	uint8_t x, w, h;
+	uint8_t style; //LAYER_STYLE_*
+	char text[50];
+} SnapshotEntry;
+
+typedef struct {
+	caltime_t valid_from; //time the layout was computed at
+	caltime_t valid_until; //refresh_at at that time (0 if only valid until midnight)
+	uint32_t settings_flags; //settings the layout was computed with
+	uint32_t entries_hash; //hash over the entries (to skip rewriting unchanged entries)
+	int16_t items_biggest_y;
+	uint8_t num_entries; //0 if there is no valid snapshot
+} SnapshotHeader;
+
+SnapshotHeader snapshot_persisted_header; //header of the snapshot in persistent storage (if snapshot_persisted_known)
+bool snapshot_persisted_known = false;
+
+//Adds a snapshot entry for the layer if it's visible on the first screen. Returns false if there's no space left
+bool snapshot_add_entry(SnapshotEntry *entries, int *num_entries, TextLayer *layer, uint8_t style) {
+	GRect frame = layer_get_frame(text_layer_get_layer(layer));
+	if (frame.origin.y >= LAYOUT_SCREEN_HEIGHT)
+		return true;
+	if (*num_entries >= SNAPSHOT_MAX_ENTRIES)
+		return false;
+	
+	SnapshotEntry *entry = &entries[(*num_entries)++];
+	memset(entry, 0, sizeof(SnapshotEntry));
+	entry->y = frame.origin.y;
+	entry->x = frame.origin.x;
+	entry->w = frame.size.w;
+	entry->h = frame.size.h;
+	entry->style = style;
+	const char *text = text_layer_get_text(layer);
+	if (text != 0)
+		strncpy(entry->text, text, sizeof(entry->text)-1);
+	return true;
+}
+
+//Whether the persisted snapshot is as good as header (then nothing needs to be written)
+bool snapshot_unchanged(SnapshotHeader *header) {
+	SnapshotHeader *persisted = &snapshot_persisted_header;
+	if (!snapshot_persisted_known)
+		return false;
+	if (header->num_entries == 0 || persisted->num_entries == 0) //(invalid either way)
+		return header->num_entries == persisted->num_entries;
+	return persisted->entries_hash == header->entries_hash && persisted->num_entries == header->num_entries && persisted->settings_flags == header->settings_flags
+		&& persisted->valid_until == header->valid_until && persisted->items_biggest_y == header->items_biggest_y
+		&& persisted->valid_from <= header->valid_from && caltime_to_date_only(persisted->valid_from) == caltime_to_date_only(header->valid_from); //(the same layout computed earlier that day is just as valid)
+}
+
+void snapshot_save() { //saves the currently displayed layout. Nothing is written if the persisted snapshot is the same, entries are only rewritten if they changed
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	header.valid_from = display_now;
+	header.valid_until = refresh_at;
+	header.settings_flags = settings_get_bool_flags();
+	header.items_biggest_y = items_biggest_y;
+	SnapshotEntry *entries = mem_alloc(MEM_TAG_SNAPSHOT, sizeof(SnapshotEntry)*SNAPSHOT_MAX_ENTRIES);
+	int num_entries = 0;
+	bool complete = entries != 0 && num_layers+num_separators > 0 && !displaying_stream && current_page == 0; //(only today's page is shown at startup)
+	for (int i=0;complete && i<display_visible_layers;i++)
+		complete = snapshot_add_entry(entries, &num_entries, item_layers[i], item_layer_styles[i]);
+	for (int i=0;complete && i<display_visible_separators;i++)
+		if (day_separator_layers[i] != 0)
+			complete = snapshot_add_entry(entries, &num_entries, day_separator_layers[i], LAYER_STYLE_SEPARATOR);
+	
+	if (complete) {
+		header.num_entries = num_entries;
+		header.entries_hash = hash_data(AGENDA_ITEM_HASH_INIT, entries, sizeof(SnapshotEntry)*num_entries);
+		if (!snapshot_persisted_known || header.entries_hash != snapshot_persisted_header.entries_hash || header.num_entries != snapshot_persisted_header.num_entries) {
+			for (int i=0;i*SNAPSHOT_ENTRIES_PER_KEY<num_entries;i++) {
+				int num = num_entries-i*SNAPSHOT_ENTRIES_PER_KEY < SNAPSHOT_ENTRIES_PER_KEY ? num_entries-i*SNAPSHOT_ENTRIES_PER_KEY : SNAPSHOT_ENTRIES_PER_KEY;
+				persist_write_data(PERSIST_SNAPSHOT_PREFIX|i, &entries[i*SNAPSHOT_ENTRIES_PER_KEY], sizeof(SnapshotEntry)*num);
+				stats_increment(STAT_FLASH_WRITES);
+			}
+		}
+	}
+	if (entries != 0)
+		mem_free(entries);
+	
+	if (snapshot_unchanged(&header))
+		return;
+	persist_write_data(PERSIST_SNAPSHOT_HEADER, &header, sizeof(header));
+	stats_increment(STAT_FLASH_WRITES);
+	snapshot_persisted_header = header;
+	snapshot_persisted_known = true;
+}
+
+//Creates a layer for a snapshot entry (as create_item_layers() or create_day_separator_layer() would have)
+TextLayer* create_snapshot_layer(SnapshotEntry *entry, char* text) { //returns 0 if out of memory
+	TextLayer *layer = text_layer_create(GRect(entry->x, entry->y, entry->w, entry->h));
+	if (layer == 0)
+		return 0;
+	stats_increment(STAT_LAYERS_CREATED);
+	bool separator = entry->style & LAYER_STYLE_SEPARATOR;
+	text_layer_set_background_color(layer, separator ? GColorBlack : GColorWhite);
+	text_layer_set_text_color(layer, separator ? GColorWhite : GColorBlack);
+	text_layer_set_font(layer, entry->style & LAYER_STYLE_BOLD ? font_bold : font);
+	if (separator)
+		text_layer_set_text_alignment(layer, GTextAlignmentRight);
+	if (entry->style & LAYER_STYLE_ROW_TEXT)
+		text_layer_set_overflow_mode(layer, GTextOverflowModeFill);
+	text_layer_set_text(layer, text);
+	layer_add_child(root_layer, text_layer_get_layer(layer));
+	return layer;
+}
+
+bool snapshot_show() { //shows the persisted snapshot if it's valid for the current time and settings. Returns false if not
+	SnapshotHeader header;
+	if (!persist_exists(PERSIST_SNAPSHOT_HEADER) || persist_read_data(PERSIST_SNAPSHOT_HEADER, &header, sizeof(header)) != sizeof(header))
+		return false;
+	snapshot_persisted_header = header;
+	snapshot_persisted_known = true;
+	
+	caltime_t now = get_current_time();
+	if (header.num_entries == 0 || header.num_entries > SNAPSHOT_MAX_ENTRIES || header.settings_flags != settings_get_bool_flags() || now < header.valid_from
+		|| caltime_to_date_only(now) != caltime_to_date_only(header.valid_from) || (header.valid_until != 0 && now > header.valid_until))
+		return false;
+	
+	//Create the layers. Texts are copied to item_texts, so remove_displayed_data() cleans up as usual
+	set_font_from_settings();
+	if (!allocate_display_arrays(header.num_entries, 0))
+		return false;
+	num_layers = 0;
+	num_separators = 0;
+	SnapshotEntry entries[SNAPSHOT_ENTRIES_PER_KEY];
+	for (int i=0;i*SNAPSHOT_ENTRIES_PER_KEY<header.num_entries;i++) {
+		int num = header.num_entries-i*SNAPSHOT_ENTRIES_PER_KEY < SNAPSHOT_ENTRIES_PER_KEY ? header.num_entries-i*SNAPSHOT_ENTRIES_PER_KEY : SNAPSHOT_ENTRIES_PER_KEY;
+		if (persist_read_data(PERSIST_SNAPSHOT_PREFIX|i, entries, sizeof(SnapshotEntry)*num) != (int) sizeof(SnapshotEntry)*num) {
+			remove_displayed_data();
+			return false;
+		}
+		for (int j=0;j<num;j++) {
+			entries[j].text[sizeof(entries[j].text)-1] = 0;
+			item_texts[num_layers] = mem_alloc(MEM_TAG_SNAPSHOT, strlen(entries[j].text)+1);
+			item_layers[num_layers] = item_texts[num_layers] == 0 ? 0 : create_snapshot_layer(&entries[j], strcpy(item_texts[num_layers], entries[j].text));
+			item_layer_styles[num_layers++] = entries[j].style;
+			if (item_layers[num_layers-1] == 0) { //out of memory
+				remove_displayed_data();
+				return false;
+			}
+		}
+	}
+	
+	display_now = header.valid_from;
+	refresh_at = header.valid_until;
+	items_biggest_y = header.items_biggest_y;
+	display_visible_layers = num_layers; //(separators are in item_layers, too) so that snapshot_save() saves the same snapshot again if we exit before the full render
+	display_visible_separators = 0;
+	return true;
+}
+
+void full_render_timer_callback(void *data) { //replaces the snapshot by the real display
+	full_render_timer = 0;
+	db_restore_persisted(NUM_DB_ITEMS_ALL);
+	if (!displaying_stream) {
+		remove_displayed_data();
+		display_data();
+	}
+}
+
+void cancel_full_render() { //the database got new content before the snapshot was replaced. Don't restore the persisted one
+	if (full_render_timer != 0)
+		app_timer_cancel(full_render_timer);
+	full_render_timer = 0;
+}
+
+//Startup is staged so that the clock shows up as fast as possible: handle_init() creates the header and registers services,
+//init_stage_visible_items() shows what's on the first screen, init_stage_remaining_items() adds the rest
+#define INIT_STAGE_DELAY_MS 10 //delay between stages (so that the system can draw in between)
+bool init_items_pending = false; //true until init_stage_visible_items() ran (nothing to remember in snapshot_save() before)
+uint16_t init_stage_display_pass = 0; //display pass started by init_stage_visible_items()
+int init_stage_num_displayed = 0; //number of db items displayed by init_stage_visible_items()
+
+void init_stage_remaining_items(void *data) { //startup stage 2: restore the remaining items and append them to the display
+	init_stage_timer = 0;
+	db_restore_persisted(NUM_DB_ITEMS_ALL);
+	if (displaying_stream) //sync will show new data anyway
+		return;
+	
+	if (item_layers == 0 || pages_layer != 0 || db_has_recurrences() || display_pass != init_stage_display_pass) { //display has been rebuilt in between (or is paged, or repetitions have to be sorted in). Do it again with everything
+		remove_displayed_data();
+		display_data();
+		return;
+	}
+	
+	for (int i=init_stage_num_displayed;i<db_num_occurrences();i++) {
+		AgendaOccurrence occurrence = db_get_occurrence(i);
+		display_item(&occurrence);
+	}
+	display_end();
+}
+
+void init_stage_visible_items(void *data) { //startup stage 1: show the snapshot, or restore and show enough items for the first screen
+	init_stage_timer = 0;
+	init_items_pending = false;
+	if (displaying_stream) { //sync is already showing new items. Only restore (in case it fails)
+		db_restore_persisted(NUM_DB_ITEMS_ALL);
+		return;
+	}
+	
+	if (snapshot_show()) {
+		full_render_timer = app_timer_register(SNAPSHOT_FULL_RENDER_DELAY_MS, full_render_timer_callback, NULL);
+		return;
+	}
+	
+	bool done = db_restore_persisted(get_screenful_item_num());
+	remove_displayed_data();
+	if (db_size() <= 0)
+		return;
+	if (settings_get_bool_flags() & SETTINGS_BOOL_DAY_PAGES) //today's page from what we have, stage 2 rebuilds it
+		display_data();
+	else {
+		display_begin(db_num_persisted() > db_num_occurrences() ? db_num_persisted() : db_num_occurrences()); //make space for the remaining items
+		for (int i=0;i<db_num_occurrences();i++) {
+			AgendaOccurrence occurrence = db_get_occurrence(i);
+			display_item(&occurrence);
+		}
+		display_end();
+	}
+	
+	if (!done) {
+		init_stage_display_pass = display_pass;
+		init_stage_num_displayed = db_num_occurrences();
+		init_stage_timer = app_timer_register(INIT_STAGE_DELAY_MS, init_stage_remaining_items, NULL);
+	}
+}
+
+void cancel_init_stages() { //the database got new content. Don't continue restoring the persisted one
+	if (init_stage_timer != 0)
+		app_timer_cancel(init_stage_timer);
+	init_stage_timer = 0;
+	init_items_pending = false;
+}
+
+//Create all necessary structures, etc. (see above for the stages)
 void handle_init(void) {
+	PROBE_START(PROBE_INIT);
+	
 	//Init window
 	window = window_create();
 	window_stack_push(window, true);
@@ -718,19 +1318,17 @@ void handle_init(void) {
 	else
 		last_sync_id = 0;
 	
-	db_restore_persisted();
 	settings_restore_persisted();
+	stats_restore_persisted();
 	
-	//Create some initial stuff depending on settings
-	handle_new_settings();
-	
-	//Show data from database
-	display_data();	
+	//Create some initial stuff depending on settings (header with clock, ...). Items come later
+	handle_new_settings(0xFFFFFFFF & ~SETTINGS_BOOL_LIMIT_PERSIST); //(not the persistence setting: nothing has changed that needs persisting)
 	
 	//Register services
 	tick_timer_service_subscribe(MINUTE_UNIT, &handle_time_tick);
 	battery_state_service_subscribe(&handle_battery);
 	bluetooth_connection_service_subscribe(bluetooth_connection_callback);
+	scheduler_set_connected(bluetooth_connection_service_peek());
 	
 	//Register for communication events
 	app_message_register_inbox_received(in_received_handler);	
@@ -740,8 +1338,14 @@ void handle_init(void) {
 	
 	//Begin listening to messages
 	const uint32_t inbound_size = 124; //should be the max value
-	const uint32_t outbound_size = 64; //we don't send much
+	const uint32_t outbound_size = 136; //we don't send much (sync request with statistics and possibly the maximal number of items)
 	app_message_open(inbound_size, outbound_size);
+	
+	//Items are restored and shown in later stages
+	init_items_pending = true;
+	init_stage_timer = app_timer_register(INIT_STAGE_DELAY_MS, init_stage_visible_items, NULL);
+	
+	PROBE_END(PROBE_INIT);
 }
 
 //Destroy what handle_init() created
@@ -754,7 +1358,11 @@ void handle_deinit(void) {
 	bluetooth_connection_service_unsubscribe();
 	app_message_deregister_callbacks();
 	
-	//Destroy ui
+	//Destroy ui (remembering what it looked like, unless startup didn't get that far)
+	cancel_full_render();
+	if (!init_items_pending)
+		snapshot_save();
+	cancel_init_stages();
 	destroy_header();
 	remove_displayed_data();
 	layer_destroy(root_layer);
@@ -766,22 +1374,28 @@ void handle_deinit(void) {
 	if (time_font != 0)
 		fonts_unload_custom_font(time_font);
 	
-	//Write persistent data
-	if (settings_get_bool_flags() & SETTINGS_BOOL_LIMIT_PERSIST) {
-		last_sync_id = 0; //force sync next open
-		db_persist(5); //at most 5 elements persisted
-	} else 
-		db_persist(30);
+	//Write persistent data (the database usually has been persisted in the background already)
+	if (settings_get_bool_flags() & SETTINGS_BOOL_LIMIT_PERSIST)
+		last_sync_id = 0; //force sync next open (not everything has been persisted)
+	db_persist();
 	persist_write_data(PERSIST_LAST_SYNC_ID, &last_sync_id, sizeof(last_sync_id));
+	stats_increment(STAT_FLASH_WRITES);
+	stats_persist();
 	//settings_persist(); //is persisted when new settings arrive
 	
 	//Destroy last references
-	db_reset();
+	db_cleanup();
 	communication_cleanup();
+	outbox_cleanup();
 	scroll_cleanup();
 	continuous_scroll_cleanup();
 	if (scroll_reset_timer != 0)
 		app_timer_cancel(scroll_reset_timer);
+	
+	MEM_LOG_SUMMARY();
+	STATS_LOG_SUMMARY();
+	PROBES_LOG_SUMMARY();
+	EVENT_LOG_DUMP();
 }
 
 int main(void) {
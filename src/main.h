@@ -1,11 +1,16 @@
+#include <pebble.h>
+#include <datatypes.h>
 #ifndef MAIN_H
 #define MAIN_H
 
 void handle_data_gone();
 void handle_new_data(uint8_t sync_id);
+void handle_streamed_items(AgendaItem **items, int num_received, int num_expected);
+void handle_stream_aborted();
 void handle_no_new_data();
 void handle_sync_failed();
-void handle_new_settings();
+uint32_t content_hash_to_report();
+void handle_new_settings(uint32_t changed_flags);
 void sync_layer_set_progress(int now, int max);
 void scroll(int y);
 void vibrate(uint8_t type);
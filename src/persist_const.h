@@ -8,10 +8,23 @@
 #define PERSIST_LAST_SYNC 0
 #define PERSIST_LAST_SYNC_ID 2
 
+//Statistics (see stats.c)
+#define PERSIST_STAT_PERSIST_COST 4
+
+//Snapshot of the displayed layout (see main.c)
+#define PERSIST_SNAPSHOT_HEADER 5
+#define PERSIST_SNAPSHOT_PREFIX 0x3000
+//entry chunk i is stored at PERSIST_SNAPSHOT_PREFIX|i
+
 //Settings
 #define PERSIST_BOOL_FLAG_SETTINGS 0x11001
 
-//Events
+//Events (see item_db.c and item_codec.c)
+#define PERSIST_DB_HEADER 6
+#define PERSIST_DB_CHUNK_PREFIX 0x2100
+//chunk i of the encoded items is stored at PERSIST_DB_CHUNK_PREFIX|i
+
+//Events in the old (uncompressed) format. Only deleted when migrating
 #define PERSIST_NUM_ELEMS 3
 #define PERSIST_DB_PREFIX 0x2000
 //notice that this is simply the first persist id. Event i will be stored at 0x1000|i
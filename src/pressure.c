@@ -0,0 +1,84 @@
+#include <pebble.h>
+#include <datatypes.h>
+#include <item_db.h>
+#include <pressure.h>
+#include <allocator.h>
+#include <event_log.h>
+
+//Steps down gracefully when the heap runs low instead of crashing on a failed allocation. The level is derived from heap_bytes_free(), checked before rendering and before syncing
+//Heap thresholds (bytes free) below which the corresponding level is entered
+#define PRESSURE_FEWER_ITEMS_BELOW 6000
+#define PRESSURE_NO_SECOND_ROWS_BELOW 4000
+#define PRESSURE_SINGLE_LINE_BELOW 2500
+#define PRESSURE_REQUEST_FEWER_BELOW 1500
+//A level is only left again if there are this many bytes more than its threshold (so that we don't flip between levels on every rebuild)
+#define PRESSURE_HYSTERESIS 500
+//Maximal number of items to render on PRESSURE_LEVEL_FEWER_ITEMS (and on PRESSURE_LEVEL_SINGLE_LINE or higher)
+#define PRESSURE_FEWER_ITEMS_MAX 10
+#define PRESSURE_MIN_ITEMS_MAX 5
+//Heap to keep free for rendering while a sync is buffered
+#define PRESSURE_SYNC_RESERVE 2000
+//Heap needed per buffered item during sync (item with its allocator header and buffer pointer)
+#define PRESSURE_BYTES_PER_SYNC_ITEM (sizeof(AgendaItem)+MEM_BLOCK_OVERHEAD+sizeof(AgendaItem*))
+
+PressureLevel pressure_level = PRESSURE_LEVEL_NONE; //current level
+uint8_t max_sync_items = 0; //number of items that the phone should send at most (0 for no limit). Kept until there's plenty of heap again
+bool pressure_sync_fits(int num_items);
+
+static const size_t pressure_thresholds[] = {0, PRESSURE_FEWER_ITEMS_BELOW, PRESSURE_NO_SECOND_ROWS_BELOW, PRESSURE_SINGLE_LINE_BELOW, PRESSURE_REQUEST_FEWER_BELOW}; //indexed by PressureLevel
+
+void pressure_update() { //reads free heap and adapts the level. Call before allocating a lot (rendering, syncing)
+	size_t free_bytes = heap_bytes_free();
+	PressureLevel level = pressure_level;
+	while (level < PRESSURE_LEVEL_REQUEST_FEWER && free_bytes < pressure_thresholds[level+1]) //step down
+		level++;
+	while (level > PRESSURE_LEVEL_NONE && free_bytes >= pressure_thresholds[level]+PRESSURE_HYSTERESIS) //recover
+		level--;
+	
+	if (level != pressure_level) {
+		EVENT_WARNING(EVENT_PRESSURE_LEVEL, level, free_bytes);
+	}
+	pressure_level = level;
+	if (pressure_level == PRESSURE_LEVEL_REQUEST_FEWER && max_sync_items == 0) //what we have is too much already
+		max_sync_items = db_size()*3/4 < 1 ? 1 : db_size()*3/4;
+	if (pressure_level == PRESSURE_LEVEL_NONE && max_sync_items != 0 && pressure_sync_fits(2*max_sync_items)) //plenty of space again. Phone may send everything
+		max_sync_items = 0;
+}
+
+PressureLevel pressure_get_level() {
+	return pressure_level;
+}
+
+int pressure_max_display_items(int num_items) { //number of items to render out of num_items
+	int max = pressure_level >= PRESSURE_LEVEL_SINGLE_LINE ? PRESSURE_MIN_ITEMS_MAX : pressure_level >= PRESSURE_LEVEL_FEWER_ITEMS ? PRESSURE_FEWER_ITEMS_MAX : num_items;
+	return num_items < max ? num_items : max;
+}
+
+bool pressure_skip_second_rows() {
+	return pressure_level >= PRESSURE_LEVEL_NO_SECOND_ROWS;
+}
+
+bool pressure_single_line_texts() {
+	return pressure_level >= PRESSURE_LEVEL_SINGLE_LINE;
+}
+
+bool pressure_sync_fits(int num_items) { //whether a sync of num_items items can be buffered (call pressure_update() first)
+	return heap_bytes_free() >= PRESSURE_SYNC_RESERVE+num_items*PRESSURE_BYTES_PER_SYNC_ITEM;
+}
+
+void pressure_sync_failed(int num_items) { //a sync of num_items items ran out of memory. Ask the phone for fewer next time
+	size_t free_bytes = heap_bytes_free();
+	int fitting = free_bytes > PRESSURE_SYNC_RESERVE ? (free_bytes-PRESSURE_SYNC_RESERVE)/PRESSURE_BYTES_PER_SYNC_ITEM : 0;
+	if (fitting >= num_items) //can't have been the buffer's fault, so just be more modest
+		fitting = num_items/2;
+	if (fitting < 1)
+		fitting = 1;
+	if (max_sync_items == 0 || fitting < max_sync_items)
+		max_sync_items = fitting > 255 ? 255 : fitting;
+	pressure_level = PRESSURE_LEVEL_REQUEST_FEWER;
+	EVENT_WARNING(EVENT_SYNC_OUT_OF_MEMORY, num_items, max_sync_items);
+}
+
+uint8_t pressure_max_sync_items() { //number of items the phone should send at most (0 for no limit)
+	return max_sync_items;
+}
@@ -0,0 +1,24 @@
+#include <pebble.h>
+#ifndef PRESSURE_H
+#define PRESSURE_H
+
+//Degradation levels. Every level includes the ones before it
+typedef enum {
+	PRESSURE_LEVEL_NONE, //everything as usual
+	PRESSURE_LEVEL_FEWER_ITEMS, //render fewer items
+	PRESSURE_LEVEL_NO_SECOND_ROWS, //don't render second rows
+	PRESSURE_LEVEL_SINGLE_LINE, //render texts on a single line (no two-line overflow)
+	PRESSURE_LEVEL_REQUEST_FEWER //ask the phone to send fewer items
+} PressureLevel;
+
+//For comments, see pressure.c
+void pressure_update();
+PressureLevel pressure_get_level();
+int pressure_max_display_items(int num_items);
+bool pressure_skip_second_rows();
+bool pressure_single_line_texts();
+bool pressure_sync_fits(int num_items);
+void pressure_sync_failed(int num_items);
+uint8_t pressure_max_sync_items();
+
+#endif
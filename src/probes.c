@@ -0,0 +1,53 @@
+#include <pebble.h>
+#include <probes.h>
+
+#ifdef ENABLE_PROBES
+//Number of most recent durations kept per probe
+#define PROBE_RING_SIZE 16
+
+typedef struct {
+	uint32_t started_at; //ms timestamp of the current run (see now_ms())
+	uint16_t durations[PROBE_RING_SIZE]; //ring buffer of the most recent durations in ms
+	uint8_t next; //position in durations for the next measurement
+	uint8_t count; //number of valid entries in durations
+} Probe;
+
+Probe probes[NUM_PROBES];
+
+static uint32_t now_ms() { //milliseconds (wraps around, only good for differences)
+	time_t s;
+	uint16_t ms;
+	time_ms(&s, &ms);
+	return ((uint32_t) s)*1000+ms;
+}
+
+void probe_start(ProbeId id) { //begins measuring a code path
+	probes[id].started_at = now_ms();
+}
+
+void probe_end(ProbeId id) { //ends measuring a code path, records the duration. No formatting or logging here, as this is in the hot path
+	Probe *probe = &probes[id];
+	uint32_t duration = now_ms()-probe->started_at;
+	probe->durations[probe->next] = duration > UINT16_MAX ? UINT16_MAX : duration;
+	probe->next = (probe->next+1)%PROBE_RING_SIZE;
+	if (probe->count < PROBE_RING_SIZE)
+		probe->count++;
+}
+
+void probes_log_summary() { //logs min/avg/max of the recorded durations for every probe (not for hot paths)
+	static const char *probe_names[NUM_PROBES] = {"display_data", "remove_displayed_data", "time_tick", "in_received", "db_persist", "init"};
+	for (int i=0;i<NUM_PROBES;i++) {
+		if (probes[i].count == 0)
+			continue;
+		uint16_t min = UINT16_MAX, max = 0;
+		uint32_t sum = 0;
+		for (int j=0;j<probes[i].count;j++) {
+			uint16_t d = probes[i].durations[j];
+			if (d < min) min = d;
+			if (d > max) max = d;
+			sum += d;
+		}
+		APP_LOG(APP_LOG_LEVEL_INFO, "probe %s: min %d, avg %d, max %d ms (%d runs)", probe_names[i], (int) min, (int) (sum/probes[i].count), (int) max, (int) probes[i].count);
+	}
+}
+#endif
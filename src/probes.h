@@ -0,0 +1,34 @@
+#include <pebble.h>
+#ifndef PROBES_H
+#define PROBES_H
+
+//Define to measure the duration of hot paths (see probes.c). If undefined, all probe macros compile to nothing
+//#define ENABLE_PROBES
+
+//Measured code paths
+typedef enum {
+	PROBE_DISPLAY_DATA,
+	PROBE_REMOVE_DISPLAYED_DATA,
+	PROBE_TIME_TICK,
+	PROBE_IN_RECEIVED,
+	PROBE_DB_PERSIST,
+	PROBE_INIT,
+	NUM_PROBES
+} ProbeId;
+
+#ifdef ENABLE_PROBES
+//For comments, see probes.c
+void probe_start(ProbeId id);
+void probe_end(ProbeId id);
+void probes_log_summary();
+
+#define PROBE_START(id) probe_start(id)
+#define PROBE_END(id) probe_end(id)
+#define PROBES_LOG_SUMMARY() probes_log_summary()
+#else
+#define PROBE_START(id)
+#define PROBE_END(id)
+#define PROBES_LOG_SUMMARY()
+#endif
+
+#endif
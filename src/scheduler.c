@@ -0,0 +1,87 @@
+#include <pebble.h>
+#include <scheduler.h>
+
+//Decides when the watch should ask the phone for fresh data. All times in seconds (time_t)
+//Interval between syncs after new data arrived. Doubles with every COMMAND_NO_NEW_DATA up to SCHEDULER_MAX_INTERVAL
+#define SCHEDULER_BASE_INTERVAL (60*30)
+#define SCHEDULER_MAX_INTERVAL (60*60*2)
+//Retry interval if a request went unanswered or failed. Doubles with every failure up to SCHEDULER_MAX_RETRY
+#define SCHEDULER_MIN_RETRY 60
+#define SCHEDULER_MAX_RETRY (60*30)
+//Sync this long before the next known item boundary (item starting/ending), so that the data is fresh when the display changes
+#define SCHEDULER_BOUNDARY_LEAD (60*5)
+//... but only if the last successful sync is at least this old
+#define SCHEDULER_BOUNDARY_MIN_AGE (60*10)
+
+static time_t next_sync = 0; //time of the next sync attempt (0 to sync as soon as possible)
+static time_t last_successful_sync = 0; //time where the last sync (with or without new data) was completed
+static time_t sync_interval = SCHEDULER_BASE_INTERVAL; //current interval between successful syncs
+static time_t retry_interval = SCHEDULER_MIN_RETRY; //current interval between failed attempts
+static bool awaiting_response = false; //true if a request has been sent but no answer arrived yet
+static bool failure_counted = false; //true if the last request already failed (and backed off) through scheduler_sync_failed()
+static bool bluetooth_connected = true; //no sync requests while disconnected
+
+bool scheduler_sync_due(time_t now) { //true iff a sync request should be sent now
+	if (!bluetooth_connected)
+		return false;
+	if (now < last_successful_sync) //time went backward (time zoning/DST that has not been handled by scheduler_rebase())
+		return true;
+	return now >= next_sync;
+}
+
+static void scheduler_back_off() { //one more failed attempt
+	retry_interval = retry_interval*2 > SCHEDULER_MAX_RETRY ? SCHEDULER_MAX_RETRY : retry_interval*2;
+}
+
+void scheduler_sync_requested(time_t now) { //a request has been sent. Schedule a retry in case we don't get an answer
+	if (awaiting_response && !failure_counted) //the previous request went unanswered: counts as failure
+		scheduler_back_off();
+	awaiting_response = true;
+	failure_counted = false;
+	next_sync = now+retry_interval;
+}
+
+void scheduler_sync_succeeded(time_t now, bool got_new_data) { //phone answered (with data or COMMAND_NO_NEW_DATA)
+	if (got_new_data)
+		sync_interval = SCHEDULER_BASE_INTERVAL;
+	else if (sync_interval < SCHEDULER_MAX_INTERVAL) //nothing changed, so back off
+		sync_interval = sync_interval*2 > SCHEDULER_MAX_INTERVAL ? SCHEDULER_MAX_INTERVAL : sync_interval*2;
+	
+	awaiting_response = false;
+	retry_interval = SCHEDULER_MIN_RETRY;
+	last_successful_sync = now;
+	next_sync = now+sync_interval;
+}
+
+void scheduler_sync_failed(time_t now) { //request could not be delivered (or the sync was aborted). Retry later with exponential backoff
+	failure_counted = true;
+	next_sync = now+retry_interval;
+	scheduler_back_off();
+}
+
+void scheduler_set_connected(bool connected) { //suppresses syncs while disconnected. Reconnecting triggers a sync right away
+	if (connected && !bluetooth_connected) {
+		next_sync = 0;
+		retry_interval = SCHEDULER_MIN_RETRY;
+		awaiting_response = false; //a request sent before the disconnect doesn't count against the phone
+	}
+	bluetooth_connected = connected;
+}
+
+void scheduler_rebase(time_t shift) { //the clock jumped by shift because the local time offset changed (and the items have been rebased accordingly). Keeps the schedule as it was
+	if (last_successful_sync != 0)
+		last_successful_sync += shift;
+	if (next_sync != 0)
+		next_sync += shift;
+}
+
+void scheduler_set_next_boundary(time_t boundary) { //informs about the next time the displayed data changes (0 if unknown). Brings the next sync forward if necessary
+	if (boundary == 0 || awaiting_response)
+		return;
+	
+	time_t sync_at = boundary-SCHEDULER_BOUNDARY_LEAD;
+	if (sync_at < last_successful_sync+SCHEDULER_BOUNDARY_MIN_AGE)
+		sync_at = last_successful_sync+SCHEDULER_BOUNDARY_MIN_AGE;
+	if (sync_at < next_sync)
+		next_sync = sync_at;
+}
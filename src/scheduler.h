@@ -0,0 +1,14 @@
+#include <pebble.h>
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+//For comments, see scheduler.c
+bool scheduler_sync_due(time_t now);
+void scheduler_sync_requested(time_t now);
+void scheduler_sync_succeeded(time_t now, bool got_new_data);
+void scheduler_sync_failed(time_t now);
+void scheduler_set_connected(bool connected);
+void scheduler_rebase(time_t shift);
+void scheduler_set_next_boundary(time_t boundary);
+
+#endif
@@ -2,12 +2,14 @@
 #include<main.h>
 #include<settings.h>
 #include<persist_const.h>
+#include<stats.h>
 
 //Actual settings stored here
 uint32_t boolean_flags = SETTINGS_BOOL_SHOW_CLOCK_HEADER;
 
 void settings_persist() { //saves settings to persistent storage. 
 	persist_write_int(PERSIST_BOOL_FLAG_SETTINGS, boolean_flags);
+	stats_increment(STAT_FLASH_WRITES);
 }
 
 void settings_restore_persisted() { //restores settings from persistent storage if existing
@@ -20,15 +22,12 @@ uint32_t settings_get_bool_flags() { //getter for general settings (details in s
 	return boolean_flags;
 }
 
-void settings_set(uint32_t flags) { // Will callback to main.h and persist on changes
-	bool changed = false;
-	if (boolean_flags != flags) {
-		boolean_flags = flags;
-		changed = true;
-	}
+void settings_set(uint32_t flags) { // Will callback to main.h (with the flags that changed) and persist on changes
+	uint32_t changed_flags = boolean_flags ^ flags;
+	boolean_flags = flags;
 	
-	if (changed) {
-		handle_new_settings();
+	if (changed_flags != 0) {
+		handle_new_settings(changed_flags);
 		settings_persist();
 	}
 }
\ No newline at end of file
@@ -44,6 +44,15 @@
 	
 //Whether or not to invert the whole watchface
 #define SETTINGS_BOOL_INVERT 0x8000
+
+//Whether or not to show one day per page (tap flips to the next day) instead of one long list
+#define SETTINGS_BOOL_DAY_PAGES 0x10000
+	
+//Groups of flags, by the part of the UI they affect (see handle_new_settings())
+#define SETTINGS_GROUP_HEADER (SETTINGS_BOOL_SHOW_CLOCK_HEADER|SETTINGS_BOOL_HEADER_SIZE0|SETTINGS_BOOL_HEADER_SIZE1)
+#define SETTINGS_GROUP_ITEMS (SETTINGS_BOOL_12H|SETTINGS_BOOL_AMPM|SETTINGS_BOOL_FONT_SIZE0|SETTINGS_BOOL_FONT_SIZE1|SETTINGS_BOOL_SEPARATOR_DATE|SETTINGS_BOOL_COUNTDOWNS|SETTINGS_BOOL_DAY_PAGES)
+#define SETTINGS_GROUP_SCROLL (SETTINGS_BOOL_ENABLE_SCROLL|SETTINGS_BOOL_ENABLED_ALT_SCROLL|SETTINGS_BOOL_DAY_PAGES)
+#define SETTINGS_GROUP_INVERT SETTINGS_BOOL_INVERT
 	
 void settings_persist(); //saves settings to persistent storage. (Does not have to be called from outside settings.c)
 void settings_restore_persisted(); //restores settings from persistent storage (if exists)
@@ -0,0 +1,62 @@
+#include <pebble.h>
+#include <stats.h>
+#include <persist_const.h>
+
+//Rough energy cost per event in microampere-seconds, used by stats_estimate_energy_uas(). These are estimates (CPU awake for a few ms at ~3 mA, radio for ~20 ms at ~10 mA, flash erase/write), good for comparing policies, not for absolute battery life
+#define ENERGY_UAS_WAKEUP 15
+#define ENERGY_UAS_MESSAGE 200
+#define ENERGY_UAS_LAYER 2
+#define ENERGY_UAS_TEXT_LAYOUT 5
+#define ENERGY_UAS_FLASH_WRITE 100
+
+uint32_t stats[NUM_STATS]; //the counters (since the watchface started, except for STAT_PERSIST_*)
+
+void stats_increment(StatId id) {
+	stats[id]++;
+}
+
+void stats_add(StatId id, uint32_t value) {
+	stats[id] += value;
+}
+
+void stats_set(StatId id, uint32_t value) {
+	stats[id] = value;
+}
+
+uint32_t stats_get(StatId id) {
+	return stats[id];
+}
+
+uint32_t stats_now_ms() { //milliseconds (wraps around, only good for differences)
+	time_t s;
+	uint16_t ms;
+	time_ms(&s, &ms);
+	return ((uint32_t) s)*1000+ms;
+}
+
+void stats_persist() { //saves the counters that refer to the time the watchface was closed (STAT_PERSIST_*)
+	stats[STAT_FLASH_WRITES]++;
+	persist_write_data(PERSIST_STAT_PERSIST_COST, &stats[STAT_PERSIST_BYTES], sizeof(uint32_t)*(STAT_PERSIST_MS-STAT_PERSIST_BYTES+1));
+}
+
+void stats_restore_persisted() {
+	if (persist_exists(PERSIST_STAT_PERSIST_COST))
+		persist_read_data(PERSIST_STAT_PERSIST_COST, &stats[STAT_PERSIST_BYTES], sizeof(uint32_t)*(STAT_PERSIST_MS-STAT_PERSIST_BYTES+1));
+}
+
+uint32_t stats_estimate_energy_uas() { //estimated energy spent on the counted activities since start (in microampere-seconds)
+	return stats[STAT_WAKEUPS]*ENERGY_UAS_WAKEUP
+		+ (stats[STAT_MESSAGES_SENT]+stats[STAT_MESSAGES_RECEIVED])*ENERGY_UAS_MESSAGE
+		+ (stats[STAT_LAYERS_CREATED]+stats[STAT_LAYERS_DESTROYED])*ENERGY_UAS_LAYER
+		+ stats[STAT_TEXT_LAYOUTS]*ENERGY_UAS_TEXT_LAYOUT
+		+ stats[STAT_FLASH_WRITES]*ENERGY_UAS_FLASH_WRITE;
+}
+
+#ifdef ENABLE_STATS_LOG
+void stats_log_summary() { //dumps activity counters and energy estimate into the app log
+	APP_LOG(APP_LOG_LEVEL_INFO, "activity: %lu wakeups, %lu msgs out, %lu msgs in, %lu/%lu layers created/destroyed, %lu layouts, %lu flash writes",
+		(unsigned long) stats[STAT_WAKEUPS], (unsigned long) stats[STAT_MESSAGES_SENT], (unsigned long) stats[STAT_MESSAGES_RECEIVED], (unsigned long) stats[STAT_LAYERS_CREATED],
+		(unsigned long) stats[STAT_LAYERS_DESTROYED], (unsigned long) stats[STAT_TEXT_LAYOUTS], (unsigned long) stats[STAT_FLASH_WRITES]);
+	APP_LOG(APP_LOG_LEVEL_INFO, "estimated energy: %lu uAs", (unsigned long) stats_estimate_energy_uas());
+}
+#endif
@@ -0,0 +1,45 @@
+#include <pebble.h>
+#ifndef STATS_H
+#define STATS_H
+
+//Performance counters that are reported to the phone with every sync request
+typedef enum {
+	STAT_REBUILDS, //number of display rebuilds (display_begin() calls)
+	STAT_LAST_REBUILD_MS, //duration of the last display_data() in ms
+	STAT_DROPPED_INBOUND, //number of dropped incoming messages
+	STAT_SYNC_RESTARTS, //number of syncs restarted via handle_sync_failed()
+	STAT_PERSIST_BYTES, //bytes written by the last db_persist() (survives restarts, like the other STAT_PERSIST_*)
+	STAT_PERSIST_KEYS, //persistent storage keys written by the last db_persist()
+	STAT_PERSIST_MS, //duration of the last db_persist() in ms
+	//Activity counters for the energy estimate (see stats_estimate_energy_uas())
+	STAT_WAKEUPS, //event handlers called by the system (ticks, taps, Bluetooth, battery, messages)
+	STAT_MESSAGES_SENT,
+	STAT_MESSAGES_RECEIVED,
+	STAT_LAYERS_CREATED,
+	STAT_LAYERS_DESTROYED,
+	STAT_TEXT_LAYOUTS, //text measurements (graphics_text_layout_get_content_size())
+	STAT_FLASH_WRITES, //persistent storage writes
+	NUM_STATS
+} StatId;
+
+//Define to dump the activity counters and the energy estimate into the app log when the watchface exits. If undefined, STATS_LOG_SUMMARY() compiles to nothing
+//#define ENABLE_STATS_LOG
+
+//For comments, see stats.c
+void stats_increment(StatId id);
+void stats_add(StatId id, uint32_t value);
+void stats_set(StatId id, uint32_t value);
+uint32_t stats_get(StatId id);
+uint32_t stats_now_ms();
+void stats_persist();
+void stats_restore_persisted();
+uint32_t stats_estimate_energy_uas();
+
+#ifdef ENABLE_STATS_LOG
+void stats_log_summary();
+#define STATS_LOG_SUMMARY() stats_log_summary()
+#else
+#define STATS_LOG_SUMMARY()
+#endif
+
+#endif
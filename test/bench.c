@@ -0,0 +1,161 @@
+#include <pebble.h>
+#include <shim.h>
+#include <phone.h>
+#include <harness.h>
+#include <item_db.h>
+#include <communication.h>
+
+//Benchmark of the watchface's hot paths on the host: display_data(), the minute tick, in_received_handler() (a whole sync) and db_persist().
+//Usage: bench [-r repetitions] [calendar sizes...]
+//Host times are only good for comparing changes on the same machine. The counters (layers, layouts, allocations, storage) are exact
+
+#define BENCH_MAX_ITEMS 64
+#define BENCH_MAX_MESSAGES (2*BENCH_MAX_ITEMS+2)
+#define BENCH_SETTINGS (SETTINGS_BOOL_SHOW_CLOCK_HEADER|SETTINGS_BOOL_SEPARATOR_DATE|SETTINGS_BOOL_ENABLE_SCROLL)
+
+typedef struct {
+	int num_items;
+	int repetitions;
+} BenchArgs;
+
+typedef struct {
+	uint64_t display_ns, tick_ns, sync_ns, persist_ns; //per call (per sync for sync_ns)
+	int messages; //per sync
+	uint32_t layers, layouts, mallocs, malloc_bytes; //per display_data()
+	uint32_t persist_bytes, persist_keys; //per db_persist()
+	uint64_t persist_sim_us;
+	uint32_t heap_peak;
+} BenchResult;
+
+static int build_session(uint8_t messages[][PHONE_INBOX_SIZE], size_t *sizes, PhoneItem *items, int num_items, uint8_t sync_id) { //same messages as the phone sends (see phone.c)
+	int n = 0;
+	sizes[n] = phone_build_init(messages[n], PHONE_INBOX_SIZE, PHONE_VERSION, num_items, true, sync_id, BENCH_SETTINGS);
+	n++;
+	for (int i=0;i<num_items;i++) {
+		if ((sizes[n] = phone_build_item(messages[n], PHONE_INBOX_SIZE, PHONE_COMMAND_ITEM, i, &items[i])) != 0) {
+			n++;
+			continue;
+		}
+		sizes[n] = phone_build_item(messages[n], PHONE_INBOX_SIZE, PHONE_COMMAND_ITEM_1, i, &items[i]);
+		n++;
+		sizes[n] = phone_build_item(messages[n], PHONE_INBOX_SIZE, PHONE_COMMAND_ITEM_2, i, &items[i]);
+		n++;
+	}
+	sizes[n] = phone_build_command(messages[n], PHONE_INBOX_SIZE, PHONE_COMMAND_DONE, 0);
+	return n+1;
+}
+
+static bool bench_child(void *arg, void *result_ptr) {
+	BenchArgs *args = arg;
+	BenchResult *result = result_ptr;
+	memset(result, 0, sizeof(BenchResult));
+	static PhoneItem items[BENCH_MAX_ITEMS];
+	static uint8_t messages[BENCH_MAX_MESSAGES][PHONE_INBOX_SIZE];
+	static size_t sizes[BENCH_MAX_MESSAGES];
+	int reps = args->repetitions;
+
+	//Launch and sync once, so that the watchface is in its usual state
+	shim_reset(HARNESS_START_TIME);
+	Phone phone;
+	harness_make_calendar(items, args->num_items, HARNESS_START_TIME, 1);
+	phone_init(&phone, items, args->num_items, BENCH_SETTINGS);
+	shim_set_phone(phone_handle_message, &phone);
+	harness_launch();
+	if (!harness_sync(&phone))
+		return false;
+	shim_advance(5000); //background persist
+
+	//display_data()
+	uint64_t ns = 0;
+	shim_reset_counters();
+	for (int r=0;r<reps;r++) {
+		remove_displayed_data();
+		uint32_t layers = shim_counters.text_layers_created, layouts = shim_counters.text_layouts, mallocs = shim_counters.mallocs, bytes = shim_counters.malloc_bytes;
+		uint64_t start = harness_host_ns();
+		display_data();
+		ns += harness_host_ns()-start;
+		result->layers = shim_counters.text_layers_created-layers;
+		result->layouts = shim_counters.text_layouts-layouts;
+		result->mallocs = shim_counters.mallocs-mallocs;
+		result->malloc_bytes = shim_counters.malloc_bytes-bytes;
+	}
+	result->display_ns = ns/reps;
+
+	//Minute ticks (clock update, sync check, refresh when an item starts/ends)
+	ns = 0;
+	for (int r=0;r<reps;r++) {
+		uint32_t to_tick = 60000-(uint32_t) (shim_now_ms()%60000);
+		shim_advance(to_tick-1);
+		uint64_t start = harness_host_ns();
+		shim_advance(1);
+		ns += harness_host_ns()-start;
+	}
+	result->tick_ns = ns/reps;
+	shim_advance(10000); //let a sync that the ticks requested finish
+	shim_set_phone(NULL, NULL); //from here on, messages are fed directly
+
+	//Syncs through in_received_handler() and the following db_persist()
+	uint64_t persist_ns = 0;
+	ns = 0;
+	for (int r=0;r<reps;r++) {
+		harness_make_calendar(items, args->num_items, HARNESS_START_TIME, r+2); //new content, so that everything has to be written
+		result->messages = build_session(messages, sizes, items, args->num_items, (uint8_t) (r%200+2));
+		uint64_t start = harness_host_ns();
+		for (int m=0;m<result->messages;m++) {
+			DictionaryIterator iter;
+			dict_read_begin_from_buffer(&iter, messages[m], sizes[m]);
+			in_received_handler(&iter, NULL);
+		}
+		ns += harness_host_ns()-start;
+
+		uint32_t writes = shim_counters.persist_writes+shim_counters.persist_deletes, bytes = shim_counters.persist_bytes_written;
+		uint64_t sim_us = shim_counters.persist_us;
+		start = harness_host_ns();
+		db_persist();
+		persist_ns += harness_host_ns()-start;
+		result->persist_keys = shim_counters.persist_writes+shim_counters.persist_deletes-writes;
+		result->persist_bytes = shim_counters.persist_bytes_written-bytes;
+		result->persist_sim_us = shim_counters.persist_us-sim_us;
+	}
+	result->sync_ns = ns/reps;
+	result->persist_ns = persist_ns/reps;
+	result->heap_peak = shim_counters.heap_peak;
+
+	harness_exit();
+	return true;
+}
+
+int main(int argc, char **argv) {
+	BenchArgs args = {.repetitions = 200};
+	int sizes[32], num_sizes = 0;
+	for (int i=1;i<argc;i++) {
+		if (strcmp(argv[i], "-r") == 0 && i+1 < argc)
+			args.repetitions = atoi(argv[++i]);
+		else if (num_sizes < 32)
+			sizes[num_sizes++] = atoi(argv[i]);
+	}
+	if (num_sizes == 0) {
+		int defaults[] = {0, 1, 5, 10, 20, 30};
+		for (num_sizes=0;num_sizes<6;num_sizes++)
+			sizes[num_sizes] = defaults[num_sizes];
+	}
+	if (args.repetitions < 1)
+		args.repetitions = 1;
+
+	printf("%5s %12s %10s %10s %12s | %6s %7s %7s %7s | %6s %5s %9s | %6s\n", "items", "display_us", "tick_us", "sync_us", "persist_us",
+		"layers", "layouts", "mallocs", "bytes", "p_byte", "p_key", "p_sim_ms", "heap");
+	bool ok = true;
+	for (int s=0;s<num_sizes;s++) {
+		args.num_items = sizes[s] < 0 ? 0 : sizes[s] > BENCH_MAX_ITEMS ? BENCH_MAX_ITEMS : sizes[s];
+		BenchResult result;
+		if (!harness_fork(bench_child, &args, &result, sizeof(result))) {
+			printf("%5d failed\n", args.num_items);
+			ok = false;
+			continue;
+		}
+		printf("%5d %12.1f %10.2f %10.1f %12.1f | %6u %7u %7u %7u | %6u %5u %9.1f | %6u\n", args.num_items, result.display_ns/1000.0, result.tick_ns/1000.0,
+			result.sync_ns/1000.0, result.persist_ns/1000.0, result.layers, result.layouts, result.mallocs, result.malloc_bytes,
+			result.persist_bytes, result.persist_keys, result.persist_sim_us/1000.0, result.heap_peak);
+	}
+	return ok ? 0 : 1;
+}
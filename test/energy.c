@@ -0,0 +1,130 @@
+#include <pebble.h>
+#include <shim.h>
+#include <phone.h>
+#include <harness.h>
+#include <settings.h>
+#include <stats.h>
+
+//Simulates 24 hours of the watchface on the host shim: minute ticks, taps, the phone changing the calendar, Bluetooth dropping out at night,
+//and all the syncs the scheduler asks for. Counts wakeups, messages, layers, text layouts and flash writes, and converts them into energy with
+//the watch's own model (stats_estimate_energy_uas()). Compare the output before and after changing sync or refresh policy.
+//Usage: energy [-n items] [-t taps_per_hour] [-c calendar_changes] [-d disconnected_hours] [-h hours]
+
+#define ENERGY_MAX_ITEMS 30
+#define ENERGY_SETTINGS (SETTINGS_BOOL_SHOW_CLOCK_HEADER|SETTINGS_BOOL_SEPARATOR_DATE|SETTINGS_BOOL_ENABLE_SCROLL|SETTINGS_BOOL_COUNTDOWNS)
+#define ENERGY_BATTERY_MAH 130 //Pebble (original)
+#define ENERGY_DAY_START_HOUR 8 //taps only happen while awake
+#define ENERGY_DAY_END_HOUR 22
+#define ENERGY_DISCONNECT_HOUR 23 //Bluetooth drops out then (phone elsewhere/switched off)
+
+typedef struct {
+	int num_items, taps_per_hour, calendar_changes, disconnected_hours, hours;
+} EnergyArgs;
+
+typedef struct {
+	uint32_t stats[NUM_STATS];
+	uint32_t energy_uas;
+	uint32_t requests, syncs, no_new_data; //phone side
+	uint32_t ticks, taps, lights, vibes, heap_peak;
+	uint64_t flash_us;
+} EnergyResult;
+
+static bool energy_child(void *arg, void *result_ptr) {
+	EnergyArgs *args = arg;
+	EnergyResult *result = result_ptr;
+	memset(result, 0, sizeof(EnergyResult));
+	static PhoneItem items[ENERGY_MAX_ITEMS];
+	harness_make_calendar(items, args->num_items, HARNESS_START_TIME, 11);
+
+	shim_reset(HARNESS_START_TIME);
+	Phone phone;
+	phone_init(&phone, items, args->num_items, ENERGY_SETTINGS);
+	shim_set_phone(phone_handle_message, &phone);
+	harness_launch();
+
+	int minutes = args->hours*60;
+	int tap_every = args->taps_per_hour > 0 ? 60/args->taps_per_hour : 0;
+	int change_every = args->calendar_changes > 0 ? minutes/(args->calendar_changes+1) : 0;
+	int changes = 0;
+	for (int m=1;m<=minutes;m++) {
+		shim_advance(60000);
+		struct tm *now = shim_localtime();
+
+		//Bluetooth: away at night
+		bool connected = !(args->disconnected_hours > 0 && ((now->tm_hour-ENERGY_DISCONNECT_HOUR+24)%24) < args->disconnected_hours);
+		shim_set_connected(connected);
+
+		//Taps while awake (a tap and a look)
+		if (tap_every != 0 && now->tm_hour >= ENERGY_DAY_START_HOUR && now->tm_hour < ENERGY_DAY_END_HOUR && now->tm_min%tap_every == 0) {
+			shim_advance(20000);
+			shim_tap(ACCEL_AXIS_Y, 1);
+			result->taps++;
+		}
+
+		//The calendar changes and the phone pushes
+		if (change_every != 0 && m%change_every == 0 && changes < args->calendar_changes && args->num_items > 0) {
+			snprintf(items[changes%args->num_items].text1, sizeof(items[0].text1), "Rescheduled %d", changes);
+			phone_set_items(&phone, items, args->num_items);
+			changes++;
+			if (connected) {
+				uint8_t buffer[PHONE_INBOX_SIZE];
+				size_t size = phone_build_command(buffer, sizeof(buffer), PHONE_COMMAND_FORCE_REQUEST, 0);
+				shim_deliver(buffer, size, 0);
+			}
+		}
+	}
+
+	for (int i=0;i<NUM_STATS;i++)
+		result->stats[i] = stats_get(i);
+	result->energy_uas = stats_estimate_energy_uas();
+	result->requests = phone.requests;
+	result->syncs = phone.syncs;
+	result->no_new_data = phone.no_new_data;
+	result->ticks = shim_counters.ticks;
+	result->lights = shim_counters.lights;
+	result->vibes = shim_counters.vibes;
+	result->heap_peak = shim_counters.heap_peak;
+	result->flash_us = shim_counters.persist_us;
+	harness_exit();
+	return true;
+}
+
+int main(int argc, char **argv) {
+	EnergyArgs args = {.num_items = 20, .taps_per_hour = 4, .calendar_changes = 6, .disconnected_hours = 7, .hours = 24};
+	for (int i=1;i+1<argc;i+=2) {
+		int value = atoi(argv[i+1]);
+		if (strcmp(argv[i], "-n") == 0)
+			args.num_items = value < 0 ? 0 : value > ENERGY_MAX_ITEMS ? ENERGY_MAX_ITEMS : value;
+		else if (strcmp(argv[i], "-t") == 0)
+			args.taps_per_hour = value < 0 ? 0 : value > 60 ? 60 : value;
+		else if (strcmp(argv[i], "-c") == 0)
+			args.calendar_changes = value;
+		else if (strcmp(argv[i], "-d") == 0)
+			args.disconnected_hours = value;
+		else if (strcmp(argv[i], "-h") == 0)
+			args.hours = value < 1 ? 1 : value;
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 2;
+		}
+	}
+
+	EnergyResult result;
+	if (!harness_fork(energy_child, &args, &result, sizeof(result))) {
+		printf("simulation failed\n");
+		return 1;
+	}
+
+	printf("%d hours, %d items, %d taps/hour, %d calendar changes, %d hours disconnected\n", args.hours, args.num_items, args.taps_per_hour, args.calendar_changes, args.disconnected_hours);
+	printf("wakeups           %8u (%u ticks, %u taps)\n", result.stats[STAT_WAKEUPS], result.ticks, result.taps);
+	printf("messages out/in   %8u / %u (%u requests answered: %u syncs, %u no new data)\n", result.stats[STAT_MESSAGES_SENT], result.stats[STAT_MESSAGES_RECEIVED], result.requests, result.syncs, result.no_new_data);
+	printf("layers cr./destr. %8u / %u\n", result.stats[STAT_LAYERS_CREATED], result.stats[STAT_LAYERS_DESTROYED]);
+	printf("text layouts      %8u\n", result.stats[STAT_TEXT_LAYOUTS]);
+	printf("flash writes      %8u (%.1f ms simulated flash time)\n", result.stats[STAT_FLASH_WRITES], result.flash_us/1000.0);
+	printf("display rebuilds  %8u\n", result.stats[STAT_REBUILDS]);
+	printf("backlight/vibes   %8u / %u\n", result.lights, result.vibes);
+	printf("heap peak         %8u bytes\n", result.heap_peak);
+	double mah = result.energy_uas/3600.0/1000.0;
+	printf("estimated energy  %8u uAs = %.3f mAh (%.2f%% of a %d mAh battery)\n", result.energy_uas, mah, 100.0*mah/ENERGY_BATTERY_MAH, ENERGY_BATTERY_MAH);
+	return 0;
+}
@@ -0,0 +1,109 @@
+#include <pebble.h>
+#include <shim.h>
+#include <harness.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define HARNESS_STARTUP_MS 3000 //covers the startup stages and the snapshot replacement (see main.c)
+#define HARNESS_SYNC_SLACK_MS 1000 //after the phone's last message
+
+void harness_launch() {
+	handle_init();
+	shim_advance(HARNESS_STARTUP_MS);
+}
+
+void harness_exit() {
+	handle_deinit();
+}
+
+bool harness_sync(Phone *phone) {
+	uint32_t requests = phone->requests;
+	for (int minute=0;minute<2 && phone->requests == requests;minute++) //the request goes out with the next tick (if due)
+		shim_advance(60000-(uint32_t) (shim_now_ms()%60000)+10);
+	if (phone->requests == requests)
+		return false;
+	if (phone->busy_until_ms > shim_mono_ms())
+		shim_advance((uint32_t) (phone->busy_until_ms-shim_mono_ms()));
+	shim_advance(HARNESS_SYNC_SLACK_MS);
+	return true;
+}
+
+caltime_t harness_caltime(time_t t) {
+	struct tm result;
+	gmtime_r(&t, &result); //the simulated watch runs in UTC
+	return tm_to_caltime(&result);
+}
+
+static uint32_t next_random(uint32_t *state) {
+	*state = *state*1103515245+12345;
+	return (*state >> 16) & 0x7FFF;
+}
+
+void harness_make_calendar(PhoneItem *items, int num_items, time_t now, uint32_t seed) {
+	static const char *titles[] = {"Standup", "Lunch with Anna", "Dentist", "Project review: quarterly planning and budget", "Gym", "Call Mom",
+		"Team offsite preparation meeting with the whole department", "Train to Berlin", "Pick up kids", "1:1"};
+	static const char *locations[] = {"Room 4.12", "", "Main Street 5, 2nd floor", "Online", "Central Station, platform 7"};
+	uint32_t state = seed;
+	time_t start = now-30*60; //first item is running already
+
+	for (int i=0;i<num_items;i++) {
+		PhoneItem *item = &items[i];
+		memset(item, 0, sizeof(PhoneItem));
+		snprintf(item->text1, sizeof(item->text1), "%s", titles[next_random(&state)%(sizeof(titles)/sizeof(titles[0]))]);
+		snprintf(item->text2, sizeof(item->text2), "%s", locations[next_random(&state)%(sizeof(locations)/sizeof(locations[0]))]);
+
+		if (i%7 == 6) { //all-day item: midnight to midnight, no times shown
+			time_t day = (start/86400)*86400;
+			item->start_time = harness_caltime(day);
+			item->end_time = harness_caltime(day+86400);
+			item->design1 = 0x01 | ROW_DESIGN_TEXT_BOLD;
+			item->design2 = 0;
+			continue;
+		}
+
+		time_t duration = (15+next_random(&state)%8*15)*60;
+		item->start_time = harness_caltime(start);
+		item->end_time = harness_caltime(start+duration);
+		item->design1 = (next_random(&state)%4+1)*ROW_DESIGN_TIME_TYPE_OFFSET | (i%3 == 0 ? ROW_DESIGN_TEXT_OVERFLOW_OFFSET : 0) | (i%5 == 0 ? ROW_DESIGN_TEXT_BOLD : 0);
+		item->design2 = item->text2[0] == 0 ? 0 : 0x01;
+		start += (next_random(&state)%2 == 0 ? duration : 0)+(next_random(&state)%6)*30*60; //overlapping or with gaps
+	}
+}
+
+bool harness_fork(HarnessChild child, void *arg, void *result, size_t result_size) {
+	int fds[2];
+	if (pipe(fds) != 0)
+		return false;
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid < 0)
+		return false;
+	if (pid == 0) {
+		close(fds[0]);
+		bool ok = child(arg, result);
+		if (write(fds[1], result, result_size) != (ssize_t) result_size)
+			ok = false;
+		fflush(stdout);
+		_exit(ok ? 0 : 1);
+	}
+
+	close(fds[1]);
+	size_t read_bytes = 0;
+	while (read_bytes < result_size) {
+		ssize_t n = read(fds[0], (uint8_t*) result+read_bytes, result_size-read_bytes);
+		if (n <= 0)
+			break;
+		read_bytes += n;
+	}
+	close(fds[0]);
+	int status;
+	waitpid(pid, &status, 0);
+	return read_bytes == result_size && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+uint64_t harness_host_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec*1000000000+now.tv_nsec;
+}
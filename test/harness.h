@@ -0,0 +1,30 @@
+#include <pebble.h>
+#include <phone.h>
+
+#ifndef HARNESS_H
+#define HARNESS_H
+
+//Helpers for the host programs in test/: launching the watchface on the simulated watch, calendars, child processes
+
+#define HARNESS_START_TIME ((time_t) 1772438400) //Monday, 2 March 2026, 08:00 (local time = UTC on the simulated watch)
+
+//Watchface entry points (see main.c)
+void handle_init(void);
+void handle_deinit(void);
+void display_data();
+void remove_displayed_data();
+
+void harness_launch(); //handle_init() and the startup stages
+void harness_exit(); //handle_deinit()
+bool harness_sync(Phone *phone); //waits for the next sync request (minute tick) and the phone's answer. Returns false if the phone got no request
+caltime_t harness_caltime(time_t t);
+void harness_make_calendar(PhoneItem *items, int num_items, time_t now, uint32_t seed); //deterministic mix of short, long, overlapping and all-day items
+
+//Runs child(arg, result) in a child process, so that it starts with fresh watchface globals. result (result_size bytes) is copied back.
+//Returns false if the child returned false or crashed
+typedef bool (*HarnessChild)(void *arg, void *result);
+bool harness_fork(HarnessChild child, void *arg, void *result, size_t result_size);
+
+uint64_t harness_host_ns(); //host clock (for timing)
+
+#endif
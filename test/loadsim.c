@@ -0,0 +1,235 @@
+#include <pebble.h>
+#include <shim.h>
+#include <phone.h>
+#include <harness.h>
+#include <settings.h>
+#include <item_db.h>
+#include <communication.h>
+#include <stats.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+//Load simulator for the sync protocol (in_received_handler() and item_db): N simulated watches sync at the same time, each against its own
+//stand-in phone over a link with latency, jitter and loss. The phones can share one endpoint with a limited message rate. Every watch
+//gets K calendar changes pushed (COMMAND_FORCE_REQUEST). A sync is complete when the changed item has arrived in the watch's db.
+//Reports, for each N: sync throughput, latency percentiles (simulated time, push to item in the db), restarts per sync and answers the phones gave up on.
+//Each watch is a process of its own (the watchface keeps its state in globals, so it can't run twice in one process).
+//Usage: loadsim [-k syncs] [-i items] [-l latency_ms] [-j jitter_ms] [-p loss_permille] [-c endpoint_messages_per_s] [watch counts...]
+
+#define LS_MAX_ITEMS 30
+#define LS_MAX_SYNCS 32
+#define LS_MAX_WATCHES 256
+#define LS_SETTINGS (SETTINGS_BOOL_SHOW_CLOCK_HEADER|SETTINGS_BOOL_SEPARATOR_DATE)
+#define LS_STEP_MS 100
+#define LS_TIMEOUT_MS (5*60*1000) //a sync that takes longer failed (the watch retries on its own in between)
+
+typedef struct {
+	int watch; //index (seeds the calendar and the link)
+	int num_watches;
+	int num_syncs, num_items;
+	uint32_t latency_ms, jitter_ms, loss_permille;
+	uint32_t endpoint_rate; //messages/s of all phones together (0: unlimited)
+} LsArgs;
+
+typedef struct {
+	uint32_t latencies_ms[LS_MAX_SYNCS]; //0 if the sync didn't complete
+	int completed;
+	uint32_t restarts; //STAT_SYNC_RESTARTS
+	uint32_t requests, messages, lost_messages, failed_syncs; //phone side
+} LsResult;
+
+static bool item_arrived(const char *text) {
+	for (int i=0;i<db_size();i++)
+		if (strcmp(db_get(i)->row1text, text) == 0)
+			return true;
+	return false;
+}
+
+static bool push(Phone *phone) { //the phone asks for a request (resent if lost)
+	uint8_t buffer[PHONE_INBOX_SIZE];
+	size_t size = phone_build_command(buffer, sizeof(buffer), PHONE_COMMAND_FORCE_REQUEST, 0);
+	for (int attempt=0;attempt<phone->max_attempts;attempt++) {
+		if (shim_deliver(buffer, size, 0) == APP_MSG_OK)
+			return true;
+		shim_advance(phone->resend_after_ms);
+	}
+	return false;
+}
+
+static bool watch_child(void *arg, void *result_ptr) {
+	LsArgs *args = arg;
+	LsResult *result = result_ptr;
+	memset(result, 0, sizeof(LsResult));
+	static PhoneItem items[LS_MAX_ITEMS];
+	harness_make_calendar(items, args->num_items, HARNESS_START_TIME, 100+args->watch);
+
+	shim_reset(HARNESS_START_TIME);
+	uint32_t seed = 7919*(args->watch+1);
+	shim_set_link(args->latency_ms+(args->jitter_ms > 0 ? seed%(args->jitter_ms+1) : 0), args->loss_permille, seed);
+	Phone phone;
+	phone_init(&phone, items, args->num_items, LS_SETTINGS);
+	if (args->endpoint_rate > 0) { //fair share of the endpoint
+		uint32_t interval = (uint32_t) args->num_watches*1000/args->endpoint_rate;
+		phone.message_interval_ms = interval > phone.message_interval_ms ? interval : phone.message_interval_ms;
+	}
+	shim_set_phone(phone_handle_message, &phone);
+	harness_launch();
+	harness_sync(&phone); //initial sync (not measured)
+	shim_advance(5000);
+	uint32_t restarts_before = stats_get(STAT_SYNC_RESTARTS);
+
+	for (int s=0;s<args->num_syncs && args->num_items > 0;s++) {
+		PhoneItem *changed = &items[(s*7+args->watch)%args->num_items];
+		snprintf(changed->text1, sizeof(changed->text1), "Change %d of watch %d", s, args->watch);
+		phone_set_items(&phone, items, args->num_items);
+		uint64_t pushed_at = shim_now_ms();
+		push(&phone);
+		while (!item_arrived(changed->text1) && shim_now_ms()-pushed_at < LS_TIMEOUT_MS)
+			shim_advance(LS_STEP_MS);
+		if (item_arrived(changed->text1)) {
+			result->latencies_ms[s] = (uint32_t) (shim_now_ms()-pushed_at);
+			result->completed++;
+		}
+		while (communication_sync_in_progress() && shim_now_ms()-pushed_at < LS_TIMEOUT_MS) //let the rest of the sync finish before the next change
+			shim_advance(LS_STEP_MS);
+		shim_advance(5000); //background persist
+	}
+
+	result->restarts = stats_get(STAT_SYNC_RESTARTS)-restarts_before;
+	result->requests = phone.requests;
+	result->messages = phone.messages;
+	result->lost_messages = phone.lost_messages;
+	result->failed_syncs = phone.failed_syncs;
+	harness_exit();
+	return true;
+}
+
+static int compare_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+//Runs all watches at the same time (one process each, see harness_fork() for the sequential version). Returns the number of watches that crashed
+static int run_watches(LsArgs *base, int num_watches, LsResult *results) {
+	static pid_t pids[LS_MAX_WATCHES];
+	static int fds[LS_MAX_WATCHES];
+	fflush(stdout);
+	for (int w=0;w<num_watches;w++) {
+		int pipe_fds[2];
+		pids[w] = -1;
+		fds[w] = -1;
+		if (pipe(pipe_fds) != 0)
+			continue;
+		pid_t pid = fork();
+		if (pid < 0) {
+			close(pipe_fds[0]);
+			close(pipe_fds[1]);
+			continue;
+		}
+		if (pid == 0) {
+			close(pipe_fds[0]);
+			LsArgs args = *base;
+			args.watch = w;
+			LsResult result;
+			bool ok = watch_child(&args, &result);
+			if (write(pipe_fds[1], &result, sizeof(result)) != (ssize_t) sizeof(result))
+				ok = false;
+			_exit(ok ? 0 : 1);
+		}
+		close(pipe_fds[1]);
+		pids[w] = pid;
+		fds[w] = pipe_fds[0];
+	}
+
+	int crashed = 0;
+	for (int w=0;w<num_watches;w++) {
+		memset(&results[w], 0, sizeof(LsResult));
+		size_t read_bytes = 0;
+		while (fds[w] >= 0 && read_bytes < sizeof(LsResult)) {
+			ssize_t n = read(fds[w], (uint8_t*) &results[w]+read_bytes, sizeof(LsResult)-read_bytes);
+			if (n <= 0)
+				break;
+			read_bytes += n;
+		}
+		if (fds[w] >= 0)
+			close(fds[w]);
+		int status = 1;
+		if (pids[w] > 0)
+			waitpid(pids[w], &status, 0);
+		if (read_bytes != sizeof(LsResult) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			memset(&results[w], 0, sizeof(LsResult));
+			crashed++;
+		}
+	}
+	return crashed;
+}
+
+int main(int argc, char **argv) {
+	LsArgs base = {.num_syncs = 5, .num_items = 20, .latency_ms = 30, .jitter_ms = 20, .loss_permille = 10, .endpoint_rate = 0};
+	int counts[16], num_counts = 0;
+	for (int i=1;i<argc;i++) {
+		if (argv[i][0] == '-' && i+1 < argc) {
+			int value = atoi(argv[++i]);
+			value = value < 0 ? 0 : value;
+			switch (argv[i-1][1]) {
+				case 'k': base.num_syncs = value > LS_MAX_SYNCS ? LS_MAX_SYNCS : value; break;
+				case 'i': base.num_items = value > LS_MAX_ITEMS ? LS_MAX_ITEMS : value; break;
+				case 'l': base.latency_ms = value; break;
+				case 'j': base.jitter_ms = value; break;
+				case 'p': base.loss_permille = value > 1000 ? 1000 : value; break;
+				case 'c': base.endpoint_rate = value; break;
+				default:
+					fprintf(stderr, "unknown option %s\n", argv[i-1]);
+					return 2;
+			}
+		}
+		else if (num_counts < 16) {
+			int n = atoi(argv[i]);
+			counts[num_counts++] = n < 1 ? 1 : n > LS_MAX_WATCHES ? LS_MAX_WATCHES : n;
+		}
+	}
+	if (num_counts == 0) {
+		int defaults[] = {1, 2, 4, 8, 16, 32};
+		for (num_counts=0;num_counts<6;num_counts++)
+			counts[num_counts] = defaults[num_counts];
+	}
+
+	printf("%d syncs of %d items per watch, link %u+%u ms, %u/1000 lost, endpoint %u messages/s%s\n", base.num_syncs, base.num_items,
+		base.latency_ms, base.jitter_ms, base.loss_permille, base.endpoint_rate, base.endpoint_rate == 0 ? " (unlimited)" : "");
+	printf("%7s %9s %9s %9s %8s %8s %8s %9s %9s %7s %7s\n", "watches", "complete", "syncs/s", "sim_syncs/h", "p50_ms", "p99_ms", "max_ms", "restarts", "msgs", "lost", "gave_up");
+	static LsResult results[LS_MAX_WATCHES];
+	static uint32_t latencies[LS_MAX_WATCHES*LS_MAX_SYNCS];
+	int crashed_total = 0;
+	for (int c=0;c<num_counts;c++) {
+		base.num_watches = counts[c];
+		uint64_t start = harness_host_ns();
+		int crashed = run_watches(&base, counts[c], results);
+		double host_s = (harness_host_ns()-start)/1e9;
+		crashed_total += crashed;
+
+		int completed = 0;
+		uint64_t latency_sum = 0;
+		uint32_t restarts = 0, messages = 0, lost = 0, gave_up = 0;
+		for (int w=0;w<counts[c];w++) {
+			for (int s=0;s<base.num_syncs;s++)
+				if (results[w].latencies_ms[s] != 0) {
+					latencies[completed++] = results[w].latencies_ms[s];
+					latency_sum += results[w].latencies_ms[s];
+				}
+			restarts += results[w].restarts;
+			messages += results[w].messages;
+			lost += results[w].lost_messages;
+			gave_up += results[w].failed_syncs;
+		}
+		qsort(latencies, completed, sizeof(uint32_t), compare_u32);
+		uint32_t p50 = completed > 0 ? latencies[(completed-1)/2] : 0;
+		uint32_t p99 = completed > 0 ? latencies[(completed-1)*99/100] : 0;
+		uint32_t max = completed > 0 ? latencies[completed-1] : 0;
+		double mean_s = completed > 0 ? latency_sum/1000.0/completed : 0;
+		printf("%7d %4d/%-4d %9.1f %11.0f %8u %8u %8u %9.3f %9u %7u %7u\n", counts[c], completed, counts[c]*base.num_syncs, completed/host_s,
+			mean_s > 0 ? counts[c]*3600/mean_s : 0, p50, p99, max, completed > 0 ? (double) restarts/completed : 0, messages, lost, gave_up);
+		if (crashed > 0)
+			printf("%7d watches crashed\n", crashed);
+	}
+	return crashed_total == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include <pebble.h>
+#include <shim.h>
+#include <phone.h>
+#include <harness.h>
+#include <settings.h>
+#include <item_db.h>
+
+//Clock jumps between two minute ticks (detect_offset_change() in main.c). A time zone/DST change moves the phone's timed items by the jump,
+//and the watch should rebase its db without being sent everything again. A clock that is merely set (the phone's items stay where they are)
+//must leave the db alone, even if the jump is a multiple of 15 minutes. Either way, the db has to end up with the phone's times. Exits non-zero on failure
+
+#define OT_NUM_ITEMS 14
+#define OT_SETTINGS SETTINGS_BOOL_SHOW_CLOCK_HEADER
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do { if (!(condition)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+typedef struct {
+	int32_t jump_minutes; //clock jump
+	bool offset_change; //whether the phone's items move with it (time zone/DST) or not (clock set)
+} OtArgs;
+
+typedef struct {
+	uint32_t requests, full_syncs, no_new_data; //phone side, after the jump
+	int items, matching; //db_size(), items with the phone's times
+	int moved; //items whose times differ from before the jump
+} OtResult;
+
+static bool jump_child(void *arg, void *result_ptr) {
+	OtArgs *args = arg;
+	OtResult *result = result_ptr;
+	memset(result, 0, sizeof(OtResult));
+	static PhoneItem items[OT_NUM_ITEMS];
+	static caltime_t start_times[OT_NUM_ITEMS];
+	harness_make_calendar(items, OT_NUM_ITEMS, HARNESS_START_TIME, 5);
+
+	shim_reset(HARNESS_START_TIME);
+	Phone phone;
+	phone_init(&phone, items, OT_NUM_ITEMS, OT_SETTINGS);
+	shim_set_phone(phone_handle_message, &phone);
+	harness_launch();
+	if (!harness_sync(&phone))
+		return false;
+	shim_advance(5000); //background persist
+	for (int i=0;i<db_size();i++)
+		start_times[i] = db_get(i)->start_time;
+
+	if (args->offset_change) { //the phone now sends the timed items in the new local time (and takes that as a calendar change)
+		for (int i=0;i<OT_NUM_ITEMS;i++) {
+			AgendaItem item = {.start_time = items[i].start_time, .end_time = items[i].end_time};
+			if (agenda_item_is_all_day(&item))
+				continue;
+			items[i].start_time = caltime_add_minutes(items[i].start_time, args->jump_minutes);
+			items[i].end_time = items[i].end_time == 0 ? 0 : caltime_add_minutes(items[i].end_time, args->jump_minutes);
+		}
+		phone_set_items(&phone, items, OT_NUM_ITEMS);
+	}
+	uint32_t requests = phone.requests, full_syncs = phone.syncs, no_new_data = phone.no_new_data;
+	shim_jump_clock(args->jump_minutes*60);
+	shim_advance(3*60*1000); //a few ticks: detection, request, answer
+
+	result->requests = phone.requests-requests;
+	result->full_syncs = phone.syncs-full_syncs;
+	result->no_new_data = phone.no_new_data-no_new_data;
+	result->items = db_size();
+	for (int i=0;i<db_size() && i<OT_NUM_ITEMS;i++) {
+		AgendaItem *item = db_get(i);
+		result->matching += item->start_time == items[i].start_time && item->end_time == items[i].end_time;
+		result->moved += item->start_time != start_times[i];
+	}
+	harness_exit();
+	return true;
+}
+
+static void run(const char *name, int32_t jump_minutes, bool offset_change) {
+	OtArgs args = {.jump_minutes = jump_minutes, .offset_change = offset_change};
+	OtResult result;
+	if (!harness_fork(jump_child, &args, &result, sizeof(result))) {
+		printf("FAIL: %s: watchface run failed\n", name);
+		failures++;
+		return;
+	}
+	printf("%s: %+ld min, %d of %d items with the phone's times (%d moved), phone got %u requests: %u full syncs / %u no new data\n",
+		name, (long) jump_minutes, result.matching, result.items, result.moved, result.requests, result.full_syncs, result.no_new_data);
+
+	CHECK(result.items == OT_NUM_ITEMS && result.matching == OT_NUM_ITEMS, "%s: %d of %d items have the phone's times", name, result.matching, result.items);
+	if (offset_change) { //rebased locally
+		CHECK(result.moved > 0, "%s: no item moved", name);
+		CHECK(result.full_syncs == 0 && result.no_new_data >= 1, "%s: expected the phone to confirm with no new data", name);
+	}
+	else
+		CHECK(result.moved == 0, "%s: %d items moved by a clock that was set", name, result.moved);
+}
+
+int main(int argc, char **argv) {
+	run("time zone east", 60, true);
+	run("DST ends", -60, true);
+	run("time zone, half hour", 330, true);
+	run("clock set, an hour", 60, false);
+	run("clock set back, 45 minutes", -45, false);
+	run("clock set, 7 minutes", 7, false);
+	if (failures == 0)
+		printf("offset_test: all checks passed\n");
+	else
+		printf("offset_test: %d checks failed\n", failures);
+	return failures == 0 ? 0 : 1;
+}
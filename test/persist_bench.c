@@ -0,0 +1,198 @@
+#include <pebble.h>
+#include <shim.h>
+#include <phone.h>
+#include <harness.h>
+#include <settings.h>
+#include <item_db.h>
+#include <persist_const.h>
+#include <unistd.h>
+
+//Cost of item_db's persist/restore cycle under the shim's flash model (per-write and per-byte latency, 256 byte values, wear per key).
+//For each calendar size and persistence strategy (everything, or SETTINGS_BOOL_LIMIT_PERSIST), it reports keys written/deleted, bytes and
+//simulated milliseconds of: the first persist after a sync, a sync that changed one item, a sync without changes, leaving the watchface
+//(handle_deinit()), restoring on the next launch and leaving again without any change. Then it repeats one-item changes to see the wear of the busiest key.
+//Usage: persist_bench [-w syncs] [sizes...]
+
+#define PB_MAX_ITEMS 30
+#define PB_SETTINGS (SETTINGS_BOOL_SHOW_CLOCK_HEADER|SETTINGS_BOOL_SEPARATOR_DATE)
+
+typedef enum { PHASE_FIRST, PHASE_ONE_CHANGED, PHASE_UNCHANGED, PHASE_EXIT, PHASE_RESTORE, PHASE_UNCHANGED_EXIT, NUM_PHASES } Phase;
+static const char *phase_names[NUM_PHASES] = {"first sync", "1 item changed", "unchanged", "exit", "restore", "unchanged exit"};
+
+typedef struct {
+	uint32_t keys, bytes, reads;
+	uint64_t us;
+} PhaseCost;
+
+typedef struct {
+	int num_items;
+	bool limited;
+	int wear_syncs;
+	char path[64]; //storage between the launches
+	time_t relaunch_at; //for quick_launch()
+} PbArgs;
+
+typedef struct {
+	PhaseCost phases[NUM_PHASES];
+	uint32_t max_key_writes; //wear: writes of the busiest key after wear_syncs syncs
+	uint32_t storage_bytes;
+	int restored_items;
+	time_t exit_time;
+} PbResult;
+
+static ShimCounters before;
+
+static void phase_begin() {
+	before = shim_counters;
+}
+
+static void phase_end(PhaseCost *cost) {
+	cost->keys = shim_counters.persist_writes+shim_counters.persist_deletes-before.persist_writes-before.persist_deletes;
+	cost->bytes = shim_counters.persist_bytes_written-before.persist_bytes_written;
+	cost->reads = shim_counters.persist_reads-before.persist_reads;
+	cost->us = shim_counters.persist_us-before.persist_us;
+}
+
+static void force_sync(Phone *phone) { //the phone pushes (like after a calendar change)
+	uint8_t buffer[PHONE_INBOX_SIZE];
+	size_t size = phone_build_command(buffer, sizeof(buffer), PHONE_COMMAND_FORCE_REQUEST, 0);
+	shim_deliver(buffer, size, 0);
+	shim_advance(100);
+	if (phone->busy_until_ms > shim_mono_ms())
+		shim_advance((uint32_t) (phone->busy_until_ms-shim_mono_ms()));
+	shim_advance(5000); //background persist
+}
+
+static bool first_launch(void *arg, void *result_ptr) {
+	PbArgs *args = arg;
+	PbResult *result = result_ptr;
+	static PhoneItem items[PB_MAX_ITEMS];
+	harness_make_calendar(items, args->num_items, HARNESS_START_TIME, 5);
+
+	shim_reset(HARNESS_START_TIME);
+	Phone phone;
+	phone_init(&phone, items, args->num_items, PB_SETTINGS | (args->limited ? SETTINGS_BOOL_LIMIT_PERSIST : 0));
+	shim_set_phone(phone_handle_message, &phone);
+	harness_launch();
+
+	phase_begin();
+	if (!harness_sync(&phone))
+		return false;
+	shim_advance(5000);
+	phase_end(&result->phases[PHASE_FIRST]);
+
+	phase_begin();
+	if (args->num_items > 0)
+		snprintf(items[args->num_items/2].text1, sizeof(items[0].text1), "Moved to Friday");
+	phone_set_items(&phone, items, args->num_items);
+	force_sync(&phone);
+	phase_end(&result->phases[PHASE_ONE_CHANGED]);
+
+	phase_begin();
+	force_sync(&phone); //phone sends everything again (forced), but nothing changed
+	phase_end(&result->phases[PHASE_UNCHANGED]);
+
+	phase_begin();
+	harness_exit();
+	phase_end(&result->phases[PHASE_EXIT]);
+	result->exit_time = time(NULL);
+	result->storage_bytes = shim_persist_used_bytes();
+	return shim_persist_save(args->path);
+}
+
+static bool quick_launch(void *arg, void *result_ptr) { //launches from the saved storage right after the exit and leaves without any change
+	PbArgs *args = arg;
+	PbResult *result = result_ptr;
+	shim_reset(args->relaunch_at);
+	if (!shim_persist_load(args->path))
+		return false;
+	harness_launch();
+	shim_advance(5000); //(snapshot replaced by the real display, startup stages done)
+	phase_begin();
+	harness_exit();
+	phase_end(&result->phases[PHASE_UNCHANGED_EXIT]);
+	return shim_persist_save(args->path);
+}
+
+static bool second_launch(void *arg, void *result_ptr) {
+	PbArgs *args = arg;
+	PbResult *result = result_ptr;
+	static PhoneItem items[PB_MAX_ITEMS];
+	harness_make_calendar(items, args->num_items, HARNESS_START_TIME, 5);
+
+	shim_reset(HARNESS_START_TIME);
+	if (!shim_persist_load(args->path))
+		return false;
+	phase_begin();
+	harness_launch(); //startup stages restore the db
+	phase_end(&result->phases[PHASE_RESTORE]);
+	result->restored_items = db_size();
+
+	//Wear: a sync with one changed item every time
+	Phone phone;
+	phone_init(&phone, items, args->num_items, PB_SETTINGS | (args->limited ? SETTINGS_BOOL_LIMIT_PERSIST : 0));
+	shim_set_phone(phone_handle_message, &phone);
+	for (int s=0;s<args->wear_syncs && args->num_items > 0;s++) {
+		snprintf(items[s%args->num_items].text2, sizeof(items[0].text2), "Room %d", s);
+		phone_set_items(&phone, items, args->num_items);
+		force_sync(&phone);
+	}
+	harness_exit();
+	uint32_t max_writes = 0;
+	for (uint32_t key=0;key<0x4000;key++) {
+		uint32_t writes = shim_persist_key_writes(key);
+		max_writes = writes > max_writes ? writes : max_writes;
+	}
+	result->max_key_writes = max_writes;
+	return true;
+}
+
+int main(int argc, char **argv) {
+	int sizes[16], num_sizes = 0, wear_syncs = 20;
+	for (int i=1;i<argc;i++) {
+		if (strcmp(argv[i], "-w") == 0 && i+1 < argc)
+			wear_syncs = atoi(argv[++i]);
+		else if (num_sizes < 16)
+			sizes[num_sizes++] = atoi(argv[i]);
+	}
+	if (num_sizes == 0) {
+		int defaults[] = {5, 10, 20, 30};
+		for (num_sizes=0;num_sizes<4;num_sizes++)
+			sizes[num_sizes] = defaults[num_sizes];
+	}
+
+	shim_reset(HARNESS_START_TIME); //(for the default model)
+	ShimPersistModel *model = &shim_persist_model;
+	printf("flash model: write %u us + %u us/byte, read %u us + %u us/byte, delete %u us, %u bytes storage\n",
+		model->write_us, model->write_byte_us, model->read_us, model->read_byte_us, model->delete_us, model->storage_bytes);
+	printf("%5s %-9s %-15s %5s %6s %6s %9s\n", "items", "strategy", "phase", "keys", "bytes", "reads", "sim_ms");
+	bool ok = true;
+	for (int s=0;s<num_sizes;s++) {
+		for (int limited=0;limited<2;limited++) {
+			PbArgs args = {.num_items = sizes[s] < 0 ? 0 : sizes[s] > PB_MAX_ITEMS ? PB_MAX_ITEMS : sizes[s], .limited = limited, .wear_syncs = wear_syncs};
+			snprintf(args.path, sizeof(args.path), "/tmp/persist_bench_%d.bin", (int) getpid());
+			PbResult first, quick, second;
+			memset(&first, 0, sizeof(first));
+			memset(&quick, 0, sizeof(quick));
+			memset(&second, 0, sizeof(second));
+			bool launched = harness_fork(first_launch, &args, &first, sizeof(first));
+			args.relaunch_at = first.exit_time+10;
+			launched = launched && harness_fork(quick_launch, &args, &quick, sizeof(quick)); //(the streamed display of the sync can be ordered differently than the one built from the db)
+			args.relaunch_at += 10;
+			if (!launched || !harness_fork(quick_launch, &args, &quick, sizeof(quick)) || !harness_fork(second_launch, &args, &second, sizeof(second))) {
+				printf("%5d %-9s failed\n", args.num_items, limited ? "limited" : "all");
+				ok = false;
+				unlink(args.path);
+				continue;
+			}
+			unlink(args.path);
+			first.phases[PHASE_RESTORE] = second.phases[PHASE_RESTORE];
+			first.phases[PHASE_UNCHANGED_EXIT] = quick.phases[PHASE_UNCHANGED_EXIT];
+			for (int p=0;p<NUM_PHASES;p++)
+				printf("%5d %-9s %-15s %5u %6u %6u %9.1f\n", args.num_items, limited ? "limited" : "all", phase_names[p], first.phases[p].keys, first.phases[p].bytes, first.phases[p].reads, first.phases[p].us/1000.0);
+			printf("%5d %-9s storage %u bytes, %d items restored, busiest key written %u times in %d syncs\n", args.num_items, limited ? "limited" : "all",
+				first.storage_bytes, second.restored_items, second.max_key_writes, wear_syncs);
+		}
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+#include <pebble.h>
+#include <shim.h>
+#include <phone.h>
+
+//Stand-in for the phone app. Like the real one, it answers a sync request with COMMAND_NO_NEW_DATA if the watch reports the current sync id
+//or the content hash of the items it would send, and with COMMAND_INIT_DATA, the items and COMMAND_DONE otherwise. Items that don't fit into one message are split into COMMAND_ITEM_1/_2
+
+void phone_init(Phone *phone, PhoneItem *items, int num_items, uint32_t settings) {
+	memset(phone, 0, sizeof(Phone));
+	phone->items = items;
+	phone->num_items = num_items;
+	phone->settings = settings;
+	phone->sync_id = 1;
+	phone->message_interval_ms = 50;
+	phone->resend_after_ms = 1000;
+	phone->max_attempts = 3;
+}
+
+void phone_set_items(Phone *phone, PhoneItem *items, int num_items) {
+	phone->items = items;
+	phone->num_items = num_items;
+	phone->sync_id = phone->sync_id == 255 ? 1 : phone->sync_id+1;
+}
+
+bool phone_decode_report(const uint8_t *data, size_t size, PhoneReport *report) {
+	uint8_t copy[PHONE_INBOX_SIZE*2];
+	if (size > sizeof(copy))
+		return false;
+	memcpy(copy, data, size);
+	memset(report, 0, sizeof(PhoneReport));
+
+	DictionaryIterator iter;
+	for (Tuple *tuple = dict_read_begin_from_buffer(&iter, copy, size); tuple != NULL; tuple = dict_read_next(&iter)) {
+		if (tuple->type != TUPLE_INT && tuple->type != TUPLE_UINT)
+			continue;
+		uint32_t value = tuple->length == 1 ? tuple->value->uint8 : tuple->length == 2 ? tuple->value->uint16 : tuple->value->uint32;
+		switch (tuple->key) {
+			case 0: report->version = value; break;
+			case 1: report->backward_version = value; break;
+			case 2: report->last_sync_id = value; break;
+			case 3: report->content_hash = value; break;
+			case 4: report->num_items = value; break;
+			case 13: report->max_items = value; break;
+			default:
+			if (tuple->key >= 5 && tuple->key < 5+PHONE_NUM_STATS)
+				report->stats[tuple->key-5] = value;
+			break;
+		}
+		if (tuple->key < 32)
+			report->keys |= 1u << tuple->key;
+	}
+	return (report->keys & 0x1) != 0; //version is always sent
+}
+
+size_t phone_build_init(uint8_t *buffer, size_t size, uint8_t version, uint8_t num_items, bool has_sync_id, uint8_t sync_id, uint32_t settings) {
+	DictionaryIterator iter;
+	dict_write_begin(&iter, buffer, size);
+	DictionaryResult result = dict_write_uint8(&iter, 0, PHONE_COMMAND_INIT_DATA);
+	result |= dict_write_uint8(&iter, 1, version);
+	result |= dict_write_uint8(&iter, 10, num_items);
+	result |= dict_write_int32(&iter, 40, (int32_t) settings);
+	if (has_sync_id)
+		result |= dict_write_uint8(&iter, 2, sync_id);
+	return result == DICT_OK ? dict_write_end(&iter) : 0;
+}
+
+size_t phone_build_item(uint8_t *buffer, size_t size, uint8_t command, uint8_t index, const PhoneItem *item) {
+	DictionaryIterator iter;
+	dict_write_begin(&iter, buffer, size);
+	DictionaryResult result = dict_write_uint8(&iter, 0, command);
+	result |= dict_write_uint8(&iter, 5, index);
+	if (command != PHONE_COMMAND_ITEM_2) {
+		result |= dict_write_cstring(&iter, 1, item->text1);
+		result |= dict_write_uint8(&iter, 3, item->design1);
+		result |= dict_write_int32(&iter, 20, item->start_time);
+	}
+	if (command != PHONE_COMMAND_ITEM_1) {
+		result |= dict_write_cstring(&iter, 2, item->text2);
+		result |= dict_write_uint8(&iter, 4, item->design2);
+		result |= dict_write_int32(&iter, 30, item->end_time);
+		if (item->recurrence_rule != 0) {
+			result |= dict_write_uint8(&iter, 50, item->recurrence_rule);
+			result |= dict_write_uint8(&iter, 51, item->recurrence_count);
+		}
+	}
+	return result == DICT_OK ? dict_write_end(&iter) : 0;
+}
+
+size_t phone_build_command(uint8_t *buffer, size_t size, uint8_t command, uint8_t vibrate) {
+	DictionaryIterator iter;
+	dict_write_begin(&iter, buffer, size);
+	DictionaryResult result = dict_write_uint8(&iter, 0, command);
+	if (command == PHONE_COMMAND_DONE)
+		result |= dict_write_uint8(&iter, 6, vibrate);
+	return result == DICT_OK ? dict_write_end(&iter) : 0;
+}
+
+static bool phone_send(Phone *phone, const uint8_t *data, size_t size, uint32_t *delay) { //delivers with resending. Returns false if the message was lost for good
+	for (int attempt=0;attempt<phone->max_attempts;attempt++) {
+		phone->messages++;
+		if (shim_deliver(data, size, *delay) == APP_MSG_OK) {
+			*delay += phone->message_interval_ms;
+			return true;
+		}
+		phone->lost_messages++;
+		*delay += phone->resend_after_ms;
+	}
+	phone->failed_syncs++;
+	return false;
+}
+
+uint32_t phone_content_hash(const Phone *phone, int num_items) { //what the watch's db_content_hash() is after receiving the first num_items items
+	uint32_t hash = AGENDA_ITEM_HASH_INIT;
+	for (int i=0;i<num_items && i<phone->num_items;i++) {
+		const PhoneItem *phone_item = &phone->items[i];
+		AgendaItem item;
+		memset(&item, 0, sizeof(item));
+		set_item_row1(&item, (char*) phone_item->text1, phone_item->design1);
+		set_item_row2(&item, (char*) phone_item->text2, phone_item->design2);
+		set_item_times(&item, phone_item->start_time, phone_item->end_time);
+		set_item_recurrence(&item, phone_item->recurrence_rule, phone_item->recurrence_count);
+		hash = agenda_item_hash(hash, &item);
+	}
+	return hash;
+}
+
+static void phone_answer(Phone *phone, const PhoneReport *report) {
+	uint8_t buffer[PHONE_INBOX_SIZE];
+	uint32_t delay = phone->message_interval_ms;
+	size_t size;
+
+	int num_items = phone->num_items;
+	if (report->max_items != 0 && report->max_items < num_items) //watch is low on memory
+		num_items = report->max_items;
+	if (num_items > 255)
+		num_items = 255;
+
+	if (report->last_sync_id == phone->sync_id || (report->num_items == num_items && report->content_hash == phone_content_hash(phone, num_items))) {
+		phone->no_new_data++;
+		size = phone_build_command(buffer, sizeof(buffer), PHONE_COMMAND_NO_NEW_DATA, 0);
+		phone_send(phone, buffer, size, &delay);
+		phone->busy_until_ms = shim_mono_ms()+delay;
+		return;
+	}
+
+	phone->syncs++;
+	size = phone_build_init(buffer, sizeof(buffer), PHONE_VERSION, (uint8_t) num_items, true, phone->sync_id, phone->settings);
+	bool ok = phone_send(phone, buffer, size, &delay);
+	for (int i=0;ok && i<num_items;i++) {
+		size = phone_build_item(buffer, sizeof(buffer), PHONE_COMMAND_ITEM, (uint8_t) i, &phone->items[i]);
+		if (size != 0) {
+			ok = phone_send(phone, buffer, size, &delay);
+			continue;
+		}
+		size = phone_build_item(buffer, sizeof(buffer), PHONE_COMMAND_ITEM_1, (uint8_t) i, &phone->items[i]);
+		ok = phone_send(phone, buffer, size, &delay);
+		size = phone_build_item(buffer, sizeof(buffer), PHONE_COMMAND_ITEM_2, (uint8_t) i, &phone->items[i]);
+		ok = ok && phone_send(phone, buffer, size, &delay);
+	}
+	if (ok) {
+		size = phone_build_command(buffer, sizeof(buffer), PHONE_COMMAND_DONE, phone->vibrate);
+		phone_send(phone, buffer, size, &delay);
+	}
+	phone->busy_until_ms = shim_mono_ms()+delay;
+}
+
+AppMessageResult phone_handle_message(const uint8_t *data, size_t size, void *context) {
+	Phone *phone = context;
+	PhoneReport report;
+	if (!phone_decode_report(data, size, &report))
+		return APP_MSG_OK;
+	phone->requests++;
+	phone->last_report = report;
+	if (shim_mono_ms() < phone->busy_until_ms) //still sending the previous answer. The watch will ask again
+		return APP_MSG_OK;
+	phone_answer(phone, &report);
+	return APP_MSG_OK;
+}
@@ -0,0 +1,69 @@
+#include <pebble.h>
+#include <datatypes.h>
+
+#ifndef PHONE_H
+#define PHONE_H
+
+//Stand-in for the phone app (host only): answers the watch's sync requests with a calendar and decodes what the watch reports
+
+//Protocol constants (see communication.c)
+#define PHONE_INBOX_SIZE 124 //inbound size of the watch
+#define PHONE_VERSION 14
+#define PHONE_COMMAND_INIT_DATA 0
+#define PHONE_COMMAND_ITEM 1
+#define PHONE_COMMAND_DONE 2
+#define PHONE_COMMAND_NO_NEW_DATA 4
+#define PHONE_COMMAND_FORCE_REQUEST 5
+#define PHONE_COMMAND_ITEM_1 6
+#define PHONE_COMMAND_ITEM_2 7
+#define PHONE_NUM_STATS 8 //outgoing keys 5..12 of the watch
+
+typedef struct {
+	char text1[50], text2[50];
+	uint8_t design1, design2;
+	caltime_t start_time, end_time;
+	uint8_t recurrence_rule, recurrence_count;
+} PhoneItem;
+
+//Decoded sync request of the watch (its outgoing keys)
+typedef struct {
+	uint32_t keys; //bit i set iff key i was present
+	uint8_t version, backward_version, last_sync_id, num_items;
+	uint32_t content_hash;
+	uint16_t stats[PHONE_NUM_STATS]; //rebuilds, last rebuild ms, heap peak, dropped inbound, sync restarts, persist bytes, persist keys, persist ms
+	uint8_t max_items; //0 if not sent
+} PhoneReport;
+
+typedef struct {
+	//Calendar and settings to send
+	PhoneItem *items;
+	int num_items;
+	uint32_t settings;
+	uint8_t sync_id; //changes whenever the calendar changes (never 0)
+	uint8_t vibrate; //for COMMAND_DONE
+
+	//Behaviour
+	uint32_t message_interval_ms; //time between two messages of a sync
+	uint32_t resend_after_ms; //timeout after a lost message
+	uint8_t max_attempts; //per message. The sync is given up after that
+
+	//What happened
+	uint32_t requests; //sync requests received
+	uint32_t syncs, no_new_data; //answers
+	uint32_t messages, lost_messages, failed_syncs;
+	uint64_t busy_until_ms; //the last message of the current answer arrives at this time (shim_mono_ms())
+	PhoneReport last_report;
+} Phone;
+
+void phone_init(Phone *phone, PhoneItem *items, int num_items, uint32_t settings);
+void phone_set_items(Phone *phone, PhoneItem *items, int num_items); //calendar changed (new sync id)
+AppMessageResult phone_handle_message(const uint8_t *data, size_t size, void *context); //ShimPhoneHandler with a Phone as context
+bool phone_decode_report(const uint8_t *data, size_t size, PhoneReport *report);
+uint32_t phone_content_hash(const Phone *phone, int num_items); //content hash the watch reports when it has the first num_items items
+
+//Messages to the watch. Return the size (0 if the message doesn't fit into size bytes)
+size_t phone_build_init(uint8_t *buffer, size_t size, uint8_t version, uint8_t num_items, bool has_sync_id, uint8_t sync_id, uint32_t settings);
+size_t phone_build_item(uint8_t *buffer, size_t size, uint8_t command, uint8_t index, const PhoneItem *item); //PHONE_COMMAND_ITEM, _ITEM_1 or _ITEM_2
+size_t phone_build_command(uint8_t *buffer, size_t size, uint8_t command, uint8_t vibrate); //commands without payload (vibrate is for PHONE_COMMAND_DONE)
+
+#endif
@@ -0,0 +1,136 @@
+#include <pebble.h>
+#include <shim.h>
+#include <phone.h>
+#include <harness.h>
+#include <settings.h>
+#include <item_db.h>
+#include <stats.h>
+#include <allocator.h>
+
+//Render-cost regression test: runs the minute refresh (handle_time_tick() -> remove_displayed_data(), display_data()) for a matrix of
+//settings and calendar sizes and checks every refresh against the render budget (catches changes that make the minute refresh more expensive).
+//Also checks that nothing logs an error and that a refresh leaves no layers or memory behind.
+//Exits non-zero on any violation. Usage: render_test [-v] (-v prints the cost of every combination)
+
+#define RT_MAX_ITEMS 30
+
+//Budget per displayed occurrence: two rows (time and text layer each) and a day separator
+#define RENDER_BUDGET_LAYERS_PER_ITEM 5
+#define RENDER_BUDGET_LAYOUTS_PER_ITEM 2
+//Allocations: the five arrays plus two time texts and a separator text per item (sizes as in allocate_display_arrays(), create_item_layers(), create_day_separator_layer())
+#define RENDER_BUDGET_ALLOCS_FIXED 5
+#define RENDER_BUDGET_ALLOCS_PER_ITEM 3
+#define RENDER_BUDGET_BYTES_PER_ITEM (2*4*sizeof(void*)+4+2*sizeof(void*)+3*20)
+
+extern caltime_t refresh_at; //(main.c)
+
+static const int item_counts[] = {0, 1, 5, 10, 20, 30};
+#define NUM_ITEM_COUNTS ((int) (sizeof(item_counts)/sizeof(item_counts[0])))
+
+static const uint32_t fonts[] = {0, SETTINGS_BOOL_FONT_SIZE0, SETTINGS_BOOL_FONT_SIZE1, SETTINGS_BOOL_FONT_SIZE0|SETTINGS_BOOL_FONT_SIZE1};
+static const uint32_t headers[] = {0, SETTINGS_BOOL_SHOW_CLOCK_HEADER, SETTINGS_BOOL_SHOW_CLOCK_HEADER|SETTINGS_BOOL_HEADER_SIZE0|SETTINGS_BOOL_HEADER_SIZE1};
+static const uint32_t clocks[] = {0, SETTINGS_BOOL_12H, SETTINGS_BOOL_12H|SETTINGS_BOOL_AMPM};
+static const uint32_t options[] = {0, SETTINGS_BOOL_COUNTDOWNS, SETTINGS_BOOL_SEPARATOR_DATE, SETTINGS_BOOL_DAY_PAGES|SETTINGS_BOOL_ENABLE_SCROLL, SETTINGS_BOOL_INVERT|SETTINGS_BOOL_COUNTDOWNS|SETTINGS_BOOL_SEPARATOR_DATE};
+#define COUNT(array) ((int) (sizeof(array)/sizeof(array[0])))
+
+typedef struct {
+	int num_items;
+	uint32_t settings;
+} RtArgs;
+
+typedef struct {
+	int occurrences; //displayed by the refresh
+	uint32_t layers, layouts, mallocs, malloc_bytes; //per refresh (layers and layouts as counted by the watch's stats, allocations of the watchface itself without allocator headers)
+	uint32_t error_logs;
+	int32_t leaked_layers, leaked_blocks; //after refresh minus before
+	bool refreshed;
+} RtResult;
+
+static bool within_budget(RtResult *result) {
+	uint32_t n = (uint32_t) result->occurrences;
+	return result->layers <= n*RENDER_BUDGET_LAYERS_PER_ITEM && result->layouts <= n*RENDER_BUDGET_LAYOUTS_PER_ITEM
+		&& result->mallocs <= RENDER_BUDGET_ALLOCS_FIXED+n*RENDER_BUDGET_ALLOCS_PER_ITEM && result->malloc_bytes <= n*RENDER_BUDGET_BYTES_PER_ITEM;
+}
+
+static bool render_child(void *arg, void *result_ptr) {
+	RtArgs *args = arg;
+	RtResult *result = result_ptr;
+	memset(result, 0, sizeof(RtResult));
+	static PhoneItem items[RT_MAX_ITEMS];
+	harness_make_calendar(items, args->num_items, HARNESS_START_TIME, 9);
+
+	shim_reset(HARNESS_START_TIME);
+	Phone phone;
+	phone_init(&phone, items, args->num_items, args->settings);
+	shim_set_phone(phone_handle_message, &phone);
+	harness_launch();
+	if (!harness_sync(&phone))
+		return false;
+	shim_advance(5000); //background persist
+
+	//Refresh on the next minute tick, like when an item starts or ends
+	refresh_at = 1;
+	ShimCounters before = shim_counters;
+	uint32_t layers_before = stats_get(STAT_LAYERS_CREATED), layouts_before = stats_get(STAT_TEXT_LAYOUTS);
+	uint32_t wakeups = shim_counters.ticks;
+	while (shim_counters.ticks == wakeups)
+		shim_advance(1000);
+	result->refreshed = refresh_at != 1 || args->num_items == 0; //display_data() recomputes refresh_at (does nothing for an empty db)
+	result->occurrences = db_num_occurrences();
+	result->layers = stats_get(STAT_LAYERS_CREATED)-layers_before;
+	result->layouts = stats_get(STAT_TEXT_LAYOUTS)-layouts_before;
+	result->mallocs = shim_counters.app_mallocs-before.app_mallocs;
+	result->malloc_bytes = shim_counters.app_malloc_bytes-before.app_malloc_bytes-result->mallocs*MEM_BLOCK_OVERHEAD;
+	result->leaked_layers = (int32_t) ((shim_counters.text_layers_created-shim_counters.text_layers_destroyed)-(before.text_layers_created-before.text_layers_destroyed));
+	result->leaked_blocks = (int32_t) ((shim_counters.mallocs-shim_counters.frees)-(before.mallocs-before.frees));
+	result->error_logs = shim_counters.error_logs;
+	harness_exit();
+	return true;
+}
+
+int main(int argc, char **argv) {
+	bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+	int failures = 0, runs = 0;
+	RtResult worst[NUM_ITEM_COUNTS];
+	memset(worst, 0, sizeof(worst));
+
+	for (int n=0;n<NUM_ITEM_COUNTS;n++)
+	for (int f=0;f<COUNT(fonts);f++)
+	for (int h=0;h<COUNT(headers);h++)
+	for (int c=0;c<COUNT(clocks);c++)
+	for (int o=0;o<COUNT(options);o++) {
+		RtArgs args = {.num_items = item_counts[n], .settings = fonts[f]|headers[h]|clocks[c]|options[o]};
+		RtResult result;
+		runs++;
+		if (!harness_fork(render_child, &args, &result, sizeof(result))) {
+			printf("FAIL: %d items, settings %05x: run failed\n", args.num_items, (unsigned) args.settings);
+			failures++;
+			continue;
+		}
+		if (verbose)
+			printf("%2d items, settings %05x: %2d occurrences, %3u layers, %3u layouts, %3u mallocs, %5u bytes\n", args.num_items, (unsigned) args.settings,
+				result.occurrences, result.layers, result.layouts, result.mallocs, result.malloc_bytes);
+		bool budget_ok = within_budget(&result);
+		if (!budget_ok || result.error_logs != 0 || !result.refreshed || result.leaked_layers != 0 || result.leaked_blocks != 0) {
+			printf("FAIL: %d items, settings %05x: %s (%d occurrences: %u layers, %u layouts, %u mallocs, %u bytes), %u error logs, %s, %d layers and %d blocks leaked\n",
+				args.num_items, (unsigned) args.settings, budget_ok ? "within budget" : "over budget", result.occurrences, result.layers, result.layouts, result.mallocs, result.malloc_bytes,
+				result.error_logs, result.refreshed ? "refreshed" : "not refreshed", result.leaked_layers, result.leaked_blocks);
+			failures++;
+		}
+		RtResult *w = &worst[n];
+		w->occurrences = result.occurrences > w->occurrences ? result.occurrences : w->occurrences;
+		w->layers = result.layers > w->layers ? result.layers : w->layers;
+		w->layouts = result.layouts > w->layouts ? result.layouts : w->layouts;
+		w->mallocs = result.mallocs > w->mallocs ? result.mallocs : w->mallocs;
+		w->malloc_bytes = result.malloc_bytes > w->malloc_bytes ? result.malloc_bytes : w->malloc_bytes;
+	}
+
+	printf("%5s %11s %6s %7s %7s %6s  (worst refresh over %d settings)\n", "items", "occurrences", "layers", "layouts", "mallocs", "bytes", runs/NUM_ITEM_COUNTS);
+	for (int n=0;n<NUM_ITEM_COUNTS;n++)
+		printf("%5d %11d %6u %7u %7u %6u\n", item_counts[n], worst[n].occurrences, worst[n].layers, worst[n].layouts, worst[n].mallocs, worst[n].malloc_bytes);
+	if (failures == 0)
+		printf("render_test: %d runs within budget\n", runs);
+	else
+		printf("render_test: %d of %d runs failed\n", failures, runs);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,350 @@
+#include <pebble.h>
+#include <shim.h>
+#include <phone.h>
+#include <harness.h>
+#include <item_db.h>
+#include <stats.h>
+
+//Replays recorded sync sessions (the "CAP" lines that communication.c logs with CAPTURE_SYNC_SESSIONS) through in_received_handler(),
+//with injected drops, duplicates and reordering. Every sync request of the watch (the first one and each restart after handle_sync_failed())
+//is answered with the whole session again, like the phone does.
+//Usage: replay [-d drop_permille] [-u duplicate_permille] [-o reorder_permille] [-s seed] [-n runs] [capture files...]
+//       replay -g num_items [seed]    prints the CAP lines of a generated calendar (to build a corpus)
+//Without files, generated sessions of a few sizes are replayed
+
+#define REPLAY_MAX_MESSAGES 256
+#define REPLAY_MAX_SESSIONS 10 //answers per run (1 + restarts) before giving up
+#define REPLAY_MESSAGE_INTERVAL_MS 50
+#define REPLAY_QUIET_MS (3*60*1000) //a run ends when the watch didn't ask again for this long
+
+typedef struct {
+	uint8_t data[PHONE_INBOX_SIZE];
+	size_t size;
+} ReplayMessage;
+
+typedef struct {
+	ReplayMessage messages[REPLAY_MAX_MESSAGES];
+	int num_messages;
+	int num_items; //announced by the session's COMMAND_INIT_DATA
+	uint32_t settings;
+	uint32_t drop_permille, duplicate_permille, reorder_permille;
+	uint32_t seed;
+} ReplaySession;
+
+typedef struct {
+	uint32_t sessions; //times the session was sent
+	uint32_t delivered, dropped, duplicated, reordered; //messages
+	uint32_t restarts; //STAT_SYNC_RESTARTS
+	uint32_t inbox_dropped; //STAT_DROPPED_INBOUND
+	uint32_t heap_peak;
+	int final_items; //db_size() at the end
+	uint64_t handler_ns; //host time spent delivering messages
+} ReplayResult;
+
+static bool parse_line(const char *line, ReplaySession *session) { //adds the message of a CAP line. Returns false for lines that aren't messages
+	const char *cap = strstr(line, "CAP ");
+	if (cap == NULL || session->num_messages >= REPLAY_MAX_MESSAGES)
+		return false;
+	char type = cap[4];
+	const char *fields = cap+5;
+	const char *texts = strchr(fields, '|');
+	PhoneItem item;
+	memset(&item, 0, sizeof(item));
+	if (texts != NULL) { //text1|text2 (or just one text)
+		const char *second = strchr(texts+1, '|');
+		size_t length = second != NULL ? (size_t) (second-texts-1) : strcspn(texts+1, "\r\n");
+		snprintf(item.text1, sizeof(item.text1), "%.*s", (int) length, texts+1);
+		if (second != NULL)
+			snprintf(item.text2, sizeof(item.text2), "%.*s", (int) strcspn(second+1, "\r\n"), second+1);
+	}
+
+	ReplayMessage *message = &session->messages[session->num_messages];
+	int a, b, c, d, e;
+	long start, end;
+	unsigned long settings;
+	switch (type) {
+		case 'I':
+		if (sscanf(fields, "%d %d %d %d %lu", &a, &b, &c, &d, &settings) != 5)
+			return false;
+		message->size = phone_build_init(message->data, PHONE_INBOX_SIZE, a, b, c, d, settings);
+		session->num_items = b;
+		session->settings = settings;
+		break;
+
+		case 'T':
+		if (sscanf(fields, "%d %d %d %ld %ld %d %d", &a, &b, &c, &start, &end, &d, &e) != 7)
+			return false;
+		item.design1 = b;
+		item.design2 = c;
+		item.start_time = start;
+		item.end_time = end;
+		item.recurrence_rule = d;
+		item.recurrence_count = e;
+		message->size = phone_build_item(message->data, PHONE_INBOX_SIZE, PHONE_COMMAND_ITEM, a, &item);
+		break;
+
+		case '1':
+		if (sscanf(fields, "%d %d %ld", &a, &b, &start) != 3)
+			return false;
+		item.design1 = b;
+		item.start_time = start;
+		message->size = phone_build_item(message->data, PHONE_INBOX_SIZE, PHONE_COMMAND_ITEM_1, a, &item);
+		break;
+
+		case '2':
+		if (sscanf(fields, "%d %d %ld %d %d", &a, &b, &end, &c, &d) != 5)
+			return false;
+		snprintf(item.text2, sizeof(item.text2), "%s", item.text1); //the only text is row 2
+		item.design2 = b;
+		item.end_time = end;
+		item.recurrence_rule = c;
+		item.recurrence_count = d;
+		message->size = phone_build_item(message->data, PHONE_INBOX_SIZE, PHONE_COMMAND_ITEM_2, a, &item);
+		break;
+
+		case 'D':
+		if (sscanf(fields, "%d", &a) != 1)
+			return false;
+		message->size = phone_build_command(message->data, PHONE_INBOX_SIZE, PHONE_COMMAND_DONE, a);
+		break;
+
+		case 'C':
+		if (sscanf(fields, "%d", &a) != 1)
+			return false;
+		message->size = phone_build_command(message->data, PHONE_INBOX_SIZE, a, 0);
+		break;
+
+		default: //X (drop) and R (restart) are what the watch did, not messages
+		return false;
+	}
+	if (message->size == 0)
+		return false;
+	session->num_messages++;
+	return true;
+}
+
+static bool load_session(const char *path, ReplaySession *session) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return false;
+	char line[512];
+	while (fgets(line, sizeof(line), file) != NULL)
+		parse_line(line, session);
+	fclose(file);
+	return session->num_messages != 0;
+}
+
+static void print_session_lines(PhoneItem *items, int num_items, uint32_t settings, FILE *out) { //same format as capture_message() in communication.c
+	uint8_t buffer[PHONE_INBOX_SIZE];
+	fprintf(out, "CAP I %d %d 1 1 %lu\n", PHONE_VERSION, num_items, (unsigned long) settings);
+	for (int i=0;i<num_items;i++) {
+		PhoneItem *item = &items[i];
+		if (phone_build_item(buffer, sizeof(buffer), PHONE_COMMAND_ITEM, i, item) != 0)
+			fprintf(out, "CAP T %d %d %d %ld %ld %d %d|%s|%s\n", i, item->design1, item->design2, (long) item->start_time, (long) item->end_time, item->recurrence_rule, item->recurrence_count, item->text1, item->text2);
+		else {
+			fprintf(out, "CAP 1 %d %d %ld|%s\n", i, item->design1, (long) item->start_time, item->text1);
+			fprintf(out, "CAP 2 %d %d %ld %d %d|%s\n", i, item->design2, (long) item->end_time, item->recurrence_rule, item->recurrence_count, item->text2);
+		}
+	}
+	fprintf(out, "CAP D 0\n");
+}
+
+static void generate_session(int num_items, uint32_t seed, ReplaySession *session) { //the messages that the CAP lines of the calendar stand for
+	static PhoneItem items[64];
+	num_items = num_items > 64 ? 64 : num_items;
+	harness_make_calendar(items, num_items, HARNESS_START_TIME, seed);
+	ReplayMessage *messages = session->messages;
+	int n = 0;
+	messages[n].size = phone_build_init(messages[n].data, PHONE_INBOX_SIZE, PHONE_VERSION, num_items, true, 1, SETTINGS_BOOL_SHOW_CLOCK_HEADER|SETTINGS_BOOL_SEPARATOR_DATE);
+	n++;
+	for (int i=0;i<num_items;i++) {
+		if ((messages[n].size = phone_build_item(messages[n].data, PHONE_INBOX_SIZE, PHONE_COMMAND_ITEM, i, &items[i])) != 0) {
+			n++;
+			continue;
+		}
+		messages[n].size = phone_build_item(messages[n].data, PHONE_INBOX_SIZE, PHONE_COMMAND_ITEM_1, i, &items[i]);
+		n++;
+		messages[n].size = phone_build_item(messages[n].data, PHONE_INBOX_SIZE, PHONE_COMMAND_ITEM_2, i, &items[i]);
+		n++;
+	}
+	messages[n].size = phone_build_command(messages[n].data, PHONE_INBOX_SIZE, PHONE_COMMAND_DONE, 0);
+	session->num_messages = n+1;
+	session->num_items = num_items;
+}
+
+//Run (in a child process)
+static ReplaySession *current_session;
+static ReplayResult *current_result;
+static uint32_t random_state;
+static uint64_t busy_until_ms;
+
+static uint32_t replay_random() { //0..999
+	random_state = random_state*1103515245+12345;
+	return (random_state >> 8)%1000;
+}
+
+static void deliver(int index, uint32_t *delay) {
+	shim_deliver(current_session->messages[index].data, current_session->messages[index].size, *delay);
+	*delay += REPLAY_MESSAGE_INTERVAL_MS;
+	current_result->delivered++;
+}
+
+static AppMessageResult replay_phone(const uint8_t *data, size_t size, void *context) { //answers every sync request with the (perturbed) session
+	PhoneReport report;
+	if (!phone_decode_report(data, size, &report) || current_result->sessions >= REPLAY_MAX_SESSIONS || shim_now_ms() < busy_until_ms)
+		return APP_MSG_OK;
+	current_result->sessions++;
+
+	uint32_t delay = REPLAY_MESSAGE_INTERVAL_MS;
+	int n = current_session->num_messages;
+	for (int i=0;i<n;i++) {
+		if (replay_random() < current_session->drop_permille) {
+			current_result->dropped++;
+			continue;
+		}
+		if (i+1 < n && replay_random() < current_session->reorder_permille) { //swap with the next one
+			deliver(i+1, &delay);
+			deliver(i, &delay);
+			current_result->reordered++;
+			i++;
+			continue;
+		}
+		deliver(i, &delay);
+		if (replay_random() < current_session->duplicate_permille) {
+			deliver(i, &delay);
+			current_result->duplicated++;
+		}
+	}
+	busy_until_ms = shim_now_ms()+delay;
+	return APP_MSG_OK;
+}
+
+static bool replay_child(void *arg, void *result_ptr) {
+	current_session = arg;
+	current_result = result_ptr;
+	memset(current_result, 0, sizeof(ReplayResult));
+	random_state = current_session->seed;
+	busy_until_ms = 0;
+
+	shim_reset(HARNESS_START_TIME);
+	shim_set_phone(replay_phone, NULL);
+	harness_launch();
+	shim_reset_counters();
+
+	//Run until the watch stopped asking (the scheduler's retry after a failed sync comes within a minute or two)
+	uint64_t quiet_since = shim_now_ms();
+	uint32_t sessions = 0;
+	while (shim_now_ms()-quiet_since < REPLAY_QUIET_MS) {
+		uint64_t start = harness_host_ns();
+		shim_advance(1000);
+		current_result->handler_ns += harness_host_ns()-start;
+		if (current_result->sessions != sessions || shim_now_ms() < busy_until_ms) {
+			sessions = current_result->sessions;
+			quiet_since = shim_now_ms();
+		}
+	}
+
+	current_result->restarts = stats_get(STAT_SYNC_RESTARTS);
+	current_result->inbox_dropped = stats_get(STAT_DROPPED_INBOUND);
+	current_result->heap_peak = shim_counters.heap_peak;
+	current_result->final_items = db_size();
+	harness_exit();
+	return true;
+}
+
+static bool replay(const char *name, ReplaySession *session, int runs) {
+	ReplayResult total;
+	memset(&total, 0, sizeof(total));
+	int complete = 0;
+	uint32_t seed = session->seed;
+	for (int r=0;r<runs;r++) {
+		ReplayResult result;
+		session->seed = seed+r;
+		if (!harness_fork(replay_child, session, &result, sizeof(result))) {
+			printf("%-24s run %d crashed\n", name, r);
+			return false;
+		}
+		int expected = session->num_items > 30 ? 30 : session->num_items; //(db capacity)
+		if (result.final_items == expected)
+			complete++;
+		total.sessions += result.sessions;
+		total.delivered += result.delivered;
+		total.dropped += result.dropped;
+		total.duplicated += result.duplicated;
+		total.reordered += result.reordered;
+		total.restarts += result.restarts;
+		total.inbox_dropped += result.inbox_dropped;
+		total.handler_ns += result.handler_ns;
+		if (result.heap_peak > total.heap_peak)
+			total.heap_peak = result.heap_peak;
+	}
+	session->seed = seed;
+
+	printf("%-24s %4d %5d %6.2f %8.2f %7u %7u %7u %7u %6u %10.0f %6u\n", name, session->num_messages, runs, (double) total.sessions/runs, (double) total.restarts/runs,
+		total.delivered, total.dropped, total.duplicated, total.reordered, total.inbox_dropped, total.handler_ns == 0 ? 0 : total.delivered*1e9/total.handler_ns, total.heap_peak);
+	printf("%-24s complete in %d of %d runs\n", "", complete, runs);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	static ReplaySession session;
+	uint32_t drop = 0, duplicate = 0, reorder = 0, seed = 1;
+	int runs = 10;
+	int first_file = argc;
+	for (int i=1;i<argc;i++) {
+		if (strcmp(argv[i], "-g") == 0 && i+1 < argc) {
+			static PhoneItem items[64];
+			int num_items = atoi(argv[i+1]);
+			num_items = num_items < 0 ? 0 : num_items > 64 ? 64 : num_items;
+			harness_make_calendar(items, num_items, HARNESS_START_TIME, i+2 < argc ? atoi(argv[i+2]) : 1);
+			print_session_lines(items, num_items, SETTINGS_BOOL_SHOW_CLOCK_HEADER|SETTINGS_BOOL_SEPARATOR_DATE, stdout);
+			return 0;
+		}
+		if (argv[i][0] != '-' || i+1 >= argc) {
+			first_file = i;
+			break;
+		}
+		uint32_t value = atoi(argv[++i]);
+		switch (argv[i-1][1]) {
+			case 'd': drop = value; break;
+			case 'u': duplicate = value; break;
+			case 'o': reorder = value; break;
+			case 's': seed = value; break;
+			case 'n': runs = value < 1 ? 1 : value; break;
+			default: fprintf(stderr, "unknown option %s\n", argv[i-1]); return 2;
+		}
+	}
+
+	printf("drop %u, duplicate %u, reorder %u (per mille), seed %u\n", drop, duplicate, reorder, seed);
+	printf("%-24s %4s %5s %6s %8s %7s %7s %7s %7s %6s %10s %6s\n", "session", "msgs", "runs", "sent", "restarts", "deliv", "dropped", "dup", "reord", "inbox", "msgs/s", "heap");
+	bool ok = true;
+	if (first_file == argc) {
+		int sizes[] = {5, 15, 30};
+		for (int s=0;s<3;s++) {
+			memset(&session, 0, sizeof(session));
+			generate_session(sizes[s], s+1, &session);
+			session.drop_permille = drop;
+			session.duplicate_permille = duplicate;
+			session.reorder_permille = reorder;
+			session.seed = seed;
+			char name[32];
+			snprintf(name, sizeof(name), "generated-%d", sizes[s]);
+			ok = replay(name, &session, runs) && ok;
+		}
+	}
+	for (int i=first_file;i<argc;i++) {
+		memset(&session, 0, sizeof(session));
+		if (!load_session(argv[i], &session)) {
+			printf("%-24s no CAP lines\n", argv[i]);
+			ok = false;
+			continue;
+		}
+		session.drop_permille = drop;
+		session.duplicate_permille = duplicate;
+		session.reorder_permille = reorder;
+		session.seed = seed;
+		const char *name = strrchr(argv[i], '/');
+		ok = replay(name != NULL ? name+1 : argv[i], &session, runs) && ok;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,1457 @@
+#define SHIM_HOST_CODE
+#include <stdarg.h>
+#include <pebble.h>
+#include <shim.h>
+
+//Simulated watch for host builds. Everything runs on a simulated clock: nothing happens unless a host program calls shim_advance()
+//(or shim_run_until_idle()), which then runs timers, animations, minute ticks and message deliveries in order.
+//Timers and animations use a monotonic clock. The wall clock (time(), ticks) is the monotonic one plus an offset that shim_jump_clock() changes
+
+ShimCounters shim_counters;
+ShimPersistModel shim_persist_model;
+
+#define SHIM_DEFAULT_HEAP_SIZE (24*1024)
+#define SHIM_ANIMATION_FRAME_MS 33 //interval of update calls for animations with an implementation
+#define SHIM_DEFAULT_ANIMATION_MS 250
+
+static uint8_t log_level = 0;
+
+//Clock
+static uint64_t mono_ms = 0; //monotonic time
+static int64_t wall_offset_ms = 0; //wall clock = mono_ms+wall_offset_ms
+
+uint64_t shim_now_ms() {
+	return mono_ms+wall_offset_ms;
+}
+
+uint64_t shim_mono_ms() {
+	return mono_ms;
+}
+
+time_t shim_time(time_t *tloc) {
+	time_t t = (time_t) (shim_now_ms()/1000);
+	if (tloc != NULL)
+		*tloc = t;
+	return t;
+}
+
+uint16_t time_ms(time_t *t_utc, uint16_t *out_ms) {
+	uint16_t ms = (uint16_t) (shim_now_ms()%1000);
+	if (t_utc != NULL)
+		*t_utc = shim_time(NULL);
+	if (out_ms != NULL)
+		*out_ms = ms;
+	return ms;
+}
+
+struct tm *shim_localtime() {
+	static struct tm result;
+	time_t t = shim_time(NULL);
+	localtime_r(&t, &result);
+	return &result;
+}
+
+//Logging
+void app_log(uint8_t level, const char *src_filename, int src_line_number, const char *fmt, ...) {
+	shim_counters.logs++;
+	if (level == APP_LOG_LEVEL_ERROR)
+		shim_counters.error_logs++;
+	if (level > log_level)
+		return;
+	va_list args;
+	va_start(args, fmt);
+	fprintf(stderr, "[%s:%d] ", src_filename, src_line_number);
+	vfprintf(stderr, fmt, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+}
+
+void shim_set_log_level(uint8_t level) {
+	log_level = level;
+}
+
+//Heap. Blocks come from the host's malloc, but are accounted against a fixed heap size like on the watch
+typedef struct {
+	size_t size;
+	uint32_t generation; //shim_reset() starts a new generation. Blocks from older ones are not accounted anymore
+	uint32_t padding;
+} BlockHeader;
+#define BLOCK_OVERHEAD 8 //per-block overhead of the watch's allocator
+
+static size_t heap_size = SHIM_DEFAULT_HEAP_SIZE;
+static size_t heap_used = 0;
+static uint32_t heap_generation = 0;
+
+void shim_set_heap_size(size_t bytes) {
+	heap_size = bytes;
+}
+
+void *shim_malloc(size_t size) {
+	if (heap_used+size+BLOCK_OVERHEAD > heap_size) {
+		shim_counters.failed_mallocs++;
+		return NULL;
+	}
+	BlockHeader *header = malloc(sizeof(BlockHeader)+size);
+	if (header == NULL)
+		return NULL;
+	header->size = size;
+	header->generation = heap_generation;
+	heap_used += size+BLOCK_OVERHEAD;
+	shim_counters.mallocs++;
+	shim_counters.malloc_bytes += size;
+	if (heap_used > shim_counters.heap_peak)
+		shim_counters.heap_peak = heap_used;
+	return header+1;
+}
+
+void shim_free(void *ptr) {
+	if (ptr == NULL)
+		return;
+	BlockHeader *header = ((BlockHeader*) ptr)-1;
+	if (header->generation == heap_generation) {
+		heap_used -= header->size+BLOCK_OVERHEAD;
+		shim_counters.frees++;
+	}
+	free(header);
+}
+
+void *shim_calloc(size_t count, size_t size) {
+	void *result = shim_malloc(count*size);
+	if (result != NULL)
+		memset(result, 0, count*size);
+	return result;
+}
+
+void *shim_realloc(void *ptr, size_t size) {
+	if (ptr == NULL)
+		return shim_malloc(size);
+	void *result = shim_malloc(size);
+	if (result == NULL)
+		return NULL;
+	size_t old_size = (((BlockHeader*) ptr)-1)->size;
+	memcpy(result, ptr, old_size < size ? old_size : size);
+	shim_free(ptr);
+	return result;
+}
+
+static void *count_app_malloc(void *result, size_t size) {
+	if (result != NULL) {
+		shim_counters.app_mallocs++;
+		shim_counters.app_malloc_bytes += size;
+	}
+	return result;
+}
+
+void *shim_app_malloc(size_t size) {
+	return count_app_malloc(shim_malloc(size), size);
+}
+
+void *shim_app_calloc(size_t count, size_t size) {
+	return count_app_malloc(shim_calloc(count, size), count*size);
+}
+
+void *shim_app_realloc(void *ptr, size_t size) {
+	return count_app_malloc(shim_realloc(ptr, size), size);
+}
+
+size_t heap_bytes_free(void) {
+	return heap_size-heap_used;
+}
+
+size_t heap_bytes_used(void) {
+	return heap_used;
+}
+
+//Events (timers, animation steps, message deliveries and acks), sorted by time
+typedef enum { EVENT_TIMER, EVENT_DELIVER, EVENT_OUTBOX_RESULT, EVENT_ANIMATION } EventType;
+
+struct AppTimer {
+	EventType type;
+	bool pending; //in the pending list
+	uint64_t at; //monotonic time to run at
+	uint64_t seq; //insertion order (for events at the same time)
+	AppTimerCallback callback; //EVENT_TIMER
+	void *data;
+	uint8_t *message; //EVENT_DELIVER (host memory)
+	size_t message_size;
+	AppMessageResult result; //EVENT_OUTBOX_RESULT
+	Animation *animation; //EVENT_ANIMATION
+	struct AppTimer *next; //next pending event
+	struct AppTimer *next_allocated; //all events are kept until shim_reset() (so that stale timer handles stay valid)
+};
+typedef struct AppTimer Event;
+
+static Event *pending_events = NULL;
+static Event *allocated_events = NULL;
+static uint64_t event_seq = 0;
+
+static Event *event_create(EventType type) {
+	Event *event = calloc(1, sizeof(Event));
+	event->type = type;
+	event->next_allocated = allocated_events;
+	allocated_events = event;
+	return event;
+}
+
+static void event_unschedule(Event *event) {
+	if (!event->pending)
+		return;
+	for (Event **e = &pending_events; *e != NULL; e = &(*e)->next) {
+		if (*e == event) {
+			*e = event->next;
+			break;
+		}
+	}
+	event->pending = false;
+}
+
+static void event_schedule(Event *event, uint64_t at) {
+	event_unschedule(event);
+	event->at = at;
+	event->seq = event_seq++;
+	Event **e = &pending_events;
+	while (*e != NULL && (*e)->at <= at)
+		e = &(*e)->next;
+	event->next = *e;
+	*e = event;
+	event->pending = true;
+}
+
+//Timers
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data) {
+	Event *event = event_create(EVENT_TIMER);
+	event->callback = callback;
+	event->data = callback_data;
+	event_schedule(event, mono_ms+timeout_ms);
+	shim_counters.timers_registered++;
+	return event;
+}
+
+bool app_timer_reschedule(AppTimer *timer_handle, uint32_t new_timeout_ms) {
+	if (timer_handle == NULL || !timer_handle->pending)
+		return false;
+	event_schedule(timer_handle, mono_ms+new_timeout_ms);
+	return true;
+}
+
+void app_timer_cancel(AppTimer *timer_handle) {
+	if (timer_handle != NULL)
+		event_unschedule(timer_handle);
+}
+
+//Services
+static TickHandler tick_handler = NULL;
+static TimeUnits tick_units = 0;
+static uint64_t next_tick_mono = 0;
+static struct tm last_tick_tm;
+static BatteryStateHandler battery_handler = NULL;
+static BatteryChargeState battery_state = {.charge_percent = 80, .is_charging = false, .is_plugged = false};
+static BluetoothConnectionHandler bluetooth_handler = NULL;
+static bool bluetooth_connected = true;
+static AccelTapHandler tap_handler = NULL;
+static bool is_24h_style = true;
+
+static void compute_next_tick() {
+	uint64_t wall = shim_now_ms();
+	next_tick_mono = (wall/60000+1)*60000-wall_offset_ms;
+}
+
+void tick_timer_service_subscribe(TimeUnits units, TickHandler handler) {
+	tick_handler = handler;
+	tick_units = units;
+	last_tick_tm = *shim_localtime();
+	compute_next_tick();
+}
+
+void tick_timer_service_unsubscribe(void) {
+	tick_handler = NULL;
+}
+
+static void run_tick() {
+	struct tm now = *shim_localtime();
+	TimeUnits changed = SECOND_UNIT|MINUTE_UNIT;
+	if (now.tm_hour != last_tick_tm.tm_hour || now.tm_yday != last_tick_tm.tm_yday || now.tm_year != last_tick_tm.tm_year)
+		changed |= HOUR_UNIT;
+	if (now.tm_yday != last_tick_tm.tm_yday || now.tm_year != last_tick_tm.tm_year)
+		changed |= DAY_UNIT;
+	if (now.tm_mon != last_tick_tm.tm_mon || now.tm_year != last_tick_tm.tm_year)
+		changed |= MONTH_UNIT;
+	if (now.tm_year != last_tick_tm.tm_year)
+		changed |= YEAR_UNIT;
+	last_tick_tm = now;
+	shim_counters.ticks++;
+	tick_handler(&now, changed);
+}
+
+void clock_copy_time_string(char *buffer, uint8_t size) {
+	strftime(buffer, size, is_24h_style ? "%H:%M" : "%l:%M", shim_localtime());
+	if (buffer[0] == ' ')
+		memmove(buffer, buffer+1, strlen(buffer));
+}
+
+bool clock_is_24h_style(void) {
+	return is_24h_style;
+}
+
+void shim_set_24h_style(bool is_24h) {
+	is_24h_style = is_24h;
+}
+
+void battery_state_service_subscribe(BatteryStateHandler handler) {
+	battery_handler = handler;
+}
+
+void battery_state_service_unsubscribe(void) {
+	battery_handler = NULL;
+}
+
+BatteryChargeState battery_state_service_peek(void) {
+	return battery_state;
+}
+
+void shim_set_battery(uint8_t percent, bool charging) {
+	battery_state.charge_percent = percent;
+	battery_state.is_charging = charging;
+	battery_state.is_plugged = charging;
+	if (battery_handler != NULL)
+		battery_handler(battery_state);
+}
+
+void bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler) {
+	bluetooth_handler = handler;
+}
+
+void bluetooth_connection_service_unsubscribe(void) {
+	bluetooth_handler = NULL;
+}
+
+bool bluetooth_connection_service_peek(void) {
+	return bluetooth_connected;
+}
+
+void shim_set_connected(bool connected) {
+	if (connected == bluetooth_connected)
+		return;
+	bluetooth_connected = connected;
+	if (bluetooth_handler != NULL)
+		bluetooth_handler(connected);
+}
+
+void accel_tap_service_subscribe(AccelTapHandler handler) {
+	tap_handler = handler;
+}
+
+void accel_tap_service_unsubscribe(void) {
+	tap_handler = NULL;
+}
+
+void accel_data_service_subscribe(uint32_t samples_per_update, AccelDataHandler handler) {
+}
+
+void accel_data_service_unsubscribe(void) {
+}
+
+int accel_service_peek(AccelData *data) {
+	memset(data, 0, sizeof(AccelData));
+	data->z = -1000; //lying flat
+	data->timestamp = shim_now_ms();
+	return 0;
+}
+
+void shim_tap(AccelAxisType axis, int32_t direction) {
+	if (tap_handler != NULL)
+		tap_handler(axis, direction);
+}
+
+void vibes_short_pulse(void) {
+	shim_counters.vibes++;
+}
+
+void vibes_long_pulse(void) {
+	shim_counters.vibes++;
+}
+
+void vibes_double_pulse(void) {
+	shim_counters.vibes++;
+}
+
+void light_enable_interaction(void) {
+	shim_counters.lights++;
+}
+
+void light_enable(bool enable) {
+	shim_counters.lights++;
+}
+
+//Persistent storage
+typedef struct {
+	uint32_t key;
+	bool exists;
+	uint16_t size;
+	uint32_t writes; //kept after deletion (wear)
+	uint8_t data[PERSIST_DATA_MAX_LENGTH];
+} PersistEntry;
+#define SHIM_MAX_PERSIST_ENTRIES 1024
+static PersistEntry persist_entries[SHIM_MAX_PERSIST_ENTRIES];
+static int persist_num_entries = 0;
+
+static const ShimPersistModel default_persist_model = {
+	.read_us = 150, .read_byte_us = 1,
+	.write_us = 3000, .write_byte_us = 10,
+	.delete_us = 2000,
+	.storage_bytes = 4096,
+	.key_overhead_bytes = 0
+};
+
+static PersistEntry *persist_find(uint32_t key, bool create) {
+	for (int i=0;i<persist_num_entries;i++)
+		if (persist_entries[i].key == key)
+			return &persist_entries[i];
+	if (!create || persist_num_entries >= SHIM_MAX_PERSIST_ENTRIES)
+		return NULL;
+	PersistEntry *entry = &persist_entries[persist_num_entries++];
+	memset(entry, 0, sizeof(PersistEntry));
+	entry->key = key;
+	return entry;
+}
+
+uint32_t shim_persist_used_bytes() {
+	uint32_t result = 0;
+	for (int i=0;i<persist_num_entries;i++)
+		if (persist_entries[i].exists)
+			result += persist_entries[i].size+shim_persist_model.key_overhead_bytes;
+	return result;
+}
+
+int shim_persist_num_keys() {
+	int result = 0;
+	for (int i=0;i<persist_num_entries;i++)
+		if (persist_entries[i].exists)
+			result++;
+	return result;
+}
+
+uint32_t shim_persist_key_writes(uint32_t key) {
+	PersistEntry *entry = persist_find(key, false);
+	return entry == NULL ? 0 : entry->writes;
+}
+
+bool persist_exists(const uint32_t key) {
+	PersistEntry *entry = persist_find(key, false);
+	shim_counters.persist_us += shim_persist_model.read_us;
+	return entry != NULL && entry->exists;
+}
+
+int persist_get_size(const uint32_t key) {
+	PersistEntry *entry = persist_find(key, false);
+	return entry != NULL && entry->exists ? entry->size : E_DOES_NOT_EXIST;
+}
+
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size) {
+	PersistEntry *entry = persist_find(key, false);
+	shim_counters.persist_reads++;
+	shim_counters.persist_us += shim_persist_model.read_us;
+	if (entry == NULL || !entry->exists)
+		return E_DOES_NOT_EXIST;
+	size_t size = entry->size < buffer_size ? entry->size : buffer_size;
+	memcpy(buffer, entry->data, size);
+	shim_counters.persist_bytes_read += size;
+	shim_counters.persist_us += size*shim_persist_model.read_byte_us;
+	return (int) size;
+}
+
+int32_t persist_read_int(const uint32_t key) {
+	int32_t value = 0;
+	if (persist_read_data(key, &value, sizeof(value)) != sizeof(value))
+		return 0;
+	return value;
+}
+
+bool persist_read_bool(const uint32_t key) {
+	return persist_read_int(key) != 0;
+}
+
+int persist_read_string(const uint32_t key, char *buffer, const size_t buffer_size) {
+	int result = persist_read_data(key, buffer, buffer_size);
+	if (result > 0)
+		buffer[buffer_size-1] = 0;
+	return result;
+}
+
+int persist_write_data(const uint32_t key, const void *data, const size_t size) {
+	size_t written = size;
+	if (written > PERSIST_DATA_MAX_LENGTH) { //the watch only stores the beginning
+		shim_counters.persist_oversized_writes++;
+		written = PERSIST_DATA_MAX_LENGTH;
+	}
+	PersistEntry *entry = persist_find(key, true);
+	uint32_t used_otherwise = shim_persist_used_bytes()-(entry != NULL && entry->exists ? entry->size+shim_persist_model.key_overhead_bytes : 0);
+	if (entry == NULL || used_otherwise+written+shim_persist_model.key_overhead_bytes > shim_persist_model.storage_bytes) {
+		shim_counters.persist_failed_writes++;
+		return E_OUT_OF_STORAGE;
+	}
+	memcpy(entry->data, data, written);
+	entry->size = (uint16_t) written;
+	entry->exists = true;
+	entry->writes++;
+	shim_counters.persist_writes++;
+	shim_counters.persist_bytes_written += written;
+	shim_counters.persist_us += shim_persist_model.write_us+written*shim_persist_model.write_byte_us;
+	return (int) written;
+}
+
+status_t persist_write_int(const uint32_t key, const int32_t value) {
+	return persist_write_data(key, &value, sizeof(value));
+}
+
+status_t persist_write_bool(const uint32_t key, const bool value) {
+	int32_t v = value ? 1 : 0;
+	return persist_write_data(key, &v, 1) == 1 ? 1 : E_OUT_OF_STORAGE;
+}
+
+int persist_write_string(const uint32_t key, const char *cstring) {
+	return persist_write_data(key, cstring, strlen(cstring)+1);
+}
+
+status_t persist_delete(const uint32_t key) {
+	PersistEntry *entry = persist_find(key, false);
+	if (entry == NULL || !entry->exists)
+		return E_DOES_NOT_EXIST;
+	entry->exists = false;
+	shim_counters.persist_deletes++;
+	shim_counters.persist_us += shim_persist_model.delete_us;
+	return S_SUCCESS;
+}
+
+void shim_persist_write_raw(uint32_t key, const void *data, size_t size) {
+	PersistEntry *entry = persist_find(key, true);
+	if (entry == NULL)
+		return;
+	entry->size = (uint16_t) (size > PERSIST_DATA_MAX_LENGTH ? PERSIST_DATA_MAX_LENGTH : size);
+	memcpy(entry->data, data, entry->size);
+	entry->exists = true;
+}
+
+#define PERSIST_FILE_MAGIC 0x50455253
+bool shim_persist_save(const char *path) {
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+	uint32_t header[2] = {PERSIST_FILE_MAGIC, (uint32_t) persist_num_entries};
+	bool ok = fwrite(header, sizeof(header), 1, file) == 1 && fwrite(persist_entries, sizeof(PersistEntry), persist_num_entries, file) == (size_t) persist_num_entries;
+	return fclose(file) == 0 && ok;
+}
+
+bool shim_persist_load(const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return false;
+	uint32_t header[2];
+	bool ok = fread(header, sizeof(header), 1, file) == 1 && header[0] == PERSIST_FILE_MAGIC && header[1] <= SHIM_MAX_PERSIST_ENTRIES
+		&& fread(persist_entries, sizeof(PersistEntry), header[1], file) == header[1];
+	persist_num_entries = ok ? (int) header[1] : 0;
+	fclose(file);
+	return ok;
+}
+
+//Dictionaries (same layout as on the watch: count byte, then packed tuples)
+struct __attribute__((__packed__)) Dictionary {
+	uint8_t count;
+	uint8_t head[];
+};
+#define TUPLE_HEADER_SIZE 7
+
+uint32_t dict_calc_buffer_size(const uint8_t tuple_count, ...) {
+	uint32_t result = 1+tuple_count*TUPLE_HEADER_SIZE;
+	va_list args;
+	va_start(args, tuple_count);
+	for (int i=0;i<tuple_count;i++)
+		result += va_arg(args, uint32_t);
+	va_end(args);
+	return result;
+}
+
+DictionaryResult dict_write_begin(DictionaryIterator *iter, uint8_t *const buffer, const uint16_t size) {
+	if (iter == NULL || buffer == NULL || size < 1)
+		return DICT_INVALID_ARGS;
+	iter->dictionary = (Dictionary*) buffer;
+	iter->dictionary->count = 0;
+	iter->cursor = (Tuple*) iter->dictionary->head;
+	iter->end = buffer+size;
+	return DICT_OK;
+}
+
+static DictionaryResult dict_write_raw(DictionaryIterator *iter, uint32_t key, TupleType type, const void *data, uint16_t length) {
+	if (iter == NULL || iter->dictionary == NULL)
+		return DICT_INVALID_ARGS;
+	if ((uint8_t*) iter->cursor+TUPLE_HEADER_SIZE+length > (const uint8_t*) iter->end)
+		return DICT_NOT_ENOUGH_STORAGE;
+	iter->cursor->key = key;
+	iter->cursor->type = type;
+	iter->cursor->length = length;
+	memcpy(iter->cursor->value->data, data, length);
+	iter->cursor = (Tuple*) ((uint8_t*) iter->cursor+TUPLE_HEADER_SIZE+length);
+	iter->dictionary->count++;
+	return DICT_OK;
+}
+
+DictionaryResult dict_write_data(DictionaryIterator *iter, const uint32_t key, const uint8_t *const data, const uint16_t size) {
+	return dict_write_raw(iter, key, TUPLE_BYTE_ARRAY, data, size);
+}
+
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, const uint32_t key, const char *const cstring) {
+	return dict_write_raw(iter, key, TUPLE_CSTRING, cstring, cstring == NULL ? 0 : strlen(cstring)+1);
+}
+
+DictionaryResult dict_write_int(DictionaryIterator *iter, const uint32_t key, const void *integer, const uint8_t width_bytes, const bool is_signed) {
+	if (width_bytes != 1 && width_bytes != 2 && width_bytes != 4)
+		return DICT_INVALID_ARGS;
+	return dict_write_raw(iter, key, is_signed ? TUPLE_INT : TUPLE_UINT, integer, width_bytes); //(little endian host)
+}
+
+DictionaryResult dict_write_uint8(DictionaryIterator *iter, const uint32_t key, const uint8_t value) {
+	return dict_write_int(iter, key, &value, 1, false);
+}
+
+DictionaryResult dict_write_uint16(DictionaryIterator *iter, const uint32_t key, const uint16_t value) {
+	return dict_write_int(iter, key, &value, 2, false);
+}
+
+DictionaryResult dict_write_uint32(DictionaryIterator *iter, const uint32_t key, const uint32_t value) {
+	return dict_write_int(iter, key, &value, 4, false);
+}
+
+DictionaryResult dict_write_int8(DictionaryIterator *iter, const uint32_t key, const int8_t value) {
+	return dict_write_int(iter, key, &value, 1, true);
+}
+
+DictionaryResult dict_write_int16(DictionaryIterator *iter, const uint32_t key, const int16_t value) {
+	return dict_write_int(iter, key, &value, 2, true);
+}
+
+DictionaryResult dict_write_int32(DictionaryIterator *iter, const uint32_t key, const int32_t value) {
+	return dict_write_int(iter, key, &value, 4, true);
+}
+
+DictionaryResult dict_write_tuplet(DictionaryIterator *iter, const Tuplet *const tuplet) {
+	switch (tuplet->type) {
+		case TUPLE_BYTE_ARRAY:
+		return dict_write_data(iter, tuplet->key, tuplet->bytes.data, tuplet->bytes.length);
+		case TUPLE_CSTRING:
+		return dict_write_raw(iter, tuplet->key, TUPLE_CSTRING, tuplet->cstring.data, tuplet->cstring.length);
+		case TUPLE_INT:
+		case TUPLE_UINT:
+		return dict_write_int(iter, tuplet->key, &tuplet->integer.storage, (uint8_t) tuplet->integer.width, tuplet->type == TUPLE_INT);
+	}
+	return DICT_INVALID_ARGS;
+}
+
+uint32_t dict_write_end(DictionaryIterator *iter) {
+	if (iter == NULL || iter->dictionary == NULL)
+		return 0;
+	iter->end = iter->cursor;
+	return (uint32_t) ((uint8_t*) iter->cursor-(uint8_t*) iter->dictionary);
+}
+
+Tuple *dict_read_begin_from_buffer(DictionaryIterator *iter, const uint8_t *const buffer, const uint16_t size) {
+	if (iter == NULL || buffer == NULL || size < 1)
+		return NULL;
+	iter->dictionary = (Dictionary*) buffer;
+	iter->end = buffer+size;
+	return dict_read_first(iter);
+}
+
+static bool tuple_in_range(const DictionaryIterator *iter, const Tuple *tuple) {
+	return (const uint8_t*) tuple+TUPLE_HEADER_SIZE <= (const uint8_t*) iter->end && (const uint8_t*) tuple+TUPLE_HEADER_SIZE+tuple->length <= (const uint8_t*) iter->end;
+}
+
+Tuple *dict_read_first(DictionaryIterator *iter) {
+	iter->cursor = (Tuple*) iter->dictionary->head;
+	if (iter->dictionary->count == 0 || !tuple_in_range(iter, iter->cursor))
+		return NULL;
+	return iter->cursor;
+}
+
+Tuple *dict_read_next(DictionaryIterator *iter) {
+	Tuple *next = (Tuple*) ((uint8_t*) iter->cursor+TUPLE_HEADER_SIZE+iter->cursor->length);
+	if (!tuple_in_range(iter, next))
+		return NULL;
+	iter->cursor = next;
+	return next;
+}
+
+Tuple *dict_find(const DictionaryIterator *iter, const uint32_t key) {
+	DictionaryIterator copy = *iter;
+	for (Tuple *tuple = dict_read_first(&copy); tuple != NULL; tuple = dict_read_next(&copy))
+		if (tuple->key == key)
+			return tuple;
+	return NULL;
+}
+
+//AppMessage
+static AppMessageInboxReceived inbox_received = NULL;
+static AppMessageInboxDropped inbox_dropped = NULL;
+static AppMessageOutboxSent outbox_sent = NULL;
+static AppMessageOutboxFailed outbox_failed = NULL;
+static uint8_t *inbox_buffer = NULL, *outbox_buffer = NULL; //in the app heap, like on the watch
+static uint32_t inbox_size = 0, outbox_size = 0;
+static DictionaryIterator outbox_iter;
+static bool outbox_begun = false, outbox_in_flight = false;
+static ShimPhoneHandler phone_handler = NULL;
+static void *phone_context = NULL;
+static uint32_t link_latency_ms = 0, link_loss_permille = 0, link_random = 1;
+
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound) {
+	if (inbox_buffer != NULL)
+		return APP_MSG_INVALID_ARGS;
+	inbox_buffer = shim_malloc(size_inbound);
+	outbox_buffer = shim_malloc(size_outbound);
+	if (inbox_buffer == NULL || outbox_buffer == NULL)
+		return APP_MSG_OUT_OF_MEMORY;
+	inbox_size = size_inbound;
+	outbox_size = size_outbound;
+	return APP_MSG_OK;
+}
+
+void app_message_deregister_callbacks(void) {
+	inbox_received = NULL;
+	inbox_dropped = NULL;
+	outbox_sent = NULL;
+	outbox_failed = NULL;
+}
+
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived received_callback) {
+	AppMessageInboxReceived previous = inbox_received;
+	inbox_received = received_callback;
+	return previous;
+}
+
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped dropped_callback) {
+	AppMessageInboxDropped previous = inbox_dropped;
+	inbox_dropped = dropped_callback;
+	return previous;
+}
+
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent sent_callback) {
+	AppMessageOutboxSent previous = outbox_sent;
+	outbox_sent = sent_callback;
+	return previous;
+}
+
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed failed_callback) {
+	AppMessageOutboxFailed previous = outbox_failed;
+	outbox_failed = failed_callback;
+	return previous;
+}
+
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator) {
+	if (outbox_buffer == NULL)
+		return APP_MSG_INVALID_ARGS;
+	if (outbox_begun || outbox_in_flight)
+		return APP_MSG_BUSY;
+	dict_write_begin(&outbox_iter, outbox_buffer, (uint16_t) outbox_size);
+	outbox_begun = true;
+	*iterator = &outbox_iter;
+	return APP_MSG_OK;
+}
+
+AppMessageResult app_message_outbox_send(void) {
+	if (!outbox_begun)
+		return APP_MSG_INVALID_ARGS;
+	uint32_t size = dict_write_end(&outbox_iter);
+	outbox_begun = false;
+	outbox_in_flight = true;
+	shim_counters.messages_sent++;
+
+	Event *event = event_create(EVENT_OUTBOX_RESULT);
+	if (!bluetooth_connected)
+		event->result = APP_MSG_NOT_CONNECTED;
+	else
+		event->result = phone_handler == NULL ? APP_MSG_OK : phone_handler(outbox_buffer, size, phone_context);
+	event_schedule(event, mono_ms+link_latency_ms);
+	return APP_MSG_OK;
+}
+
+static void run_outbox_result(Event *event) {
+	outbox_in_flight = false;
+	DictionaryIterator iter;
+	iter.dictionary = (Dictionary*) outbox_buffer;
+	iter.end = outbox_iter.end;
+	iter.cursor = NULL;
+	if (event->result == APP_MSG_OK) {
+		if (outbox_sent != NULL)
+			outbox_sent(&iter, NULL);
+	}
+	else if (outbox_failed != NULL)
+		outbox_failed(&iter, event->result, NULL);
+}
+
+bool shim_outbox_in_flight() {
+	return outbox_in_flight;
+}
+
+void app_comm_set_sniff_interval(const SniffInterval interval) {
+}
+
+void shim_set_phone(ShimPhoneHandler handler, void *context) {
+	phone_handler = handler;
+	phone_context = context;
+}
+
+void shim_set_link(uint32_t latency_ms, uint32_t loss_permille, uint32_t seed) {
+	link_latency_ms = latency_ms;
+	link_loss_permille = loss_permille;
+	link_random = seed == 0 ? 1 : seed;
+}
+
+static uint32_t link_next_random() { //xorshift, so that runs are reproducible
+	link_random ^= link_random << 13;
+	link_random ^= link_random >> 17;
+	link_random ^= link_random << 5;
+	return link_random;
+}
+
+AppMessageResult shim_deliver(const uint8_t *data, size_t size, uint32_t delay_ms) {
+	if (!bluetooth_connected)
+		return APP_MSG_NOT_CONNECTED;
+	if (link_loss_permille != 0 && link_next_random()%1000 < link_loss_permille)
+		return APP_MSG_SEND_TIMEOUT;
+	Event *event = event_create(EVENT_DELIVER);
+	event->message = malloc(size);
+	memcpy(event->message, data, size);
+	event->message_size = size;
+	event_schedule(event, mono_ms+delay_ms+link_latency_ms);
+	return APP_MSG_OK;
+}
+
+static void run_deliver(Event *event) {
+	if (inbox_buffer == NULL || inbox_received == NULL)
+		return;
+	if (event->message_size > inbox_size) {
+		shim_counters.messages_dropped++;
+		if (inbox_dropped != NULL)
+			inbox_dropped(APP_MSG_BUFFER_OVERFLOW, NULL);
+		return;
+	}
+	memcpy(inbox_buffer, event->message, event->message_size);
+	DictionaryIterator iter;
+	dict_read_begin_from_buffer(&iter, inbox_buffer, (uint16_t) event->message_size);
+	shim_counters.messages_received++;
+	inbox_received(&iter, NULL);
+}
+
+//Fonts and resources
+struct ShimFont {
+	char key[40];
+	int height;
+	bool bold;
+	bool custom;
+};
+#define SHIM_MAX_SYSTEM_FONTS 16
+static struct ShimFont system_fonts[SHIM_MAX_SYSTEM_FONTS];
+static int num_system_fonts = 0;
+
+static int font_height_from_name(const char *name) { //first number in the name
+	while (*name != 0 && (*name < '0' || *name > '9'))
+		name++;
+	return *name == 0 ? 14 : atoi(name);
+}
+
+GFont fonts_get_system_font(const char *font_key) {
+	for (int i=0;i<num_system_fonts;i++)
+		if (strcmp(system_fonts[i].key, font_key) == 0)
+			return &system_fonts[i];
+	if (num_system_fonts >= SHIM_MAX_SYSTEM_FONTS)
+		return &system_fonts[0];
+	struct ShimFont *font = &system_fonts[num_system_fonts++];
+	snprintf(font->key, sizeof(font->key), "%s", font_key);
+	font->height = font_height_from_name(font_key);
+	font->bold = strstr(font_key, "BOLD") != NULL;
+	font->custom = false;
+	return font;
+}
+
+ResHandle resource_get_handle(uint32_t resource_id) {
+	return (ResHandle) (uintptr_t) resource_id;
+}
+
+GFont fonts_load_custom_font(ResHandle handle) {
+	struct ShimFont *font = shim_malloc(sizeof(struct ShimFont)); //custom fonts take heap on the watch as well
+	if (font == NULL)
+		return NULL;
+	uint32_t id = (uint32_t) (uintptr_t) handle;
+	snprintf(font->key, sizeof(font->key), "resource %u", (unsigned) id);
+	font->height = id == RESOURCE_ID_FONT_ROBOTO_CONDENSED_BOLD_40 ? 40 : 30;
+	font->bold = id == RESOURCE_ID_FONT_ROBOTO_CONDENSED_BOLD_40;
+	font->custom = true;
+	return font;
+}
+
+void fonts_unload_custom_font(GFont font) {
+	if (font != NULL && font->custom)
+		shim_free(font);
+}
+
+//Text measurement: fixed advance per glyph and line height per font size. Not pixel-exact, but deterministic and proportional to the text
+static int glyph_width(GFont font) {
+	int height = font == NULL ? 14 : font->height;
+	return (height*(font != NULL && font->bold ? 11 : 10)+10)/20;
+}
+
+static int text_line_height(GFont font) {
+	return ((font == NULL ? 14 : font->height)*7)/6;
+}
+
+static int utf8_length(const char *text, int bytes) {
+	int result = 0;
+	for (int i=0;i<bytes;i++)
+		if ((text[i] & 0xC0) != 0x80)
+			result++;
+	return result;
+}
+
+GSize graphics_text_layout_get_content_size(const char *text, const GFont font, const GRect box, const GTextOverflowMode overflow_mode, const GTextAlignment alignment) {
+	shim_counters.text_layouts++;
+	if (text == NULL || *text == 0)
+		return GSize(0, 0);
+	int glyph = glyph_width(font), line = text_line_height(font);
+	int max_lines = box.size.h/line < 1 ? 1 : box.size.h/line;
+	int lines = 1, x = 0, widest = 0;
+	const char *p = text;
+	while (*p != 0) {
+		if (*p == '\n') {
+			lines++;
+			x = 0;
+			p++;
+			continue;
+		}
+		int word_bytes = 0;
+		while (p[word_bytes] != 0 && p[word_bytes] != ' ' && p[word_bytes] != '\n')
+			word_bytes++;
+		int word_width = utf8_length(p, word_bytes)*glyph;
+		if (x != 0 && x+word_width > box.size.w) { //wrap before the word
+			lines++;
+			x = 0;
+		}
+		while (word_width > box.size.w && box.size.w > 0) { //break overlong words
+			lines++;
+			word_width -= box.size.w;
+			widest = box.size.w;
+		}
+		x += word_width;
+		if (x > widest)
+			widest = x;
+		p += word_bytes;
+		if (*p == ' ') {
+			x += glyph;
+			p++;
+		}
+	}
+	if (lines > max_lines)
+		lines = max_lines;
+	return GSize(widest > box.size.w ? box.size.w : widest, lines*line);
+}
+
+//Layers
+typedef enum { LAYER_KIND_PLAIN, LAYER_KIND_TEXT, LAYER_KIND_INVERTER, LAYER_KIND_WINDOW } LayerKind;
+
+struct Layer {
+	GRect frame, bounds;
+	Layer *parent, *first_child, *next_sibling;
+	bool clips, hidden;
+	LayerKind kind;
+};
+
+struct TextLayer {
+	Layer layer;
+	const char *text;
+	GFont font;
+	GColor background_color, text_color;
+	GTextOverflowMode overflow_mode;
+	GTextAlignment alignment;
+};
+
+struct InverterLayer {
+	Layer layer;
+};
+
+struct Window {
+	Layer root;
+	GColor background_color;
+};
+
+static Window *top_window = NULL;
+
+static void layer_init(Layer *layer, GRect frame, LayerKind kind) {
+	memset(layer, 0, sizeof(Layer));
+	layer->frame = frame;
+	layer->bounds = GRect(0, 0, frame.size.w, frame.size.h);
+	layer->clips = true;
+	layer->kind = kind;
+	shim_counters.layers_created++;
+}
+
+static void layer_deinit(Layer *layer) {
+	layer_remove_from_parent(layer);
+	for (Layer *child = layer->first_child; child != NULL; ) { //children stay alive, but lose their parent
+		Layer *next = child->next_sibling;
+		child->parent = NULL;
+		child->next_sibling = NULL;
+		child = next;
+	}
+	layer->first_child = NULL;
+	shim_counters.layers_destroyed++;
+}
+
+Layer *layer_create(GRect frame) {
+	Layer *layer = shim_malloc(sizeof(Layer));
+	if (layer != NULL)
+		layer_init(layer, frame, LAYER_KIND_PLAIN);
+	return layer;
+}
+
+void layer_destroy(Layer *layer) {
+	if (layer == NULL)
+		return;
+	layer_deinit(layer);
+	shim_free(layer);
+}
+
+void layer_add_child(Layer *parent, Layer *child) {
+	if (parent == NULL || child == NULL)
+		return;
+	layer_remove_from_parent(child);
+	Layer **last = &parent->first_child;
+	while (*last != NULL)
+		last = &(*last)->next_sibling;
+	*last = child;
+	child->parent = parent;
+}
+
+void layer_remove_from_parent(Layer *child) {
+	if (child == NULL || child->parent == NULL)
+		return;
+	for (Layer **l = &child->parent->first_child; *l != NULL; l = &(*l)->next_sibling) {
+		if (*l == child) {
+			*l = child->next_sibling;
+			break;
+		}
+	}
+	child->parent = NULL;
+	child->next_sibling = NULL;
+}
+
+void layer_set_frame(Layer *layer, GRect frame) {
+	layer->frame = frame;
+	layer->bounds.size = frame.size;
+}
+
+GRect layer_get_frame(const Layer *layer) {
+	return layer->frame;
+}
+
+void layer_set_bounds(Layer *layer, GRect bounds) {
+	layer->bounds = bounds;
+}
+
+GRect layer_get_bounds(const Layer *layer) {
+	return layer->bounds;
+}
+
+void layer_set_clips(Layer *layer, bool clips) {
+	layer->clips = clips;
+}
+
+void layer_set_hidden(Layer *layer, bool hidden) {
+	layer->hidden = hidden;
+}
+
+void layer_mark_dirty(Layer *layer) {
+}
+
+TextLayer *text_layer_create(GRect frame) {
+	TextLayer *text_layer = shim_malloc(sizeof(TextLayer));
+	if (text_layer == NULL)
+		return NULL;
+	layer_init(&text_layer->layer, frame, LAYER_KIND_TEXT);
+	text_layer->text = NULL;
+	text_layer->font = fonts_get_system_font(FONT_KEY_GOTHIC_14);
+	text_layer->background_color = GColorWhite;
+	text_layer->text_color = GColorBlack;
+	text_layer->overflow_mode = GTextOverflowModeWordWrap;
+	text_layer->alignment = GTextAlignmentLeft;
+	shim_counters.text_layers_created++;
+	return text_layer;
+}
+
+void text_layer_destroy(TextLayer *text_layer) {
+	if (text_layer == NULL)
+		return;
+	layer_deinit(&text_layer->layer);
+	shim_counters.text_layers_destroyed++;
+	shim_free(text_layer);
+}
+
+Layer *text_layer_get_layer(TextLayer *text_layer) {
+	return &text_layer->layer;
+}
+
+void text_layer_set_text(TextLayer *text_layer, const char *text) {
+	text_layer->text = text;
+}
+
+const char *text_layer_get_text(TextLayer *text_layer) {
+	return text_layer->text;
+}
+
+void text_layer_set_background_color(TextLayer *text_layer, GColor color) {
+	text_layer->background_color = color;
+}
+
+void text_layer_set_text_color(TextLayer *text_layer, GColor color) {
+	text_layer->text_color = color;
+}
+
+void text_layer_set_font(TextLayer *text_layer, GFont font) {
+	text_layer->font = font;
+}
+
+void text_layer_set_overflow_mode(TextLayer *text_layer, GTextOverflowMode line_mode) {
+	text_layer->overflow_mode = line_mode;
+}
+
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment text_alignment) {
+	text_layer->alignment = text_alignment;
+}
+
+InverterLayer *inverter_layer_create(GRect frame) {
+	InverterLayer *inverter_layer = shim_malloc(sizeof(InverterLayer));
+	if (inverter_layer != NULL)
+		layer_init(&inverter_layer->layer, frame, LAYER_KIND_INVERTER);
+	return inverter_layer;
+}
+
+void inverter_layer_destroy(InverterLayer *inverter_layer) {
+	if (inverter_layer == NULL)
+		return;
+	layer_deinit(&inverter_layer->layer);
+	shim_free(inverter_layer);
+}
+
+Layer *inverter_layer_get_layer(InverterLayer *inverter_layer) {
+	return &inverter_layer->layer;
+}
+
+Window *window_create(void) {
+	Window *window = shim_malloc(sizeof(Window));
+	if (window == NULL)
+		return NULL;
+	layer_init(&window->root, GRect(0, 0, 144, 168), LAYER_KIND_WINDOW);
+	window->background_color = GColorWhite;
+	return window;
+}
+
+void window_destroy(Window *window) {
+	if (window == NULL)
+		return;
+	if (top_window == window)
+		top_window = NULL;
+	layer_deinit(&window->root);
+	shim_free(window);
+}
+
+void window_stack_push(Window *window, bool animated) {
+	top_window = window;
+}
+
+void window_set_background_color(Window *window, GColor background_color) {
+	window->background_color = background_color;
+}
+
+Layer *window_get_root_layer(const Window *window) {
+	return (Layer*) &window->root;
+}
+
+Layer *shim_window_root() {
+	return top_window == NULL ? NULL : &top_window->root;
+}
+
+Layer *shim_layer_first_child(Layer *layer) {
+	return layer->first_child;
+}
+
+Layer *shim_layer_next_sibling(Layer *layer) {
+	return layer->next_sibling;
+}
+
+const char *shim_layer_text(Layer *layer) {
+	return layer->kind == LAYER_KIND_TEXT ? ((TextLayer*) layer)->text : NULL;
+}
+
+int shim_count_layers(Layer *root) {
+	if (root == NULL)
+		return 0;
+	int result = 1;
+	for (Layer *child = root->first_child; child != NULL; child = child->next_sibling)
+		result += shim_count_layers(child);
+	return result;
+}
+
+//Animations
+struct Animation {
+	uint32_t delay, duration;
+	AnimationHandlers handlers;
+	void *context;
+	const AnimationImplementation *implementation;
+	bool scheduled, started;
+	uint64_t started_at;
+	Event *event;
+	bool is_property; //property animation of a layer's frame
+	Layer *layer;
+	GRect from, to;
+};
+
+struct PropertyAnimation {
+	Animation animation;
+};
+
+static void animation_init(Animation *animation) {
+	memset(animation, 0, sizeof(Animation));
+	animation->duration = SHIM_DEFAULT_ANIMATION_MS;
+}
+
+Animation *animation_create(void) {
+	Animation *animation = shim_malloc(sizeof(Animation));
+	if (animation != NULL)
+		animation_init(animation);
+	return animation;
+}
+
+void animation_destroy(Animation *animation) {
+	if (animation == NULL)
+		return;
+	animation_unschedule(animation);
+	shim_free(animation);
+}
+
+void animation_set_delay(Animation *animation, uint32_t delay_ms) {
+	animation->delay = delay_ms;
+}
+
+void animation_set_duration(Animation *animation, uint32_t duration_ms) {
+	animation->duration = duration_ms;
+}
+
+void animation_set_handlers(Animation *animation, AnimationHandlers callbacks, void *context) {
+	animation->handlers = callbacks;
+	animation->context = context;
+}
+
+void animation_set_implementation(Animation *animation, const AnimationImplementation *implementation) {
+	animation->implementation = implementation;
+}
+
+void animation_schedule(Animation *animation) {
+	animation_unschedule(animation);
+	if (animation->event == NULL) {
+		animation->event = event_create(EVENT_ANIMATION);
+		animation->event->animation = animation;
+	}
+	animation->scheduled = true;
+	animation->started = false;
+	event_schedule(animation->event, mono_ms+animation->delay);
+}
+
+void animation_unschedule(Animation *animation) {
+	if (animation == NULL || !animation->scheduled)
+		return;
+	event_unschedule(animation->event);
+	animation->scheduled = false;
+	if (animation->handlers.stopped != NULL)
+		animation->handlers.stopped(animation, false, animation->context);
+}
+
+bool animation_is_scheduled(Animation *animation) {
+	return animation->scheduled;
+}
+
+static void run_animation(Animation *animation) {
+	if (!animation->started) {
+		animation->started = true;
+		animation->started_at = mono_ms;
+		if (animation->is_property)
+			layer_set_frame(animation->layer, animation->from);
+		if (animation->implementation != NULL && animation->implementation->setup != NULL)
+			animation->implementation->setup(animation);
+		if (animation->handlers.started != NULL)
+			animation->handlers.started(animation, animation->context);
+		if (!animation->scheduled) //unscheduled by the handler
+			return;
+	}
+
+	bool infinite = animation->duration == ANIMATION_DURATION_INFINITE;
+	uint64_t elapsed = mono_ms-animation->started_at;
+	if (infinite || elapsed < animation->duration) { //intermediate frame
+		if (animation->implementation != NULL && animation->implementation->update != NULL)
+			animation->implementation->update(animation, infinite ? 0 : (uint32_t) (elapsed*ANIMATION_NORMALIZED_MAX/animation->duration));
+		if (!animation->scheduled)
+			return;
+		uint64_t next = mono_ms+SHIM_ANIMATION_FRAME_MS;
+		if (animation->implementation == NULL || animation->implementation->update == NULL || (!infinite && next > animation->started_at+animation->duration)) //nothing to do until the end
+			next = infinite ? next : animation->started_at+animation->duration;
+		event_schedule(animation->event, next);
+		return;
+	}
+
+	//Finished
+	if (animation->is_property)
+		layer_set_frame(animation->layer, animation->to);
+	if (animation->implementation != NULL && animation->implementation->update != NULL)
+		animation->implementation->update(animation, ANIMATION_NORMALIZED_MAX);
+	if (animation->implementation != NULL && animation->implementation->teardown != NULL)
+		animation->implementation->teardown(animation);
+	animation->scheduled = false;
+	if (animation->handlers.stopped != NULL)
+		animation->handlers.stopped(animation, true, animation->context); //(may destroy the animation)
+}
+
+PropertyAnimation *property_animation_create_layer_frame(Layer *layer, GRect *from_frame, GRect *to_frame) {
+	PropertyAnimation *property_animation = shim_malloc(sizeof(PropertyAnimation));
+	if (property_animation == NULL)
+		return NULL;
+	Animation *animation = &property_animation->animation;
+	animation_init(animation);
+	animation->is_property = true;
+	animation->layer = layer;
+	animation->from = from_frame != NULL ? *from_frame : layer->frame;
+	animation->to = to_frame != NULL ? *to_frame : layer->frame;
+	return property_animation;
+}
+
+void property_animation_destroy(PropertyAnimation *property_animation) {
+	animation_destroy((Animation*) property_animation);
+}
+
+//Running the simulation
+static void run_event(Event *event) {
+	event->pending = false;
+	switch (event->type) {
+		case EVENT_TIMER:
+		shim_counters.timers_fired++;
+		event->callback(event->data);
+		break;
+
+		case EVENT_DELIVER:
+		run_deliver(event);
+		free(event->message);
+		event->message = NULL;
+		break;
+
+		case EVENT_OUTBOX_RESULT:
+		run_outbox_result(event);
+		break;
+
+		case EVENT_ANIMATION:
+		run_animation(event->animation);
+		break;
+	}
+}
+
+static void advance_to(uint64_t target) { //runs everything due until the monotonic time target
+	while (true) {
+		uint64_t event_at = pending_events != NULL ? pending_events->at : UINT64_MAX;
+		uint64_t tick_at = tick_handler != NULL ? next_tick_mono : UINT64_MAX;
+		if (event_at > target && tick_at > target)
+			break;
+		if (tick_at < event_at) {
+			mono_ms = tick_at;
+			compute_next_tick();
+			run_tick();
+		}
+		else {
+			Event *event = pending_events;
+			pending_events = event->next;
+			mono_ms = event_at > mono_ms ? event_at : mono_ms;
+			run_event(event);
+		}
+	}
+	if (target > mono_ms)
+		mono_ms = target;
+}
+
+void shim_advance(uint32_t ms) {
+	advance_to(mono_ms+ms);
+}
+
+void shim_run_until_idle(uint32_t max_ms) {
+	uint64_t end = mono_ms+max_ms;
+	while (pending_events != NULL && pending_events->at <= end)
+		advance_to(pending_events->at);
+}
+
+void shim_jump_clock(int32_t seconds) {
+	wall_offset_ms += (int64_t) seconds*1000;
+	if (tick_handler != NULL)
+		compute_next_tick();
+}
+
+//App lifecycle
+static ShimScenario scenario = NULL;
+static void *scenario_context = NULL;
+
+void shim_set_scenario(ShimScenario new_scenario, void *context) {
+	scenario = new_scenario;
+	scenario_context = context;
+}
+
+void app_event_loop(void) {
+	if (scenario != NULL)
+		scenario(scenario_context);
+}
+
+void shim_reset_counters() {
+	memset(&shim_counters, 0, sizeof(shim_counters));
+	shim_counters.heap_peak = heap_used;
+}
+
+void shim_reset(time_t start) {
+	setenv("TZ", "UTC", 1); //time() is local time on the watch
+	tzset();
+
+	while (allocated_events != NULL) {
+		Event *next = allocated_events->next_allocated;
+		free(allocated_events->message);
+		free(allocated_events);
+		allocated_events = next;
+	}
+	pending_events = NULL;
+	mono_ms = 0;
+	wall_offset_ms = (int64_t) start*1000;
+
+	heap_generation++;
+	heap_used = 0;
+	heap_size = SHIM_DEFAULT_HEAP_SIZE;
+
+	tick_handler = NULL;
+	battery_handler = NULL;
+	bluetooth_handler = NULL;
+	tap_handler = NULL;
+	bluetooth_connected = true;
+	battery_state = (BatteryChargeState) {.charge_percent = 80, .is_charging = false, .is_plugged = false};
+	is_24h_style = true;
+
+	app_message_deregister_callbacks();
+	inbox_buffer = outbox_buffer = NULL;
+	inbox_size = outbox_size = 0;
+	outbox_begun = outbox_in_flight = false;
+	phone_handler = NULL;
+	phone_context = NULL;
+	shim_set_link(0, 0, 1);
+
+	persist_num_entries = 0;
+	shim_persist_model = default_persist_model;
+	top_window = NULL;
+	scenario = NULL;
+	scenario_context = NULL;
+	shim_reset_counters();
+}
@@ -0,0 +1,86 @@
+#ifndef SHIM_H
+#define SHIM_H
+
+//Control of the simulated watch (see pebble_shim.c). Used by the host programs in test/, not by the watchface
+#include <pebble.h>
+
+//Everything the watchface did through the API since the last shim_reset() (or shim_reset_counters())
+typedef struct {
+	uint32_t layers_created, layers_destroyed; //all layer types
+	uint32_t text_layers_created, text_layers_destroyed;
+	uint32_t text_layouts; //graphics_text_layout_get_content_size() calls
+	uint32_t mallocs, frees;
+	uint32_t malloc_bytes; //bytes requested in total
+	uint32_t app_mallocs, app_malloc_bytes; //the part of mallocs/malloc_bytes that the watchface requested itself (without the SDK's objects: layers, fonts, buffers)
+	uint32_t failed_mallocs; //requests that didn't fit into the heap
+	uint32_t heap_peak; //peak of heap_bytes_used()
+	uint32_t persist_reads, persist_writes, persist_deletes;
+	uint32_t persist_bytes_read, persist_bytes_written;
+	uint32_t persist_oversized_writes; //writes above PERSIST_DATA_MAX_LENGTH (truncated)
+	uint32_t persist_failed_writes; //writes that didn't fit into the storage
+	uint64_t persist_us; //simulated time spent in persist_* (see ShimPersistModel)
+	uint32_t messages_sent, messages_received, messages_dropped;
+	uint32_t timers_registered, timers_fired;
+	uint32_t ticks; //minute ticks delivered
+	uint32_t vibes, lights;
+	uint32_t logs; //APP_LOG lines
+	uint32_t error_logs; //APP_LOG lines at APP_LOG_LEVEL_ERROR
+} ShimCounters;
+extern ShimCounters shim_counters;
+
+//Cost model of the persistent storage
+typedef struct {
+	uint32_t read_us, read_byte_us; //per read, per byte read
+	uint32_t write_us, write_byte_us; //per write (erase/program), per byte written
+	uint32_t delete_us;
+	uint32_t storage_bytes; //total storage of the app (keys and values)
+	uint32_t key_overhead_bytes; //storage used per key besides the value
+} ShimPersistModel;
+extern ShimPersistModel shim_persist_model;
+
+void shim_reset(time_t start); //fresh watch: empty heap, no timers, no handlers, empty storage, clock at start (local time, like on the watch)
+void shim_reset_counters();
+void shim_set_log_level(uint8_t level); //APP_LOG lines up to this level are printed (0: none, the default)
+void shim_set_heap_size(size_t bytes); //size of the simulated app heap (default: 24 KB)
+
+//Simulated clock. Advancing runs everything that is due in between: timers, animations, minute ticks, message deliveries
+uint64_t shim_now_ms();
+uint64_t shim_mono_ms(); //monotonic clock (not changed by shim_jump_clock()). For the phone side, whose clock doesn't jump with the watch's
+void shim_advance(uint32_t ms);
+void shim_run_until_idle(uint32_t max_ms); //advances until no timers/animations/deliveries are pending (or max_ms passed). Ticks don't count
+void shim_jump_clock(int32_t seconds); //sets the clock forward/back (like a time zone change on the phone) without running anything in between
+struct tm *shim_localtime();
+
+//Persistent storage
+uint32_t shim_persist_key_writes(uint32_t key); //number of writes to key so far (wear)
+uint32_t shim_persist_used_bytes();
+int shim_persist_num_keys();
+bool shim_persist_save(const char *path); //so that storage survives between (simulated) app launches in different processes
+bool shim_persist_load(const char *path);
+void shim_persist_write_raw(uint32_t key, const void *data, size_t size); //writes without counting (for setting up old data)
+
+//Communication. The phone side gets every message the watch sends and can deliver messages to the watch
+typedef AppMessageResult (*ShimPhoneHandler)(const uint8_t *data, size_t size, void *context); //returns whether the phone acks the message
+void shim_set_phone(ShimPhoneHandler handler, void *context);
+void shim_set_link(uint32_t latency_ms, uint32_t loss_permille, uint32_t seed); //latency of every delivery/ack, probability of losing an inbound message
+AppMessageResult shim_deliver(const uint8_t *data, size_t size, uint32_t delay_ms); //message from the phone, arriving after delay_ms. Not APP_MSG_OK if lost (the phone would get a timeout)
+void shim_set_connected(bool connected); //calls the Bluetooth handler if changed
+bool shim_outbox_in_flight();
+
+//Other input
+void shim_tap(AccelAxisType axis, int32_t direction);
+void shim_set_battery(uint8_t percent, bool charging);
+void shim_set_24h_style(bool is_24h);
+
+//App lifecycle: app_event_loop() calls the scenario (or returns right away if there is none)
+typedef void (*ShimScenario)(void *context);
+void shim_set_scenario(ShimScenario scenario, void *context);
+
+//Reading the layer tree
+Layer *shim_window_root();
+Layer *shim_layer_first_child(Layer *layer);
+Layer *shim_layer_next_sibling(Layer *layer);
+const char *shim_layer_text(Layer *layer); //text of a text layer (0 for other layers)
+int shim_count_layers(Layer *root); //root and all descendants
+
+#endif
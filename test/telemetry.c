@@ -0,0 +1,110 @@
+#include <pebble.h>
+#include <shim.h>
+#include <phone.h>
+#include <harness.h>
+#include <settings.h>
+
+//Stand-in receiver for the performance telemetry that the watch piggybacks onto sync requests (outgoing keys 5..13, see communication.c).
+//Runs the watchface against the stand-in phone, decodes what it reports and checks it against what the shim observed. Exits non-zero on failure
+
+static const char *stat_names[PHONE_NUM_STATS] = {"rebuilds", "last rebuild ms", "heap peak", "dropped inbound", "sync restarts", "persist bytes", "persist keys", "persist ms"};
+static int failures = 0;
+
+#define CHECK(condition, ...) do { if (!(condition)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+typedef struct {
+	PhoneReport first, second; //first request, and the one forced after the sync
+	uint32_t shim_heap_peak;
+	uint32_t outbox_size; //size of the second request
+	bool synced;
+} TelemetryResult;
+
+static uint32_t last_request_size = 0;
+static AppMessageResult recording_phone(const uint8_t *data, size_t size, void *context) {
+	last_request_size = size;
+	return phone_handle_message(data, size, context);
+}
+
+static bool telemetry_child(void *arg, void *result_ptr) {
+	size_t heap_size = *(size_t*) arg;
+	TelemetryResult *result = result_ptr;
+	memset(result, 0, sizeof(TelemetryResult));
+	static PhoneItem items[20];
+	harness_make_calendar(items, 20, HARNESS_START_TIME, 3);
+
+	shim_reset(HARNESS_START_TIME);
+	if (heap_size != 0)
+		shim_set_heap_size(heap_size);
+	Phone phone;
+	phone_init(&phone, items, 20, SETTINGS_BOOL_SHOW_CLOCK_HEADER);
+	shim_set_phone(recording_phone, &phone);
+	harness_launch();
+	result->synced = harness_sync(&phone);
+	result->first = phone.last_report;
+	shim_advance(5000); //background persist
+
+	//The phone asks for a request (to get fresh telemetry). With little heap, the sync above has been aborted and the watch asks again by itself
+	uint32_t requests = phone.requests;
+	if (heap_size == 0) {
+		uint8_t buffer[PHONE_INBOX_SIZE];
+		size_t size = phone_build_command(buffer, sizeof(buffer), PHONE_COMMAND_FORCE_REQUEST, 0);
+		shim_deliver(buffer, size, 0);
+		shim_advance(1000);
+	}
+	else
+		shim_advance(3*60*1000);
+	if (phone.requests == requests)
+		return false;
+	result->second = phone.last_report;
+	result->outbox_size = last_request_size;
+	result->shim_heap_peak = shim_counters.heap_peak;
+	harness_exit();
+	return true;
+}
+
+static void print_report(const char *name, const PhoneReport *report) {
+	printf("%s: version %u (compatible from %u), last sync id %u, %u items, hash %08x", name, report->version, report->backward_version, report->last_sync_id, report->num_items, (unsigned) report->content_hash);
+	if (report->keys & (1u << 13))
+		printf(", max items %u", report->max_items);
+	printf("\n");
+	for (int i=0;i<PHONE_NUM_STATS;i++)
+		printf("  %-16s %u\n", stat_names[i], report->stats[i]);
+}
+
+int main(int argc, char **argv) {
+	//Normal heap
+	size_t heap_size = 0;
+	TelemetryResult result;
+	if (!harness_fork(telemetry_child, &heap_size, &result, sizeof(result))) {
+		printf("FAIL: watchface run failed\n");
+		return 1;
+	}
+	print_report("first request", &result.first);
+	print_report("after sync", &result.second);
+	CHECK(result.synced, "no sync");
+	CHECK((result.first.keys & 0x1FFF) == 0x1FFF, "first request lacks keys (have %x)", (unsigned) result.first.keys);
+	CHECK((result.second.keys & 0x1FFF) == 0x1FFF, "second request lacks keys (have %x)", (unsigned) result.second.keys);
+	CHECK(!(result.second.keys & (1u << 13)), "max items sent without memory pressure");
+	CHECK(result.second.version == 14 && result.second.backward_version == 8, "versions");
+	CHECK(result.second.num_items == 20, "reported %u items", result.second.num_items);
+	CHECK(result.second.last_sync_id == 0, "forced request should report sync id 0");
+	CHECK(result.second.stats[0] >= 1, "no rebuild counted");
+	CHECK(result.second.stats[2] > 0 && result.second.stats[2] <= result.shim_heap_peak, "heap peak %u (shim saw %u)", result.second.stats[2], result.shim_heap_peak);
+	CHECK(result.second.stats[3] == 0 && result.second.stats[4] == 0, "drops/restarts on a clean link");
+	CHECK(result.second.stats[5] > 0 && result.second.stats[6] > 0, "persist cost not reported");
+	CHECK(result.outbox_size <= 136, "request needs %u bytes, outbox has 136", result.outbox_size);
+
+	//Low memory: the sync doesn't fit, so the watch asks for fewer items
+	heap_size = 6*1024;
+	if (!harness_fork(telemetry_child, &heap_size, &result, sizeof(result))) {
+		printf("FAIL: low memory run failed\n");
+		return 1;
+	}
+	print_report("low memory", &result.second);
+	CHECK(result.second.keys & (1u << 13), "no max items under memory pressure");
+	CHECK(result.second.max_items > 0 && result.second.max_items < 20, "max items %u", result.second.max_items);
+	CHECK(result.outbox_size <= 136, "request needs %u bytes, outbox has 136", result.outbox_size);
+
+	printf(failures == 0 ? "telemetry: all checks passed\n" : "telemetry: %d checks failed\n", failures);
+	return failures == 0 ? 0 : 1;
+}
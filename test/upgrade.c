@@ -0,0 +1,151 @@
+#include <pebble.h>
+#include <shim.h>
+#include <phone.h>
+#include <harness.h>
+#include <settings.h>
+#include <item_db.h>
+#include <persist_const.h>
+#include <unistd.h>
+
+//Upgrade path from the old persistence format (one uncompressed AgendaItem per key under PERSIST_DB_PREFIX|i, count under PERSIST_NUM_ELEMS)
+//to the codec stream (see item_db.c). Installs old-format storage with a last sync id that the phone still considers current, launches the
+//watchface and checks that the items are migrated (shown without a sync, persisted in the new format, old keys gone), and that the phone is
+//asked for everything when the old data can't be read completely. Exits non-zero on failure
+
+#define UP_NUM_ITEMS 6
+#define UP_SYNC_ID 7
+#define UP_SETTINGS SETTINGS_BOOL_SHOW_CLOCK_HEADER
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do { if (!(condition)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+typedef struct {
+	int num_stored; //old-format items actually in storage (fewer than announced: damaged)
+	char path[64]; //storage for the second launch
+} UpArgs;
+
+typedef struct {
+	int restored_items; //db_size() after the startup stages
+	bool texts_match, recurrence_cleared;
+	uint8_t reported_sync_id; //of the first sync request
+	uint32_t full_syncs, no_new_data; //phone answers
+	int final_items; //db_size() at exit
+	bool old_keys_gone, new_header_written;
+} UpResult;
+
+static void make_items(PhoneItem *phone_items, AgendaItem *old_items) {
+	harness_make_calendar(phone_items, UP_NUM_ITEMS, HARNESS_START_TIME, 4);
+	for (int i=0;i<UP_NUM_ITEMS;i++) {
+		phone_items[i].recurrence_rule = 0; //(the old format had none)
+		phone_items[i].recurrence_count = 0;
+		AgendaItem *item = &old_items[i];
+		memset(item, 0, sizeof(AgendaItem));
+		snprintf(item->row1text, sizeof(item->row1text), "%s", phone_items[i].text1);
+		snprintf(item->row2text, sizeof(item->row2text), "%s", phone_items[i].text2);
+		item->row1design = phone_items[i].design1;
+		item->row2design = phone_items[i].design2;
+		item->start_time = phone_items[i].start_time;
+		item->end_time = phone_items[i].end_time;
+		item->recurrence_rule = 0xA5; //padding in the old struct: whatever was in memory
+		item->recurrence_count = 0x5A;
+	}
+}
+
+static bool first_launch(void *arg, void *result_ptr) {
+	UpArgs *args = arg;
+	UpResult *result = result_ptr;
+	memset(result, 0, sizeof(UpResult));
+	static PhoneItem phone_items[UP_NUM_ITEMS];
+	static AgendaItem old_items[UP_NUM_ITEMS];
+	make_items(phone_items, old_items);
+
+	//Storage as the previous version left it
+	shim_reset(HARNESS_START_TIME);
+	uint8_t sync_id = UP_SYNC_ID;
+	persist_write_int(PERSIST_NUM_ELEMS, UP_NUM_ITEMS);
+	for (int i=0;i<args->num_stored;i++)
+		persist_write_data(PERSIST_DB_PREFIX|i, &old_items[i], sizeof(AgendaItem));
+	persist_write_data(PERSIST_LAST_SYNC_ID, &sync_id, sizeof(sync_id));
+	persist_write_int(PERSIST_BOOL_FLAG_SETTINGS, UP_SETTINGS);
+
+	//The phone's calendar didn't change since that sync
+	Phone phone;
+	phone_init(&phone, phone_items, UP_NUM_ITEMS, UP_SETTINGS);
+	phone.sync_id = UP_SYNC_ID;
+	shim_set_phone(phone_handle_message, &phone);
+	harness_launch();
+	result->restored_items = db_size();
+	result->texts_match = true;
+	result->recurrence_cleared = true;
+	for (int i=0;i<db_size();i++) {
+		result->texts_match = result->texts_match && strcmp(db_get(i)->row1text, old_items[i].row1text) == 0 && strcmp(db_get(i)->row2text, old_items[i].row2text) == 0;
+		result->recurrence_cleared = result->recurrence_cleared && db_get(i)->recurrence_rule == 0 && db_get(i)->recurrence_count == 0;
+	}
+
+	if (!harness_sync(&phone))
+		return false;
+	result->reported_sync_id = phone.last_report.last_sync_id;
+	result->full_syncs = phone.syncs;
+	result->no_new_data = phone.no_new_data;
+	shim_advance(5000); //background persist
+	result->final_items = db_size();
+	harness_exit();
+
+	result->old_keys_gone = !persist_exists(PERSIST_NUM_ELEMS);
+	for (int i=0;i<UP_NUM_ITEMS;i++)
+		result->old_keys_gone = result->old_keys_gone && !persist_exists(PERSIST_DB_PREFIX|i);
+	result->new_header_written = persist_exists(PERSIST_DB_HEADER);
+	return shim_persist_save(args->path);
+}
+
+static bool second_launch(void *arg, void *result_ptr) {
+	UpArgs *args = arg;
+	int *restored = result_ptr;
+	shim_reset(HARNESS_START_TIME+600);
+	if (!shim_persist_load(args->path))
+		return false;
+	harness_launch();
+	*restored = db_size();
+	harness_exit();
+	return true;
+}
+
+static void run(const char *name, int num_stored) {
+	UpArgs args = {.num_stored = num_stored};
+	snprintf(args.path, sizeof(args.path), "/tmp/upgrade_%d.bin", (int) getpid());
+	UpResult result;
+	int relaunch_items = 0;
+	bool ok = harness_fork(first_launch, &args, &result, sizeof(result)) && harness_fork(second_launch, &args, &relaunch_items, sizeof(relaunch_items));
+	unlink(args.path);
+	if (!ok) {
+		printf("FAIL: %s: watchface run failed\n", name);
+		failures++;
+		return;
+	}
+	printf("%s: %d of %d items migrated, first request reports sync id %u, phone answered %u full syncs / %u no new data, %d items at exit, %d after relaunch\n",
+		name, result.restored_items, UP_NUM_ITEMS, result.reported_sync_id, result.full_syncs, result.no_new_data, result.final_items, relaunch_items);
+
+	CHECK(result.restored_items == num_stored, "%s: %d items restored from the old format (%d stored)", name, result.restored_items, num_stored);
+	CHECK(result.texts_match, "%s: migrated texts differ", name);
+	CHECK(result.recurrence_cleared, "%s: old padding taken as recurrence", name);
+	if (num_stored == UP_NUM_ITEMS) //everything migrated: the sync id is still good
+		CHECK(result.reported_sync_id == UP_SYNC_ID && result.no_new_data == 1 && result.full_syncs == 0, "%s: expected a request with the old sync id, answered by no new data", name);
+	else //items lost: the phone has to send everything, although its calendar didn't change
+		CHECK(result.reported_sync_id == 0 && result.full_syncs == 1, "%s: expected a request with sync id 0 and a full sync", name);
+	CHECK(result.final_items == UP_NUM_ITEMS, "%s: %d items at exit", name, result.final_items);
+	CHECK(result.old_keys_gone, "%s: old-format keys left behind", name);
+	CHECK(result.new_header_written, "%s: nothing persisted in the new format", name);
+	CHECK(relaunch_items == UP_NUM_ITEMS, "%s: %d items after relaunch", name, relaunch_items);
+}
+
+int main(int argc, char **argv) {
+	run("complete", UP_NUM_ITEMS);
+	run("damaged", UP_NUM_ITEMS/2);
+	run("announced only", 0);
+	if (failures == 0)
+		printf("upgrade: all checks passed\n");
+	else
+		printf("upgrade: %d checks failed\n", failures);
+	return failures == 0 ? 0 : 1;
+}